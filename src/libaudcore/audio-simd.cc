@@ -0,0 +1,829 @@
+/*
+ * audio-simd.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Vectorized versions of the most common sample format conversions.  Only the
+ * native-endian signed formats are handled here; everything else (and the
+ * remainder of each buffer) goes through the scalar code in audio.cc.
+ *
+ * The kernels must produce bit-exact results compared to the scalar code.  In
+ * particular:
+ *  - Integer to float conversion is followed by multiplication by a power of
+ *    two, which is exact in both cases.
+ *  - Clamping uses max(x, low) followed by min(x, high), with the same operand
+ *    order (and hence the same NaN handling) as aud::clamp().
+ *  - Float to integer conversion uses the current rounding mode, which
+ *    audio_to_int() sets to FE_TONEAREST, just like lrintf().
+ *
+ * The one exception is the fused volume/soft clipping kernel, which computes
+ * the soft clipping curve in single precision and may therefore differ from
+ * audio_soft_clip() in the last bit. */
+
+#include "internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define USE_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) &&                           \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+#define S16_RANGE 0x8000
+#define S24_RANGE 0x800000
+#define S32_RANGE 0x80000000u
+#define S32_MAX 0x7fffff80 /* see pos_range() in audio.cc */
+
+#ifdef USE_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/* ---- SSE2 ---- */
+
+SSE2 static inline __m128i to_int_sse2(const float * in, __m128 scale,
+                                       __m128 low, __m128 high)
+{
+    __m128 f = _mm_mul_ps(_mm_loadu_ps(in), scale);
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(f, low), high));
+}
+
+SSE2 static int from_s16_sse2(const void * in_, float * out, int samples)
+{
+    auto in = (const int16_t *)in_;
+    const __m128 scale = _mm_set1_ps(1.0f / S16_RANGE);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+
+    return i;
+}
+
+SSE2 static int from_s24_sse2(const void * in_, float * out, int samples)
+{
+    auto in = (const int32_t *)in_;
+    const __m128 scale = _mm_set1_ps(1.0f / S24_RANGE);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+    {
+        /* ignore high byte (sign-extend from bit 23) */
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        x = _mm_srai_epi32(_mm_slli_epi32(x, 8), 8);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+
+    return i;
+}
+
+SSE2 static int from_s32_sse2(const void * in_, float * out, int samples)
+{
+    auto in = (const int32_t *)in_;
+    const __m128 scale = _mm_set1_ps(1.0f / S32_RANGE);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+
+    return i;
+}
+
+SSE2 static int to_s16_sse2(const float * in, void * out_, int samples)
+{
+    auto out = (int16_t *)out_;
+    const __m128 scale = _mm_set1_ps(S16_RANGE);
+    const __m128 low = _mm_set1_ps(-S16_RANGE);
+    const __m128 high = _mm_set1_ps(S16_RANGE - 1);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i a = to_int_sse2(in + i, scale, low, high);
+        __m128i b = to_int_sse2(in + i + 4, scale, low, high);
+        /* values are already clamped, so saturation is a no-op */
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+
+    return i;
+}
+
+SSE2 static int to_s24_sse2(const float * in, void * out_, int samples)
+{
+    auto out = (int32_t *)out_;
+    const __m128 scale = _mm_set1_ps(S24_RANGE);
+    const __m128 low = _mm_set1_ps(-S24_RANGE);
+    const __m128 high = _mm_set1_ps(S24_RANGE - 1);
+    const __m128i mask = _mm_set1_epi32(0xffffff); /* zero high byte */
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128i x = to_int_sse2(in + i, scale, low, high);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_and_si128(x, mask));
+    }
+
+    return i;
+}
+
+SSE2 static int to_s32_sse2(const float * in, void * out_, int samples)
+{
+    auto out = (int32_t *)out_;
+    const __m128 scale = _mm_set1_ps(S32_RANGE);
+    const __m128 low = _mm_set1_ps(-(float)S32_RANGE);
+    const __m128 high = _mm_set1_ps(S32_MAX);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        _mm_storeu_si128((__m128i *)(out + i),
+                         to_int_sse2(in + i, scale, low, high));
+
+    return i;
+}
+
+/* For stereo interlacing, 32-bit words are shuffled as floats, which is safe
+ * since shuffles never modify the bit patterns. */
+
+SSE2 static int interlace_stereo_32_sse2(const void * const * in, void * out_,
+                                         int frames)
+{
+    auto left = (const float *)in[0];
+    auto right = (const float *)in[1];
+    auto out = (float *)out_;
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+    }
+
+    return i;
+}
+
+SSE2 static int interlace_stereo_16_sse2(const void * const * in, void * out_,
+                                         int frames)
+{
+    auto left = (const int16_t *)in[0];
+    auto right = (const int16_t *)in[1];
+    auto out = (int16_t *)out_;
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 8),
+                         _mm_unpackhi_epi16(l, r));
+    }
+
+    return i;
+}
+
+SSE2 static int deinterlace_stereo_32_sse2(const void * in_,
+                                           void * const * out, int frames)
+{
+    auto in = (const float *)in_;
+    auto left = (float *)out[0];
+    auto right = (float *)out[1];
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(in + 2 * i);
+        __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+
+    return i;
+}
+
+SSE2 static int deinterlace_stereo_16_sse2(const void * in_,
+                                           void * const * out, int frames)
+{
+    auto in = (const int16_t *)in_;
+    auto left = (int16_t *)out[0];
+    auto right = (int16_t *)out[1];
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 8));
+
+        /* sign-extend each half of the 32-bit frames, then pack them back
+         * together (without saturation, since the values are in range) */
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        __m128i ra = _mm_srai_epi32(a, 16);
+        __m128i rb = _mm_srai_epi32(b, 16);
+
+        _mm_storeu_si128((__m128i *)(left + i), _mm_packs_epi32(la, lb));
+        _mm_storeu_si128((__m128i *)(right + i), _mm_packs_epi32(ra, rb));
+    }
+
+    return i;
+}
+
+/* Soft clipping is done as min(|x|, line1, ..., line4, 1), which is equal to
+ * the piecewise function in audio.cc since its slopes are decreasing.  The
+ * constant comes last so that NaN input (which fails every comparison in the
+ * scalar code) also gives 1, and the sign is applied as in the scalar code. */
+SSE2 static inline __m128 line_sse2(__m128 y, float a, float b)
+{
+    return _mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(a)), _mm_set1_ps(b));
+}
+
+SSE2 static inline __m128 soft_clip_sse2(__m128 x)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 y = _mm_andnot_ps(sign, x);
+
+    __m128 r = _mm_min_ps(y, line_sse2(y, 0.8f, 0.08f));
+    r = _mm_min_ps(r, line_sse2(y, 0.7f, 0.15f));
+    r = _mm_min_ps(r, line_sse2(y, 0.4f, 0.45f));
+    r = _mm_min_ps(r, line_sse2(y, 0.15f, 0.775f));
+    r = _mm_min_ps(r, _mm_set1_ps(1.0f));
+
+    __m128 pos = _mm_cmpgt_ps(x, _mm_setzero_ps());
+    return _mm_xor_ps(r, _mm_andnot_ps(pos, sign));
+}
+
+SSE2 static int amplify_clip_sse2(float * data, int samples, float left,
+                                  float right, bool clip)
+{
+    const __m128 factors = _mm_setr_ps(left, right, left, right);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(data + i), factors);
+        _mm_storeu_ps(data + i, clip ? soft_clip_sse2(x) : x);
+    }
+
+    return i;
+}
+
+/* ---- AVX2 ---- */
+
+/* Packed 24-bit samples are expanded/compacted four at a time with a byte
+ * shuffle (an SSSE3 instruction, which every AVX2 processor supports). */
+
+AVX2 static inline __m128i unpack_s24_3(const uint8_t * in)
+{
+    const __m128i shuf =
+        _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    __m128i x = _mm_loadu_si128((const __m128i *)in);
+    return _mm_srai_epi32(_mm_shuffle_epi8(x, shuf), 8);
+}
+
+AVX2 static inline void pack_s24_3(__m128i x, uint8_t * out)
+{
+    const __m128i shuf =
+        _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    x = _mm_shuffle_epi8(x, shuf);
+
+    int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+    _mm_storel_epi64((__m128i *)out, x);
+    memcpy(out + 8, &last, 4);
+}
+
+AVX2 static inline __m256i to_int_avx2(const float * in, __m256 scale,
+                                       __m256 low, __m256 high)
+{
+    __m256 f = _mm256_mul_ps(_mm256_loadu_ps(in), scale);
+    return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(f, low), high));
+}
+
+AVX2 static int from_s16_avx2(const void * in_, float * out, int samples)
+{
+    auto in = (const int16_t *)in_;
+    const __m256 scale = _mm256_set1_ps(1.0f / S16_RANGE);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(f, scale));
+    }
+
+    return i;
+}
+
+AVX2 static int from_s24_avx2(const void * in_, float * out, int samples)
+{
+    auto in = (const int32_t *)in_;
+    const __m256 scale = _mm256_set1_ps(1.0f / S24_RANGE);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+        x = _mm256_srai_epi32(_mm256_slli_epi32(x, 8), 8);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+
+    return i;
+}
+
+AVX2 static int from_s32_avx2(const void * in_, float * out, int samples)
+{
+    auto in = (const int32_t *)in_;
+    const __m256 scale = _mm256_set1_ps(1.0f / S32_RANGE);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+
+    return i;
+}
+
+AVX2 static int from_s24_3_avx2(const void * in_, float * out, int samples)
+{
+    auto in = (const uint8_t *)in_;
+    const __m256 scale = _mm256_set1_ps(1.0f / S24_RANGE);
+
+    /* each 16-byte load reads 4 bytes past the 4 samples it converts, so make
+     * sure that we never read past the end of the buffer */
+    int i = 0;
+    for (; i + 10 <= samples; i += 8)
+    {
+        __m128i lo = unpack_s24_3(in + 3 * i);
+        __m128i hi = unpack_s24_3(in + 3 * i + 12);
+        __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+
+    return i;
+}
+
+AVX2 static int to_s16_avx2(const float * in, void * out_, int samples)
+{
+    auto out = (int16_t *)out_;
+    const __m256 scale = _mm256_set1_ps(S16_RANGE);
+    const __m256 low = _mm256_set1_ps(-S16_RANGE);
+    const __m256 high = _mm256_set1_ps(S16_RANGE - 1);
+
+    int i = 0;
+    for (; i + 16 <= samples; i += 16)
+    {
+        __m256i a = to_int_avx2(in + i, scale, low, high);
+        __m256i b = to_int_avx2(in + i + 8, scale, low, high);
+        /* packing works within 128-bit lanes; restore the original order */
+        __m256i x = _mm256_packs_epi32(a, b);
+        x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(out + i), x);
+    }
+
+    return i;
+}
+
+AVX2 static int to_s24_avx2(const float * in, void * out_, int samples)
+{
+    auto out = (int32_t *)out_;
+    const __m256 scale = _mm256_set1_ps(S24_RANGE);
+    const __m256 low = _mm256_set1_ps(-S24_RANGE);
+    const __m256 high = _mm256_set1_ps(S24_RANGE - 1);
+    const __m256i mask = _mm256_set1_epi32(0xffffff); /* zero high byte */
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m256i x = to_int_avx2(in + i, scale, low, high);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_and_si256(x, mask));
+    }
+
+    return i;
+}
+
+AVX2 static int to_s32_avx2(const float * in, void * out_, int samples)
+{
+    auto out = (int32_t *)out_;
+    const __m256 scale = _mm256_set1_ps(S32_RANGE);
+    const __m256 low = _mm256_set1_ps(-(float)S32_RANGE);
+    const __m256 high = _mm256_set1_ps(S32_MAX);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            to_int_avx2(in + i, scale, low, high));
+
+    return i;
+}
+
+AVX2 static int to_s24_3_avx2(const float * in, void * out_, int samples)
+{
+    auto out = (uint8_t *)out_;
+    const __m256 scale = _mm256_set1_ps(S24_RANGE);
+    const __m256 low = _mm256_set1_ps(-S24_RANGE);
+    const __m256 high = _mm256_set1_ps(S24_RANGE - 1);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m256i x = to_int_avx2(in + i, scale, low, high);
+        pack_s24_3(_mm256_castsi256_si128(x), out + 3 * i);
+        pack_s24_3(_mm256_extracti128_si256(x, 1), out + 3 * i + 12);
+    }
+
+    return i;
+}
+
+AVX2 static inline __m256 line_avx2(__m256 y, float a, float b)
+{
+    return _mm256_add_ps(_mm256_mul_ps(y, _mm256_set1_ps(a)),
+                         _mm256_set1_ps(b));
+}
+
+AVX2 static inline __m256 soft_clip_avx2(__m256 x)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 y = _mm256_andnot_ps(sign, x);
+
+    __m256 r = _mm256_min_ps(y, line_avx2(y, 0.8f, 0.08f));
+    r = _mm256_min_ps(r, line_avx2(y, 0.7f, 0.15f));
+    r = _mm256_min_ps(r, line_avx2(y, 0.4f, 0.45f));
+    r = _mm256_min_ps(r, line_avx2(y, 0.15f, 0.775f));
+    r = _mm256_min_ps(r, _mm256_set1_ps(1.0f));
+
+    __m256 pos = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+    return _mm256_xor_ps(r, _mm256_andnot_ps(pos, sign));
+}
+
+AVX2 static int amplify_clip_avx2(float * data, int samples, float left,
+                                  float right, bool clip)
+{
+    const __m256 factors =
+        _mm256_setr_ps(left, right, left, right, left, right, left, right);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(data + i), factors);
+        _mm256_storeu_ps(data + i, clip ? soft_clip_avx2(x) : x);
+    }
+
+    return i;
+}
+
+#endif // USE_X86
+
+#ifdef USE_NEON
+
+/* vmaxnm/vminnm return the numeric operand if the other one is NaN, which
+ * matches the scalar clamp for NaN input (result = low). */
+
+static inline int32x4_t to_int_neon(const float * in, float32x4_t scale,
+                                    float32x4_t low, float32x4_t high)
+{
+    float32x4_t f = vmulq_f32(vld1q_f32(in), scale);
+    return vcvtnq_s32_f32(vminnmq_f32(vmaxnmq_f32(f, low), high));
+}
+
+static int from_s16_neon(const void * in_, float * out, int samples)
+{
+    auto in = (const int16_t *)in_;
+    const float32x4_t scale = vdupq_n_f32(1.0f / S16_RANGE);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x8_t x = vld1q_s16(in + i);
+        int32x4_t lo = vmovl_s16(vget_low_s16(x));
+        int32x4_t hi = vmovl_s16(vget_high_s16(x));
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(lo), scale));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(hi), scale));
+    }
+
+    return i;
+}
+
+static int from_s24_neon(const void * in_, float * out, int samples)
+{
+    auto in = (const int32_t *)in_;
+    const float32x4_t scale = vdupq_n_f32(1.0f / S24_RANGE);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+    {
+        int32x4_t x = vshrq_n_s32(vshlq_n_s32(vld1q_s32(in + i), 8), 8);
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(x), scale));
+    }
+
+    return i;
+}
+
+static int from_s32_neon(const void * in_, float * out, int samples)
+{
+    auto in = (const int32_t *)in_;
+    const float32x4_t scale = vdupq_n_f32(1.0f / S32_RANGE);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(in + i)), scale));
+
+    return i;
+}
+
+static int from_s24_3_neon(const void * in_, float * out, int samples)
+{
+    auto in = (const uint8_t *)in_;
+    const float32x4_t scale = vdupq_n_f32(1.0f / S24_RANGE);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        /* split into low, middle, and high bytes */
+        uint8x8x3_t b = vld3_u8(in + 3 * i);
+        int16x8_t hi = vreinterpretq_s16_u16(vshll_n_u8(b.val[2], 8));
+        hi = vshrq_n_s16(hi, 8); /* sign-extend high byte */
+        uint16x8_t lo = vorrq_u16(vshll_n_u8(b.val[1], 8), vmovl_u8(b.val[0]));
+
+        int32x4_t x1 = vorrq_s32(vshlq_n_s32(vmovl_s16(vget_low_s16(hi)), 16),
+                                 vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lo))));
+        int32x4_t x2 = vorrq_s32(vshlq_n_s32(vmovl_s16(vget_high_s16(hi)), 16),
+                                 vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lo))));
+
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(x1), scale));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(x2), scale));
+    }
+
+    return i;
+}
+
+static int to_s16_neon(const float * in, void * out_, int samples)
+{
+    auto out = (int16_t *)out_;
+    const float32x4_t scale = vdupq_n_f32(S16_RANGE);
+    const float32x4_t low = vdupq_n_f32(-S16_RANGE);
+    const float32x4_t high = vdupq_n_f32(S16_RANGE - 1);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x4_t a = vmovn_s32(to_int_neon(in + i, scale, low, high));
+        int16x4_t b = vmovn_s32(to_int_neon(in + i + 4, scale, low, high));
+        vst1q_s16(out + i, vcombine_s16(a, b));
+    }
+
+    return i;
+}
+
+static int to_s24_neon(const float * in, void * out_, int samples)
+{
+    auto out = (int32_t *)out_;
+    const float32x4_t scale = vdupq_n_f32(S24_RANGE);
+    const float32x4_t low = vdupq_n_f32(-S24_RANGE);
+    const float32x4_t high = vdupq_n_f32(S24_RANGE - 1);
+    const int32x4_t mask = vdupq_n_s32(0xffffff); /* zero high byte */
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        vst1q_s32(out + i,
+                  vandq_s32(to_int_neon(in + i, scale, low, high), mask));
+
+    return i;
+}
+
+static int to_s32_neon(const float * in, void * out_, int samples)
+{
+    auto out = (int32_t *)out_;
+    const float32x4_t scale = vdupq_n_f32(S32_RANGE);
+    const float32x4_t low = vdupq_n_f32(-(float)S32_RANGE);
+    const float32x4_t high = vdupq_n_f32(S32_MAX);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+        vst1q_s32(out + i, to_int_neon(in + i, scale, low, high));
+
+    return i;
+}
+
+static int to_s24_3_neon(const float * in, void * out_, int samples)
+{
+    auto out = (uint8_t *)out_;
+    const float32x4_t scale = vdupq_n_f32(S24_RANGE);
+    const float32x4_t low = vdupq_n_f32(-S24_RANGE);
+    const float32x4_t high = vdupq_n_f32(S24_RANGE - 1);
+
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        int32x4_t x1 = to_int_neon(in + i, scale, low, high);
+        int32x4_t x2 = to_int_neon(in + i + 4, scale, low, high);
+
+        uint8x8x3_t b;
+        b.val[0] = vmovn_u16(vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(x1)),
+                                          vmovn_u32(vreinterpretq_u32_s32(x2))));
+        x1 = vshrq_n_s32(x1, 8);
+        x2 = vshrq_n_s32(x2, 8);
+        b.val[1] = vmovn_u16(vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(x1)),
+                                          vmovn_u32(vreinterpretq_u32_s32(x2))));
+        x1 = vshrq_n_s32(x1, 8);
+        x2 = vshrq_n_s32(x2, 8);
+        b.val[2] = vmovn_u16(vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(x1)),
+                                          vmovn_u32(vreinterpretq_u32_s32(x2))));
+
+        vst3_u8(out + 3 * i, b);
+    }
+
+    return i;
+}
+
+static int interlace_stereo_32_neon(const void * const * in, void * out,
+                                    int frames)
+{
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        uint32x4x2_t x = {{vld1q_u32((const uint32_t *)in[0] + i),
+                           vld1q_u32((const uint32_t *)in[1] + i)}};
+        vst2q_u32((uint32_t *)out + 2 * i, x);
+    }
+
+    return i;
+}
+
+static int interlace_stereo_16_neon(const void * const * in, void * out,
+                                    int frames)
+{
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        uint16x8x2_t x = {{vld1q_u16((const uint16_t *)in[0] + i),
+                           vld1q_u16((const uint16_t *)in[1] + i)}};
+        vst2q_u16((uint16_t *)out + 2 * i, x);
+    }
+
+    return i;
+}
+
+static int deinterlace_stereo_32_neon(const void * in, void * const * out,
+                                      int frames)
+{
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        uint32x4x2_t x = vld2q_u32((const uint32_t *)in + 2 * i);
+        vst1q_u32((uint32_t *)out[0] + i, x.val[0]);
+        vst1q_u32((uint32_t *)out[1] + i, x.val[1]);
+    }
+
+    return i;
+}
+
+static int deinterlace_stereo_16_neon(const void * in, void * const * out,
+                                      int frames)
+{
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        uint16x8x2_t x = vld2q_u16((const uint16_t *)in + 2 * i);
+        vst1q_u16((uint16_t *)out[0] + i, x.val[0]);
+        vst1q_u16((uint16_t *)out[1] + i, x.val[1]);
+    }
+
+    return i;
+}
+
+static inline float32x4_t line_neon(float32x4_t y, float a, float b)
+{
+    return vaddq_f32(vmulq_n_f32(y, a), vdupq_n_f32(b));
+}
+
+static inline float32x4_t soft_clip_neon(float32x4_t x)
+{
+    float32x4_t y = vabsq_f32(x);
+
+    float32x4_t r = vminq_f32(y, line_neon(y, 0.8f, 0.08f));
+    r = vminq_f32(r, line_neon(y, 0.7f, 0.15f));
+    r = vminq_f32(r, line_neon(y, 0.4f, 0.45f));
+    r = vminq_f32(r, line_neon(y, 0.15f, 0.775f));
+    r = vminnmq_f32(r, vdupq_n_f32(1.0f)); /* NaN -> 1 */
+
+    uint32x4_t pos = vcgtq_f32(x, vdupq_n_f32(0));
+    return vbslq_f32(pos, r, vnegq_f32(r));
+}
+
+static int amplify_clip_neon(float * data, int samples, float left,
+                             float right, bool clip)
+{
+    const float pattern[4] = {left, right, left, right};
+    const float32x4_t factors = vld1q_f32(pattern);
+
+    int i = 0;
+    for (; i + 4 <= samples; i += 4)
+    {
+        float32x4_t x = vmulq_f32(vld1q_f32(data + i), factors);
+        vst1q_f32(data + i, clip ? soft_clip_neon(x) : x);
+    }
+
+    return i;
+}
+
+#endif // USE_NEON
+
+static AudioKernels select_kernels()
+{
+    AudioKernels k = AudioKernels();
+    k.name = "scalar";
+
+#ifdef USE_X86
+    /* needed in case we are called from a static initializer */
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        k.name = "SSE2";
+        k.from_s16 = from_s16_sse2;
+        k.from_s24 = from_s24_sse2;
+        k.from_s32 = from_s32_sse2;
+        k.to_s16 = to_s16_sse2;
+        k.to_s24 = to_s24_sse2;
+        k.to_s32 = to_s32_sse2;
+        k.interlace_stereo_16 = interlace_stereo_16_sse2;
+        k.interlace_stereo_32 = interlace_stereo_32_sse2;
+        k.deinterlace_stereo_16 = deinterlace_stereo_16_sse2;
+        k.deinterlace_stereo_32 = deinterlace_stereo_32_sse2;
+        k.amplify_clip = amplify_clip_sse2;
+    }
+
+    /* the SSE2 (de)interlacing kernels are kept, since 256-bit shuffles
+     * would have to work across lanes and are no faster */
+    if (__builtin_cpu_supports("avx2"))
+    {
+        k.name = "AVX2";
+        k.from_s16 = from_s16_avx2;
+        k.from_s24 = from_s24_avx2;
+        k.from_s32 = from_s32_avx2;
+        k.from_s24_3 = from_s24_3_avx2;
+        k.to_s16 = to_s16_avx2;
+        k.to_s24 = to_s24_avx2;
+        k.to_s32 = to_s32_avx2;
+        k.to_s24_3 = to_s24_3_avx2;
+        k.amplify_clip = amplify_clip_avx2;
+    }
+#endif
+
+#ifdef USE_NEON
+    /* NEON is mandatory on AArch64 */
+    k.name = "NEON";
+    k.from_s16 = from_s16_neon;
+    k.from_s24 = from_s24_neon;
+    k.from_s32 = from_s32_neon;
+    k.from_s24_3 = from_s24_3_neon;
+    k.to_s16 = to_s16_neon;
+    k.to_s24 = to_s24_neon;
+    k.to_s32 = to_s32_neon;
+    k.to_s24_3 = to_s24_3_neon;
+    k.interlace_stereo_16 = interlace_stereo_16_neon;
+    k.interlace_stereo_32 = interlace_stereo_32_neon;
+    k.deinterlace_stereo_16 = deinterlace_stereo_16_neon;
+    k.deinterlace_stereo_32 = deinterlace_stereo_32_neon;
+    k.amplify_clip = amplify_clip_neon;
+#endif
+
+    return k;
+}
+
+const AudioKernels & audio_simd_kernels()
+{
+    static const AudioKernels kernels = select_kernels();
+    return kernels;
+}
@@ -23,6 +23,7 @@
 
 #define WANT_AUD_BSWAP
 #include "audio.h"
+#include "internal.h"
 #include "objects.h"
 
 #define SW_VOLUME_RANGE 40 /* decibels */
@@ -33,6 +34,9 @@ struct packed24_t
 };
 static_assert(sizeof(packed24_t) == 3, "invalid packed 24-bit type");
 
+/* selected once, according to the features of the CPU */
+static const AudioKernels & simd = audio_simd_kernels();
+
 template<class Word>
 void interlace_loop(const void * const * in, int channels, void * out,
                     int frames)
@@ -67,9 +71,50 @@ void deinterlace_loop(const void * in, int channels, void * const * out,
     }
 }
 
+/* runs the vectorized kernel, if any, and returns the number of frames done */
+static int interlace_simd(const void * const * in, int format, int channels,
+                          void * out, int frames)
+{
+    if (channels != 2)
+        return 0;
+
+    auto func = (FMT_SIZEOF(format) == 2)   ? simd.interlace_stereo_16
+                : (FMT_SIZEOF(format) == 4) ? simd.interlace_stereo_32
+                                            : nullptr;
+
+    return func ? func(in, out, frames) : 0;
+}
+
+static int deinterlace_simd(const void * in, int format, int channels,
+                            void * const * out, int frames)
+{
+    if (channels != 2)
+        return 0;
+
+    auto func = (FMT_SIZEOF(format) == 2)   ? simd.deinterlace_stereo_16
+                : (FMT_SIZEOF(format) == 4) ? simd.deinterlace_stereo_32
+                                            : nullptr;
+
+    return func ? func(in, out, frames) : 0;
+}
+
 EXPORT void audio_interlace(const void * const * in, int format, int channels,
                             void * out, int frames)
 {
+    const void * rest[2];
+    int done = interlace_simd(in, format, channels, out, frames);
+
+    if (done)
+    {
+        int size = FMT_SIZEOF(format);
+        rest[0] = (const char *)in[0] + size * done;
+        rest[1] = (const char *)in[1] + size * done;
+
+        in = rest;
+        out = (char *)out + size * channels * done;
+        frames -= done;
+    }
+
     switch (format)
     {
     case FMT_FLOAT:
@@ -111,6 +156,20 @@ EXPORT void audio_interlace(const void * const * in, int format, int channels,
 EXPORT void audio_deinterlace(const void * in, int format, int channels,
                               void * const * out, int frames)
 {
+    void * rest[2];
+    int done = deinterlace_simd(in, format, channels, out, frames);
+
+    if (done)
+    {
+        int size = FMT_SIZEOF(format);
+        rest[0] = (char *)out[0] + size * done;
+        rest[1] = (char *)out[1] + size * done;
+
+        in = (const char *)in + size * channels * done;
+        out = rest;
+        frames -= done;
+    }
+
     switch (format)
     {
     case FMT_FLOAT:
@@ -292,9 +351,63 @@ void to_int_loop(const float * in, void * out_, int samples)
     }
 }
 
+/* runs the vectorized kernel, if any, and returns the number of samples done */
+static int from_int_simd(const void * in, int format, float * out, int samples)
+{
+    int (*func)(const void *, float *, int) = nullptr;
+
+    switch (format)
+    {
+    case FMT_S16_NE:
+        func = simd.from_s16;
+        break;
+    case FMT_S24_NE:
+        func = simd.from_s24;
+        break;
+    case FMT_S32_NE:
+        func = simd.from_s32;
+        break;
+    case FMT_S24_3NE:
+        func = simd.from_s24_3;
+        break;
+    }
+
+    return func ? func(in, out, samples) : 0;
+}
+
+static inline int to_int_simd(const float * in, void * out, int format,
+                              int samples)
+{
+    int (*func)(const float *, void *, int) = nullptr;
+
+    switch (format)
+    {
+    case FMT_S16_NE:
+        func = simd.to_s16;
+        break;
+    case FMT_S24_NE:
+        func = simd.to_s24;
+        break;
+    case FMT_S32_NE:
+        func = simd.to_s32;
+        break;
+    case FMT_S24_3NE:
+        func = simd.to_s24_3;
+        break;
+    }
+
+    return func ? func(in, out, samples) : 0;
+}
+
 EXPORT void audio_from_int(const void * in, int format, float * out,
                            int samples)
 {
+    int done = from_int_simd(in, format, out, samples);
+
+    in = (const char *)in + FMT_SIZEOF(format) * done;
+    out += done;
+    samples -= done;
+
     switch (format)
     {
     case FMT_S8:
@@ -363,6 +476,12 @@ EXPORT void audio_to_int(const float * in, void * out, int format, int samples)
     int save = fegetround();
     fesetround(FE_TONEAREST);
 
+    int done = to_int_simd(in, out, format, samples);
+
+    in += done;
+    out = (char *)out + FMT_SIZEOF(format) * done;
+    samples -= done;
+
     switch (format)
     {
     case FMT_S8:
@@ -444,6 +563,15 @@ EXPORT void audio_amplify(float * data, int channels, int frames,
     }
 }
 
+/* converts a software volume level (0-100) to a linear factor */
+float audio_volume_factor(int volume)
+{
+    if (volume <= 0)
+        return 0;
+
+    return powf(10, (float)SW_VOLUME_RANGE * (volume - 100) / 100 / 20);
+}
+
 EXPORT void audio_amplify(float * data, int channels, int frames,
                           StereoVolume volume)
 {
@@ -453,16 +581,10 @@ EXPORT void audio_amplify(float * data, int channels, int frames,
     if (volume.left == 100 && volume.right == 100)
         return;
 
-    float lfactor = 0, rfactor = 0;
+    float lfactor = audio_volume_factor(volume.left);
+    float rfactor = audio_volume_factor(volume.right);
     float factors[AUD_MAX_CHANNELS];
 
-    if (volume.left > 0)
-        lfactor =
-            powf(10, (float)SW_VOLUME_RANGE * (volume.left - 100) / 100 / 20);
-    if (volume.right > 0)
-        rfactor =
-            powf(10, (float)SW_VOLUME_RANGE * (volume.right - 100) / 100 / 20);
-
     if (channels == 2)
     {
         factors[0] = lfactor;
@@ -479,28 +601,182 @@ EXPORT void audio_amplify(float * data, int channels, int frames,
 
 /* linear approximation of y = sin(x) */
 /* contributed by Anders Johansson */
+static inline float soft_clip(float x)
+{
+    float y = fabsf(x);
+
+    if (y <= 0.4)
+        ; /* (0, 0.4) -> (0, 0.4) */
+    else if (y <= 0.7)
+        y = 0.8 * y + 0.08; /* (0.4, 0.7) -> (0.4, 0.64) */
+    else if (y <= 1.0)
+        y = 0.7 * y + 0.15; /* (0.7, 1) -> (0.64, 0.85) */
+    else if (y <= 1.3)
+        y = 0.4 * y + 0.45; /* (1, 1.3) -> (0.85, 0.97) */
+    else if (y <= 1.5)
+        y = 0.15 * y + 0.775; /* (1.3, 1.5) -> (0.97, 1) */
+    else
+        y = 1.0; /* (1.5, inf) -> 1 */
+
+    return (x > 0) ? y : -y;
+}
+
 EXPORT void audio_soft_clip(float * data, int samples)
 {
     float * end = data + samples;
 
     while (data < end)
     {
-        float x = *data;
-        float y = fabsf(x);
-
-        if (y <= 0.4)
-            ; /* (0, 0.4) -> (0, 0.4) */
-        else if (y <= 0.7)
-            y = 0.8 * y + 0.08; /* (0.4, 0.7) -> (0.4, 0.64) */
-        else if (y <= 1.0)
-            y = 0.7 * y + 0.15; /* (0.7, 1) -> (0.64, 0.85) */
-        else if (y <= 1.3)
-            y = 0.4 * y + 0.45; /* (1, 1.3) -> (0.85, 0.97) */
-        else if (y <= 1.5)
-            y = 0.15 * y + 0.775; /* (1.3, 1.5) -> (0.97, 1) */
-        else
-            y = 1.0; /* (1.5, inf) -> 1 */
+        *data = soft_clip(*data);
+        data++;
+    }
+}
+
+/* Software volume and soft clipping in a single pass over the buffer.  The
+ * same factor is used for every channel unless there are exactly two. */
+void audio_amplify_clip(float * data, int channels, int frames, float left,
+                        float right, bool clip)
+{
+    if (channels != 2)
+        left = right = aud::max(left, right);
+
+    if (left == 1 && right == 1 && !clip)
+        return;
+
+    int samples = channels * frames;
+    int done = simd.amplify_clip
+                   ? simd.amplify_clip(data, samples, left, right, clip)
+                   : 0;
+
+    for (int i = done; i < samples; i++)
+    {
+        float x = data[i] * ((i & 1) ? right : left);
+        data[i] = clip ? soft_clip(x) : x;
+    }
+}
+
+/* Number of samples post-processed at a time.  Each block (8 KiB of floats,
+ * plus up to as much again of converted output) stays in the L1 cache while
+ * it goes through every step, instead of the whole buffer being streamed
+ * through memory once per step. */
+#define POST_BLOCK 2048
+
+typedef void (*ConvertFunc)(const float * in, void * out, int samples);
+
+template<int format, class Word, class Int = Word>
+void to_int_block(const float * in, void * out_, int samples)
+{
+    auto out = (Word *)out_;
+    int done = to_int_simd(in, out, format, samples);
+    to_int_loop<format, Word, Int>(in + done, out + done, samples - done);
+}
+
+template<ConvertFunc convert, int size>
+void post_process_loop(float * data, void * out, int channels, int frames,
+                       AudioFilterFunc filter, float left, float right,
+                       bool clip)
+{
+    /* keep whole frames in each block, and an even number of samples so that
+     * the stereo volume pattern is the same in each block */
+    int block = aud::max(1, POST_BLOCK / (2 * channels)) * 2 * channels;
+    int samples = channels * frames;
+
+    for (int i = 0; i < samples; i += block)
+    {
+        float * f = data + i;
+        int n = aud::min(block, samples - i);
+
+        if (filter)
+            filter(f, n);
+
+        audio_amplify_clip(f, channels, n / channels, left, right, clip);
+
+        if (size) /* not FMT_FLOAT */
+            convert(f, (char *)out + size * i, n);
+    }
+}
+
+/* Runs the filter (the equalizer), software volume, soft clipping, and
+ * conversion to the output format in a single blocked pass.  The data is
+ * modified in place; for FMT_FLOAT, out is not used. */
+void audio_post_process(float * data, void * out, int format, int channels,
+                        int frames, AudioFilterFunc filter, float left,
+                        float right, bool clip)
+{
+    int save = fegetround();
+    fesetround(FE_TONEAREST);
+
+#define POST(f, ...)                                                           \
+    post_process_loop<f, __VA_ARGS__>(data, out, channels, frames, filter,     \
+                                      left, right, clip)
+
+    switch (format)
+    {
+    case FMT_FLOAT:
+        POST(nullptr, 0);
+        break;
+
+    case FMT_S8:
+        POST((to_int_block<FMT_S8, int8_t>), 1);
+        break;
+    case FMT_U8:
+        POST((to_int_block<FMT_U8, int8_t>), 1);
+        break;
+
+    case FMT_S16_LE:
+        POST((to_int_block<FMT_S16_LE, int16_t>), 2);
+        break;
+    case FMT_S16_BE:
+        POST((to_int_block<FMT_S16_BE, int16_t>), 2);
+        break;
+    case FMT_U16_LE:
+        POST((to_int_block<FMT_U16_LE, int16_t>), 2);
+        break;
+    case FMT_U16_BE:
+        POST((to_int_block<FMT_U16_BE, int16_t>), 2);
+        break;
+
+    case FMT_S24_LE:
+        POST((to_int_block<FMT_S24_LE, int32_t>), 4);
+        break;
+    case FMT_S24_BE:
+        POST((to_int_block<FMT_S24_BE, int32_t>), 4);
+        break;
+    case FMT_U24_LE:
+        POST((to_int_block<FMT_U24_LE, int32_t>), 4);
+        break;
+    case FMT_U24_BE:
+        POST((to_int_block<FMT_U24_BE, int32_t>), 4);
+        break;
 
-        *data++ = (x > 0) ? y : -y;
+    case FMT_S32_LE:
+        POST((to_int_block<FMT_S32_LE, int32_t>), 4);
+        break;
+    case FMT_S32_BE:
+        POST((to_int_block<FMT_S32_BE, int32_t>), 4);
+        break;
+    case FMT_U32_LE:
+        POST((to_int_block<FMT_U32_LE, int32_t>), 4);
+        break;
+    case FMT_U32_BE:
+        POST((to_int_block<FMT_U32_BE, int32_t>), 4);
+        break;
+
+    case FMT_S24_3LE:
+        POST((to_int_block<FMT_S24_3LE, packed24_t, int32_t>), 3);
+        break;
+    case FMT_S24_3BE:
+        POST((to_int_block<FMT_S24_3BE, packed24_t, int32_t>), 3);
+        break;
+    case FMT_U24_3LE:
+        POST((to_int_block<FMT_U24_3LE, packed24_t, int32_t>), 3);
+        break;
+    case FMT_U24_3BE:
+        POST((to_int_block<FMT_U24_3BE, packed24_t, int32_t>), 3);
+        break;
     }
+
+#undef POST
+
+    fesetround(save);
 }
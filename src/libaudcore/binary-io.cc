@@ -0,0 +1,222 @@
+/*
+ * binary-io.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "binary-io.h"
+
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "audstrings.h"
+#include "tuple.h"
+
+#define END_OF_FIELDS 0xff
+
+uint64_t BinaryReader::number()
+{
+    uint64_t val = 0;
+
+    for (int shift = 0; shift < 64 && pos < end; shift += 7)
+    {
+        unsigned char c = *pos++;
+        val |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return val;
+    }
+
+    ok = false;
+    return 0;
+}
+
+int64_t BinaryReader::signed_number()
+{
+    uint64_t val = number();
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+const char * BinaryReader::bytes(uint64_t len)
+{
+    if (!ok || (uint64_t)(end - pos) < len)
+    {
+        ok = false;
+        return nullptr;
+    }
+
+    const char * p = pos;
+    pos += len;
+    return p;
+}
+
+void put_number(Index<char> & buf, uint64_t val)
+{
+    for (; val >= 0x80; val >>= 7)
+        buf.append((char)(val | 0x80));
+
+    buf.append((char)val);
+}
+
+void put_signed_number(Index<char> & buf, int64_t val)
+{
+    put_number(buf, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+void put_string(Index<char> & buf, const char * str)
+{
+    int len = strlen(str);
+    put_number(buf, len);
+    buf.insert(str, -1, len);
+}
+
+static bool is_derived(Tuple::Field field)
+{
+    switch (field)
+    {
+    case Tuple::Basename:
+    case Tuple::Path:
+    case Tuple::Suffix:
+    case Tuple::Subtune:
+    case Tuple::FormattedTitle:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void put_tuple(Index<char> & buf, const Tuple & tuple, uint64_t skip)
+{
+    for (auto field : Tuple::all_fields())
+    {
+        if (is_derived(field) || (skip & ((uint64_t)1 << field)) ||
+            !tuple.is_set(field))
+            continue;
+
+        buf.append((char)field);
+
+        if (Tuple::field_get_type(field) == Tuple::String)
+            put_string(buf, tuple.get_str(field));
+        else
+            put_signed_number(buf, tuple.get_int(field));
+    }
+
+    buf.append((char)END_OF_FIELDS);
+
+    short n_subtunes = tuple.get_n_subtunes();
+    put_number(buf, n_subtunes);
+
+    for (short i = 0; i < n_subtunes; i++)
+        put_signed_number(buf, tuple.get_nth_subtune(i));
+}
+
+bool read_tuple(BinaryReader & r, Tuple * tuple)
+{
+    while (1)
+    {
+        const char * field_byte = r.bytes(1);
+        if (!field_byte)
+            return false;
+
+        int field = (unsigned char)*field_byte;
+        if (field == END_OF_FIELDS)
+            break;
+        if (field >= Tuple::n_fields)
+            return false;
+
+        if (Tuple::field_get_type((Tuple::Field)field) == Tuple::String)
+        {
+            uint64_t len = r.number();
+            const char * str = r.bytes(len);
+            if (str && tuple)
+                tuple->set_str((Tuple::Field)field, str_copy(str, len));
+        }
+        else
+        {
+            int val = r.signed_number();
+            if (r.ok && tuple)
+                tuple->set_int((Tuple::Field)field, val);
+        }
+    }
+
+    uint64_t n_subtunes = r.number();
+    if (!r.ok || n_subtunes > SHRT_MAX)
+        return false;
+
+    Index<short> subtunes;
+    for (uint64_t i = 0; i < n_subtunes; i++)
+        subtunes.append(r.signed_number());
+
+    if (!r.ok)
+        return false;
+
+    if (tuple && n_subtunes)
+        tuple->set_subtunes(n_subtunes, subtunes.begin());
+
+    return true;
+}
+
+bool map_file(const char * path, MappedFile & file)
+{
+#ifdef _WIN32
+    char * contents;
+    gsize len;
+
+    if (!g_file_get_contents(path, &contents, &len, nullptr))
+        return false;
+
+    file = {contents, (int64_t)len};
+    return true;
+#else
+    int fd = g_open(path, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void * mapped = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (mapped == MAP_FAILED)
+        return false;
+
+    file = {(const char *)mapped, (int64_t)st.st_size};
+    return true;
+#endif
+}
+
+void unmap_file(MappedFile & file)
+{
+#ifdef _WIN32
+    g_free((char *)file.data);
+#else
+    munmap((void *)file.data, file.len);
+#endif
+
+    file = MappedFile();
+}
@@ -0,0 +1,69 @@
+/*
+ * binary-io.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_BINARY_IO_H
+#define LIBAUDCORE_BINARY_IO_H
+
+#include <stdint.h>
+
+#include "index.h"
+
+class Tuple;
+
+/* Helpers for the binary files kept in the user directory (the metadata cache
+ * and the playlist store).  Numbers are written in a variable-length encoding,
+ * 7 bits per byte, least significant first, with signed numbers zigzag-encoded
+ * (0, -1, 1, -2, ...).  Strings are written as a length followed by the bytes.
+ * Files are native-endian and not meant to be moved between machines. */
+
+struct BinaryReader
+{
+    const char * pos;
+    const char * end;
+    bool ok; /* false after reading past the end or an invalid number */
+
+    uint64_t number();
+    int64_t signed_number();
+    const char * bytes(uint64_t len);
+};
+
+void put_number(Index<char> & buf, uint64_t val);
+void put_signed_number(Index<char> & buf, int64_t val);
+void put_string(Index<char> & buf, const char * str);
+
+/* Writes the fields of a tuple, except those derived from the filename and
+ * those in the skip mask (1 << field for each), followed by its subtunes. */
+void put_tuple(Index<char> & buf, const Tuple & tuple, uint64_t skip = 0);
+
+/* Reads the fields written by put_tuple() into a tuple (whose filename should
+ * already be set), or only skips over them if the tuple is null.  The state of
+ * the tuple is not changed. */
+bool read_tuple(BinaryReader & r, Tuple * tuple);
+
+/* A file mapped read-only into memory (on Windows, read into memory). */
+struct MappedFile
+{
+    const char * data;
+    int64_t len;
+};
+
+bool map_file(const char * path, MappedFile & file);
+void unmap_file(MappedFile & file);
+
+#endif // LIBAUDCORE_BINARY_IO_H
@@ -47,8 +47,10 @@ static const char * const core_defaults[] = {
     /* equalizer */
     "eqpreset_default_file", "",
     "eqpreset_extension", "",
+    "equalizer_31band", "FALSE",
     "equalizer_active", "FALSE",
     "equalizer_bands", "0,0,0,0,0,0,0,0,0,0",
+    "equalizer_bands_31", "0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0",
     "equalizer_preamp", "0",
 
     /* info popup / info window */
@@ -75,8 +77,20 @@ static const char * const core_defaults[] = {
     "enable_clipping_prevention", "TRUE",
     "output_bit_depth", "-1",
     "output_buffer_size", "500",
+    "output_thread", "FALSE",
+    "output_thread_ahead", "250",
+    "effect_threads", "FALSE",
+    "low_latency", "FALSE",
+    "target_latency", "10",
+    "gapless_preroll", "FALSE",
+    "preroll_seconds", "5",
     "record", "FALSE",
     "record_stream", aud::numeric_string<(int) OutputStream::AfterReplayGain>::str,
+    "record_overflow", aud::numeric_string<(int) RecordOverflow::Grow>::str,
+    "record_queue_size", "1000",
+    "record_queue_max", "30000",
+    "resample_output", "FALSE",
+    "resample_quality", aud::numeric_string<(int) ResampleQuality::Medium>::str,
     "replay_gain_mode", aud::numeric_string<(int) ReplayGainMode::Track>::str,
     "replay_gain_preamp", "0",
     "soft_clipping", "FALSE",
@@ -107,6 +121,7 @@ static const char * const core_defaults[] = {
     "show_hours", "TRUE",
     "metadata_fallbacks", "TRUE",
     "metadata_on_play", "FALSE",
+    "scan_threads", "0",
     "show_numbers_in_pl", "FALSE",
     "slow_probe", "FALSE",
     /* clang-format on */
@@ -425,3 +440,45 @@ EXPORT double aud_get_double(const char * section, const char * name)
 {
     return str_to_double(aud_get_str(section, name));
 }
+
+static void read_value(const char * name, bool & value)
+{
+    value = aud_get_bool(name);
+}
+
+static void read_value(const char * name, int & value)
+{
+    value = aud_get_int(name);
+}
+
+static void read_value(const char * name, double & value)
+{
+    value = aud_get_double(name);
+}
+
+template<class T>
+void ConfigHandle<T>::update(void *, void * handle_)
+{
+    auto handle = (ConfigHandle<T> *)handle_;
+
+    T value;
+    read_value(handle->m_name, value);
+    handle->m_value.store(value, std::memory_order_relaxed);
+}
+
+template<class T>
+void ConfigHandle<T>::connect()
+{
+    hook_associate(str_concat({"set ", m_name}), update, this);
+    update(nullptr, this);
+}
+
+template<class T>
+void ConfigHandle<T>::disconnect()
+{
+    hook_dissociate(str_concat({"set ", m_name}), update, this);
+}
+
+template class ConfigHandle<bool>;
+template class ConfigHandle<int>;
+template class ConfigHandle<double>;
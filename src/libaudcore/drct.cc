@@ -77,9 +77,21 @@ EXPORT String aud_drct_get_filename()
 
 static PluginHandle * record_plugin;
 
+/* true if any output plugin is enabled for recording */
+static bool any_record_enabled()
+{
+    for (PluginHandle * plugin : aud_plugin_list(PluginType::Output))
+    {
+        if (plugin_get_enabled(plugin) == PluginEnabled::Secondary)
+            return true;
+    }
+
+    return false;
+}
+
 static bool record_plugin_watcher(PluginHandle *, void *)
 {
-    if (!aud_drct_get_record_enabled())
+    if (!any_record_enabled())
         aud_set_bool("record", false);
 
     hook_call("enable record", nullptr);
@@ -88,7 +100,7 @@ static bool record_plugin_watcher(PluginHandle *, void *)
 
 static void validate_record_setting(void *, void *)
 {
-    if (aud_get_bool("record") && !aud_drct_get_record_enabled())
+    if (aud_get_bool("record") && !any_record_enabled())
     {
         /* User attempted to start recording without a recording plugin enabled.
          * This is probably not the best response, but better than nothing. */
@@ -107,7 +119,7 @@ void record_init()
         aud_plugin_add_watch(plugin, record_plugin_watcher, nullptr);
     }
 
-    if (!aud_drct_get_record_enabled())
+    if (!any_record_enabled())
         aud_set_bool("record", false);
 
     hook_associate("set record", validate_record_setting, nullptr);
@@ -149,6 +161,15 @@ EXPORT bool aud_drct_enable_record(bool enable)
     return plugin_enable_secondary(record_plugin, enable);
 }
 
+EXPORT bool aud_drct_enable_record_plugin(PluginHandle * plugin, bool enable)
+{
+    if (aud_plugin_get_type(plugin) != PluginType::Output ||
+        plugin_get_enabled(plugin) == PluginEnabled::Primary)
+        return false;
+
+    return plugin_enable_secondary(plugin, enable);
+}
+
 /* --- VOLUME CONTROL --- */
 
 EXPORT int aud_drct_get_volume_main()
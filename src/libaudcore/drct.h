@@ -20,11 +20,14 @@
 #ifndef LIBAUDCORE_DRCT_H
 #define LIBAUDCORE_DRCT_H
 
+#include <stdint.h>
+
 #include <libaudcore/audio.h>
 #include <libaudcore/index.h>
 #include <libaudcore/tuple.h>
 
 class PluginHandle;
+enum class OutputStream;
 
 /* CAUTION: These functions are not thread safe. */
 
@@ -60,6 +63,12 @@ int aud_drct_get_time();
 int aud_drct_get_length();
 void aud_drct_seek(int time);
 
+/* Returns the measured latency of the audio output in milliseconds, that is,
+ * how long it will be until audio just returned by the decoder is heard.  This
+ * includes audio buffered by the core and by the output plugin, as well as any
+ * delay added by effect plugins. */
+int aud_drct_get_latency();
+
 /* "A-B repeat": when playback reaches point B, it returns to point A (where A
  * and B are in milliseconds).  The value -1 is interpreted as the beginning of
  * the song (for A) or the end of the song (for B).  A-B repeat is disabled
@@ -85,6 +94,28 @@ bool aud_drct_get_record_enabled();
  * Returns true on success, otherwise false. */
 bool aud_drct_enable_record(bool enable);
 
+/* Besides the recording plugin above, any other output plugins can record at
+ * the same time, each from its own point in the audio chain (by default, that
+ * given by the "record_stream" config option).  Recording plugins are started
+ * and stopped together by the "record" config option.  Returns true on
+ * success, otherwise false. */
+bool aud_drct_enable_record_plugin(PluginHandle * plugin, bool enable);
+OutputStream aud_drct_get_record_stream(PluginHandle * plugin);
+void aud_drct_set_record_stream(PluginHandle * plugin, OutputStream stream);
+
+/* Statistics of the queue feeding a recording plugin, counted in samples since
+ * recording was (re)started.  All zero if the plugin is not recording. */
+struct RecordStats
+{
+    int queued;      /* waiting to be written */
+    int size;        /* current size of the queue */
+    int64_t written; /* passed to the recording plugin */
+    int64_t dropped; /* dropped because the queue was full */
+    int64_t waits;   /* times playback had to wait for the queue */
+};
+
+RecordStats aud_drct_get_record_stats(PluginHandle * plugin);
+
 /* --- VOLUME CONTROL --- */
 
 StereoVolume aud_drct_get_volume();
@@ -23,28 +23,276 @@
 #include "list.h"
 #include "plugin.h"
 #include "plugins.h"
+#include "ringbuf.h"
 #include "runtime.h"
 #include "threads.h"
 
+/* In pipelined mode (the "effect_threads" setting), each effect is run by its
+ * own worker thread, and the effects are connected by short queues of chunks.
+ * effect_process() only feeds the first queue and returns whatever has come
+ * out of the last effect so far; the audio still in the pipeline is accounted
+ * for by effect_adjust_delay().  Effects flagged PluginStateless get several
+ * workers, which process consecutive chunks in parallel.  All the queues are
+ * protected by the same mutex as the effect list.
+ *
+ * A plugin's adjust_delay() cannot be called while a worker may be inside its
+ * process(), so the workers instead count the frames going into and coming out
+ * of each plugin; the difference is the audio held by the plugin itself. */
+
+static constexpr int MAX_WORKERS = 4;
+
+struct EffectJob
+{
+    Index<float> data;
+    bool taken = false, done = false;
+};
+
 struct Effect : public ListNode
 {
     PluginHandle * plugin;
     int position;
     EffectPlugin * header;
+    int channels_in, rate_in;
     int channels_returned, rate_returned;
     bool remove_flag;
+
+    /* pipelined mode */
+    RingBuf<EffectJob> jobs; /* input chunks, oldest first */
+    std::thread workers[MAX_WORKERS];
+    int n_workers, n_busy;
+    int64_t frames_in, frames_out; /* since the last flush */
 };
 
 static aud::mutex mutex;
+static aud::condvar cond;
 static List<Effect> effects;
 static int input_channels, input_rate;
 
+static bool pipelined;    /* worker threads are running */
+static bool pipe_changed; /* effects were added or removed */
+static bool pipe_hold;    /* workers should not start new jobs */
+static bool pipe_quit;    /* workers should exit */
+static int flush_count;
+static RingBuf<Index<float>> finished; /* output of the last effect */
+
+static bool is_parallel(Effect * e)
+{
+    return (e->header->info.flags & PluginStateless);
+}
+
+static int stage_depth(Effect * e) { return e->n_workers + 1; }
+
+/* effects without workers (added since the pipeline was started) are skipped */
+static Effect * next_stage(Effect * e)
+{
+    do
+        e = effects.next(e);
+    while (e && !e->n_workers);
+
+    return e;
+}
+
+static int samples_to_ms(int samples, int channels, int rate)
+{
+    return aud::rescale<int64_t>(samples / channels, rate, 1000);
+}
+
+static Index<float> & push_finished()
+{
+    if (!finished.space())
+        finished.alloc(aud::max(16, 2 * finished.len()));
+
+    return finished.push();
+}
+
+/* moves processed chunks along the pipeline, as far as there is room */
+static void pump(aud::mutex::holder &)
+{
+    // start from the end so that room is made for earlier stages
+    for (Effect * e = effects.tail(); e; e = effects.prev(e))
+    {
+        if (!e->n_workers)
+            continue;
+
+        Effect * next = next_stage(e);
+
+        while (e->jobs.len() && e->jobs.head().done)
+        {
+            auto & data = e->jobs.head().data;
+
+            if (data.len())
+            {
+                if (!next)
+                    push_finished() = std::move(data);
+                else if (next->jobs.len() < stage_depth(next))
+                    next->jobs.push(std::move(data));
+                else
+                    break;
+            }
+
+            e->jobs.pop();
+        }
+    }
+
+    cond.notify_all();
+}
+
+static void run_effect(Effect * e, Index<float> & data)
+{
+    if (is_parallel(e))
+    {
+        // stateless plugins are required to process in place
+        e->header->process(data);
+        return;
+    }
+
+    auto & out = e->header->process(data);
+
+    // give the plugin our buffer in exchange for its working buffer
+    if (&out != &data)
+        std::swap(out, data);
+}
+
+static void effect_worker(Effect * e)
+{
+    auto mh = mutex.take();
+
+    while (!pipe_quit)
+    {
+        EffectJob * job = nullptr;
+
+        for (int i = 0; i < e->jobs.len() && !pipe_hold; i++)
+        {
+            if (!e->jobs[i].taken)
+            {
+                job = &e->jobs[i];
+                break;
+            }
+        }
+
+        if (!job)
+        {
+            cond.wait(mh);
+            continue;
+        }
+
+        // the job stays at the same address while taken; the queue is never
+        // reallocated and only finished jobs are removed from it
+        job->taken = true;
+        e->n_busy++;
+
+        Index<float> data = std::move(job->data);
+        int in_frames = data.len() / e->channels_in;
+
+        mh.unlock();
+        run_effect(e, data);
+        mh.lock();
+
+        e->frames_in += in_frames;
+        e->frames_out += data.len() / e->channels_returned;
+
+        job->data = std::move(data);
+        job->done = true;
+        e->n_busy--;
+
+        pump(mh);
+    }
+}
+
+static void start_workers(aud::mutex::holder &)
+{
+    int parallel =
+        aud::clamp((int)std::thread::hardware_concurrency(), 1, MAX_WORKERS);
+
+    for (Effect * e = effects.head(); e; e = effects.next(e))
+    {
+        e->n_workers = is_parallel(e) ? parallel : 1;
+        e->n_busy = 0;
+        e->frames_in = e->frames_out = 0;
+        e->jobs.alloc(stage_depth(e));
+
+        for (int i = 0; i < e->n_workers; i++)
+            e->workers[i] = std::thread(effect_worker, e);
+    }
+}
+
+static void stop_workers(aud::mutex::holder & mh)
+{
+    Index<std::thread> threads;
+
+    for (Effect * e = effects.head(); e; e = effects.next(e))
+    {
+        for (int i = 0; i < e->n_workers; i++)
+            threads.append(std::move(e->workers[i]));
+
+        e->n_workers = 0;
+    }
+
+    pipe_quit = true;
+    cond.notify_all();
+
+    mh.unlock();
+
+    for (auto & thread : threads)
+        thread.join();
+
+    mh.lock();
+
+    pipe_quit = false;
+
+    for (Effect * e = effects.head(); e; e = effects.next(e))
+        e->jobs.destroy();
+}
+
+/* waits until all the queued audio has come out of the last effect */
+static void drain_pipeline(aud::mutex::holder & mh)
+{
+    auto in_flight = []() {
+        for (Effect * e = effects.head(); e; e = effects.next(e))
+        {
+            if (e->jobs.len())
+                return true;
+        }
+        return false;
+    };
+
+    while (in_flight())
+        cond.wait(mh);
+}
+
+static void stop_pipeline(aud::mutex::holder & mh)
+{
+    stop_workers(mh);
+    finished.destroy();
+
+    pipelined = false;
+    pipe_changed = false;
+}
+
+/* appends all the output of the last effect to <data> */
+static void take_finished(aud::mutex::holder &, Index<float> & data)
+{
+    while (finished.len())
+    {
+        if (!data.len())
+            data = finished.pop();
+        else
+        {
+            Index<float> chunk = finished.pop();
+            data.move_from(chunk, 0, -1, -1, true, true);
+        }
+    }
+}
+
 void effect_start(int & channels, int & rate)
 {
     auto mh = mutex.take();
 
     AUDDBG("Starting effects.\n");
 
+    if (pipelined)
+        stop_pipeline(mh);
+
     effects.clear();
 
     input_channels = channels;
@@ -65,9 +313,12 @@ void effect_start(int & channels, int & rate)
         if (!header)
             continue;
 
+        Effect * effect = new Effect();
+        effect->channels_in = channels;
+        effect->rate_in = rate;
+
         header->start(channels, rate);
 
-        Effect * effect = new Effect();
         effect->plugin = plugin;
         effect->position = i;
         effect->header = header;
@@ -76,11 +327,20 @@ void effect_start(int & channels, int & rate)
 
         effects.append(effect);
     }
+
+    /* each stage of the pipeline holds audio of its own, so the pipeline is
+     * not used in low-latency mode */
+    if (effects.head() && aud_get_bool("effect_threads") &&
+        !aud_get_bool("low_latency"))
+    {
+        AUDINFO("Starting effect threads.\n");
+        start_workers(mh);
+        pipelined = true;
+    }
 }
 
-Index<float> & effect_process(Index<float> & data)
+static Index<float> & process_serial(aud::mutex::holder &, Index<float> & data)
 {
-    auto mh = mutex.take();
     Index<float> * cur = &data;
 
     Effect * e = effects.head();
@@ -113,18 +373,113 @@ Index<float> & effect_process(Index<float> & data)
     return *cur;
 }
 
+/* restarts the workers after effects have been added or removed */
+static void rebuild_pipeline(aud::mutex::holder & mh)
+{
+    drain_pipeline(mh);
+    stop_workers(mh);
+
+    // let process_serial() finish and remove the effects being removed
+    Index<float> empty;
+    auto & tail = process_serial(mh, empty);
+
+    if (tail.len())
+        push_finished().insert(tail.begin(), 0, tail.len());
+
+    start_workers(mh);
+    pipe_changed = false;
+}
+
+static Index<float> & process_pipelined(aud::mutex::holder & mh,
+                                        Index<float> & data)
+{
+    if (pipe_changed)
+        rebuild_pipeline(mh);
+
+    Effect * first = effects.head();
+    if (first && !first->n_workers)
+        first = next_stage(first);
+
+    if (first)
+    {
+        // a flush while waiting for room means that this chunk is stale
+        int count = flush_count;
+        while (first->jobs.len() >= stage_depth(first) && flush_count == count)
+            cond.wait(mh);
+
+        if (flush_count == count && data.len())
+            first->jobs.push(std::move(data));
+        else
+            data.resize(0);
+
+        pump(mh);
+    }
+
+    Index<float> out;
+    take_finished(mh, out);
+
+    // with no effect left, the input is passed through
+    out.move_from(data, 0, -1, -1, true, true);
+    data = std::move(out);
+
+    return data;
+}
+
+Index<float> & effect_process(Index<float> & data)
+{
+    auto mh = mutex.take();
+
+    if (pipelined)
+        return process_pipelined(mh, data);
+
+    return process_serial(mh, data);
+}
+
 bool effect_flush(bool force)
 {
     auto mh = mutex.take();
     bool flushed = true;
 
+    if (pipelined)
+    {
+        // wait for the workers to put down what they are working on
+        auto busy = []() {
+            for (Effect * e = effects.head(); e; e = effects.next(e))
+            {
+                if (e->n_busy)
+                    return true;
+            }
+            return false;
+        };
+
+        pipe_hold = true;
+        while (busy())
+            cond.wait(mh);
+
+        flush_count++;
+    }
+
     for (Effect * e = effects.head(); e; e = effects.next(e))
     {
         if (!e->header->flush(force) && !force)
         {
+            // audio queued for this effect is kept, as if it were part of
+            // the plugin's own buffer
             flushed = false;
             break;
         }
+
+        e->jobs.discard();
+        e->frames_in = e->frames_out = 0;
+    }
+
+    if (pipelined)
+    {
+        if (flushed)
+            finished.discard();
+
+        pipe_hold = false;
+        pump(mh);
     }
 
     return flushed;
@@ -133,10 +488,28 @@ bool effect_flush(bool force)
 Index<float> & effect_finish(Index<float> & data, bool end_of_playlist)
 {
     auto mh = mutex.take();
+    Index<float> done;
+
+    if (pipelined)
+    {
+        // the workers are idle once the pipeline is drained
+        drain_pipeline(mh);
+        take_finished(mh, done);
+    }
+
     Index<float> * cur = &data;
 
     for (Effect * e = effects.head(); e; e = effects.next(e))
+    {
         cur = &e->header->finish(*cur, end_of_playlist);
+        e->frames_in = e->frames_out = 0;
+    }
+
+    if (done.len())
+    {
+        done.move_from(*cur, 0, -1, -1, true, true);
+        *cur = std::move(done);
+    }
 
     return *cur;
 }
@@ -145,12 +518,58 @@ int effect_adjust_delay(int delay)
 {
     auto mh = mutex.take();
 
+    if (pipelined)
+    {
+        int channels = input_channels, rate = input_rate;
+        if (effects.tail())
+        {
+            channels = effects.tail()->channels_returned;
+            rate = effects.tail()->rate_returned;
+        }
+
+        for (int i = 0; i < finished.len(); i++)
+            delay += samples_to_ms(finished[i].len(), channels, rate);
+    }
+
     for (Effect * e = effects.tail(); e; e = effects.prev(e))
-        delay = e->header->adjust_delay(delay);
+    {
+        // chunks already processed are in the output time domain
+        for (int i = 0; i < e->jobs.len(); i++)
+        {
+            if (e->jobs[i].done)
+                delay += samples_to_ms(e->jobs[i].data.len(),
+                                       e->channels_returned, e->rate_returned);
+        }
+
+        if (e->n_workers)
+        {
+            int held = aud::rescale<int64_t>(e->frames_in, e->rate_in, 1000) -
+                       aud::rescale<int64_t>(e->frames_out, e->rate_returned,
+                                             1000);
+            delay += aud::max(0, held);
+        }
+        else
+            delay = e->header->adjust_delay(delay);
+
+        for (int i = 0; i < e->jobs.len(); i++)
+        {
+            if (!e->jobs[i].done)
+                delay += samples_to_ms(e->jobs[i].data.len(), e->channels_in,
+                                       e->rate_in);
+        }
+    }
 
     return delay;
 }
 
+void effect_cleanup()
+{
+    auto mh = mutex.take();
+
+    if (pipelined)
+        stop_pipeline(mh);
+}
+
 static void effect_insert(aud::mutex::holder &, PluginHandle * plugin,
                           EffectPlugin * header)
 {
@@ -191,9 +610,13 @@ static void effect_insert(aud::mutex::holder &, PluginHandle * plugin,
 
     AUDINFO("Starting %s at %d channels, %d Hz.\n", aud_plugin_get_name(plugin),
             channels, rate);
-    header->start(channels, rate);
 
     Effect * effect = new Effect();
+    effect->channels_in = channels;
+    effect->rate_in = rate;
+
+    header->start(channels, rate);
+
     effect->plugin = plugin;
     effect->position = position;
     effect->header = header;
@@ -201,6 +624,9 @@ static void effect_insert(aud::mutex::holder &, PluginHandle * plugin,
     effect->rate_returned = rate;
 
     effects.insert_after(prev, effect);
+
+    if (pipelined)
+        pipe_changed = true;
 }
 
 static void effect_remove(aud::mutex::holder &, PluginHandle * plugin)
@@ -211,6 +637,9 @@ static void effect_remove(aud::mutex::holder &, PluginHandle * plugin)
         {
             AUDDBG("Removing %s without reset.\n", aud_plugin_get_name(plugin));
             e->remove_flag = true;
+
+            if (pipelined)
+                pipe_changed = true;
             return;
         }
     }
@@ -30,6 +30,8 @@
 #include <math.h>
 #include <string.h>
 
+#include <atomic>
+
 #include "audio.h"
 #include "audstrings.h"
 #include "hook.h"
@@ -40,6 +42,10 @@
  * Gives 4 dB suppression at Fc*2 and Fc/2 */
 #define Q 1.2247449f
 
+/* The 1/3-octave filters of the 31-band mode are made proportionally
+ * narrower, keeping the same amount of overlap between adjacent bands */
+#define Q31 (Q / 3)
+
 /* Center frequencies for band-pass filters (Hz) */
 /* These are not the historical WinAmp frequencies, because the IIR filters used
  * here are designed for each frequency to be twice the previous.  Using WinAmp
@@ -47,88 +53,147 @@
 static const float CF[AUD_EQ_NBANDS] = {31.25f, 62.5f, 125,  250,  500,
                                         1000,   2000,  4000, 8000, 16000};
 
+/* For the same reason, the 31-band center frequencies are exact powers of
+ * 2^(1/3), centered on 1 kHz, rather than the nominal ISO frequencies */
+static float CF31[AUD_EQ_NBANDS_31];
+
+#define MAX_BANDS AUD_EQ_NBANDS_31
+
+/* Channels are filtered in parallel, four at a time, using the GCC/Clang
+ * vector extensions (compiled to SSE on x86 and NEON on ARM).  The filter
+ * state is laid out per band and per group of four channels, so that each
+ * step of the cascade works on a whole group at once. */
+typedef float v4sf __attribute__((vector_size(16)));
+
+#define LANES 4
+#define MAX_GROUPS ((AUD_MAX_CHANNELS + LANES - 1) / LANES)
+
+/* Settings are passed from the main thread to the audio thread through a
+ * lock-free triple buffer, so that moving a slider never blocks (or is blocked
+ * by) the audio thread.  The writer fills the back slot and swaps it with the
+ * shared slot, setting the FRESH flag; the reader swaps the shared slot with
+ * its front slot only when the flag is set. */
+struct EqSettings
+{
+    bool active;
+    bool graphic31;
+    float gains[MAX_BANDS]; /* gain factor for each band */
+};
+
+#define FRESH 4
+
+static EqSettings settings[3];
+static std::atomic<int> shared_slot(1);
+static int front_slot = 0; /* owned by the audio thread */
+static int back_slot = 2;  /* owned by eq_update() */
+
+static aud::mutex update_mutex; /* serializes eq_update() */
+
+/* The filter state is only used by the audio thread, but the format may be
+ * changed from another thread while the audio thread is idle. */
 static aud::mutex mutex;
-static bool active;
 static int channels, rate;
-static float a[AUD_EQ_NBANDS][2]; /* A weights */
-static float b[AUD_EQ_NBANDS][2]; /* B weights */
-static float wqv[AUD_MAX_CHANNELS][AUD_EQ_NBANDS]
-                [2]; /* Circular buffer for W data */
-static float gv[AUD_MAX_CHANNELS]
-               [AUD_EQ_NBANDS]; /* Gain factor for each channel and band */
-static int K;                   /* Number of used EQ bands */
+static bool graphic31;       /* band layout currently set up */
+static v4sf a[MAX_BANDS][2]; /* A weights */
+static v4sf b[MAX_BANDS][2]; /* B weights */
+static v4sf wqv[MAX_BANDS][MAX_GROUPS][2]; /* Circular buffer for W data */
+static int K;                              /* Number of used EQ bands */
+
+static constexpr v4sf splat(float x) { return v4sf{x, x, x, x}; }
 
 /* 2nd order band-pass filter design */
-static void bp2(float * a, float * b, float fc)
+static void bp2(v4sf * a, v4sf * b, float fc, float q)
 {
     float th = 2 * (float)M_PI * fc;
-    float C = (1 - tanf(th * Q / 2)) / (1 + tanf(th * Q / 2));
+    float C = (1 - tanf(th * q / 2)) / (1 + tanf(th * q / 2));
 
-    a[0] = (1 + C) * cosf(th);
-    a[1] = -C;
-    b[0] = (1 - C) / 2;
-    b[1] = -1.005f;
+    a[0] = splat((1 + C) * cosf(th));
+    a[1] = splat(-C);
+    b[0] = splat((1 - C) / 2);
+    b[1] = splat(-1.005f);
 }
 
-void eq_set_format(int new_channels, int new_rate)
+static void setup_filters(aud::mutex::holder &)
 {
-    auto mh = mutex.take();
-
-    channels = new_channels;
-    rate = new_rate;
+    const float * cf = graphic31 ? CF31 : CF;
+    float q = graphic31 ? Q31 : Q;
 
     /* Calculate number of active filters: the center frequency must be less
-     * than rate/2Q to avoid singularities in the tangent used in bp2() */
-    K = AUD_EQ_NBANDS;
+     * than rate/2Q to avoid singularities in the tangent used in bp2(), and
+     * must also be below the Nyquist frequency */
+    float limit = aud::min((float)rate / (2.005f * q), (float)rate * 0.475f);
+
+    K = graphic31 ? AUD_EQ_NBANDS_31 : AUD_EQ_NBANDS;
 
-    while (K > 0 && CF[K - 1] > (float)rate / (2.005f * Q))
+    while (K > 0 && cf[K - 1] > limit)
         K--;
 
     /* Generate filter taps */
     for (int k = 0; k < K; k++)
-        bp2(a[k], b[k], CF[k] / (float)rate);
+        bp2(a[k], b[k], cf[k] / (float)rate, q);
 
     /* Reset state */
-    memset(wqv[0][0], 0, sizeof wqv);
+    memset(wqv, 0, sizeof wqv);
 }
 
-static void eq_set_bands_real(aud::mutex::holder &, double preamp,
-                              double * values)
+void eq_set_format(int new_channels, int new_rate)
 {
-    float adj[AUD_EQ_NBANDS];
+    auto mh = mutex.take();
 
-    for (int i = 0; i < AUD_EQ_NBANDS; i++)
-        adj[i] = preamp + values[i];
+    channels = new_channels;
+    rate = new_rate;
 
-    for (int c = 0; c < AUD_MAX_CHANNELS; c++)
-    {
-        for (int i = 0; i < AUD_EQ_NBANDS; i++)
-            gv[c][i] = powf(10, adj[i] / 20) - 1;
-    }
+    setup_filters(mh);
+}
+
+/* called from the audio thread only */
+static const EqSettings & get_settings()
+{
+    if (shared_slot.load(std::memory_order_relaxed) & FRESH)
+        front_slot = shared_slot.exchange(front_slot) & ~FRESH;
+
+    return settings[front_slot];
 }
 
 void eq_filter(float * data, int samples)
 {
     auto mh = mutex.take();
 
-    if (!active)
+    const EqSettings & set = get_settings();
+    if (!set.active)
         return;
 
-    for (int channel = 0; channel < channels; channel++)
+    if (set.graphic31 != graphic31)
     {
-        float * g = gv[channel]; /* Gain factor */
-        float * end = data + samples;
+        graphic31 = set.graphic31;
+        setup_filters(mh);
+    }
 
-        for (float * f = data + channel; f < end; f += channels)
+    v4sf g[MAX_BANDS]; /* Gain factor */
+    for (int k = 0; k < K; k++)
+        g[k] = splat(set.gains[k]);
+
+    int groups = (channels + LANES - 1) / LANES;
+
+    /* unused lanes are kept at zero */
+    float frame[MAX_GROUPS * LANES] = {};
+    float * end = data + samples;
+
+    for (float * f = data; f < end; f += channels)
+    {
+        memcpy(frame, f, sizeof(float) * channels);
+
+        for (int grp = 0; grp < groups; grp++)
         {
-            float yt = *f; /* Current input sample */
+            v4sf yt; /* Current input samples */
+            memcpy(&yt, frame + grp * LANES, sizeof yt);
 
             for (int k = 0; k < K; k++)
             {
                 /* Pointer to circular buffer wq */
-                float * wq = wqv[channel][k];
+                v4sf * wq = wqv[k][grp];
                 /* Calculate output from AR part of current filter */
-                float w = yt * b[k][0] + wq[0] * a[k][0] + wq[1] * a[k][1];
+                v4sf w = yt * b[k][0] + wq[0] * a[k][0] + wq[1] * a[k][1];
 
                 /* Calculate output from MA part of current filter */
                 yt += (w + wq[1] * b[k][1]) * g[k];
@@ -138,29 +203,58 @@ void eq_filter(float * data, int samples)
                 wq[0] = w;
             }
 
-            /* Calculate output */
-            *f = yt;
+            memcpy(frame + grp * LANES, &yt, sizeof yt);
         }
+
+        /* Calculate output */
+        memcpy(f, frame, sizeof(float) * channels);
+        memset(frame + channels, 0, sizeof(float) * (groups * LANES - channels));
     }
 }
 
 static void eq_update(void *, void *)
 {
-    auto mh = mutex.take();
+    auto uh = update_mutex.take();
 
-    active = aud_get_bool("equalizer_active");
+    EqSettings & set = settings[back_slot];
 
-    double values[AUD_EQ_NBANDS];
-    aud_eq_get_bands(values);
-    eq_set_bands_real(mh, aud_get_double("equalizer_preamp"), values);
+    set.active = aud_get_bool("equalizer_active");
+    set.graphic31 = aud_get_bool("equalizer_31band");
+
+    double values[MAX_BANDS];
+    int nbands;
+
+    if (set.graphic31)
+    {
+        aud_eq_get_bands_31(values);
+        nbands = AUD_EQ_NBANDS_31;
+    }
+    else
+    {
+        aud_eq_get_bands(values);
+        nbands = AUD_EQ_NBANDS;
+    }
+
+    double preamp = aud_get_double("equalizer_preamp");
+
+    for (int i = 0; i < nbands; i++)
+        set.gains[i] = powf(10, (preamp + values[i]) / 20) - 1;
+
+    /* publish the new settings */
+    back_slot = shared_slot.exchange(back_slot | FRESH) & ~FRESH;
 }
 
 void eq_init()
 {
+    for (int i = 0; i < AUD_EQ_NBANDS_31; i++)
+        CF31[i] = 1000 * powf(2, (i - 17) / 3.0f);
+
     eq_update(nullptr, nullptr);
     hook_associate("set equalizer_active", eq_update, nullptr);
     hook_associate("set equalizer_preamp", eq_update, nullptr);
     hook_associate("set equalizer_bands", eq_update, nullptr);
+    hook_associate("set equalizer_31band", eq_update, nullptr);
+    hook_associate("set equalizer_bands_31", eq_update, nullptr);
 }
 
 void eq_cleanup()
@@ -168,6 +262,8 @@ void eq_cleanup()
     hook_dissociate("set equalizer_active", eq_update);
     hook_dissociate("set equalizer_preamp", eq_update);
     hook_dissociate("set equalizer_bands", eq_update);
+    hook_dissociate("set equalizer_31band", eq_update);
+    hook_dissociate("set equalizer_bands_31", eq_update);
 }
 
 EXPORT void aud_eq_set_bands(const double values[AUD_EQ_NBANDS])
@@ -183,6 +279,19 @@ EXPORT void aud_eq_get_bands(double values[AUD_EQ_NBANDS])
     str_to_double_array(string, values, AUD_EQ_NBANDS);
 }
 
+EXPORT void aud_eq_set_bands_31(const double values[AUD_EQ_NBANDS_31])
+{
+    StringBuf string = double_array_to_str(values, AUD_EQ_NBANDS_31);
+    aud_set_str("equalizer_bands_31", string);
+}
+
+EXPORT void aud_eq_get_bands_31(double values[AUD_EQ_NBANDS_31])
+{
+    memset(values, 0, sizeof(double) * AUD_EQ_NBANDS_31);
+    String string = aud_get_str("equalizer_bands_31");
+    str_to_double_array(string, values, AUD_EQ_NBANDS_31);
+}
+
 EXPORT void aud_eq_set_band(int band, double value)
 {
     assert(band >= 0 && band < AUD_EQ_NBANDS);
@@ -207,6 +316,17 @@ EXPORT double aud_eq_get_band(int band)
     return values[band];
 }
 
+EXPORT void aud_eq_set_band_31(int band, double value)
+{
+    assert(band >= 0 && band < AUD_EQ_NBANDS_31);
+
+    /* same caveat as above */
+    double values[AUD_EQ_NBANDS_31];
+    aud_eq_get_bands_31(values);
+    values[band] = value;
+    aud_eq_set_bands_31(values);
+}
+
 EXPORT void aud_eq_apply_preset(const EqualizerPreset & preset)
 {
     double bands[AUD_EQ_NBANDS];
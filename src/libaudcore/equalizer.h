@@ -26,6 +26,7 @@
 class VFSFile;
 
 #define AUD_EQ_NBANDS 10
+#define AUD_EQ_NBANDS_31 31 /* 1/3-octave graphic mode */
 #define AUD_EQ_MAX_GAIN 12
 
 struct EqualizerPreset
@@ -40,6 +41,13 @@ void aud_eq_get_bands(double values[AUD_EQ_NBANDS]);
 void aud_eq_set_band(int band, double value);
 double aud_eq_get_band(int band);
 
+/* The 31-band bands are used instead of the regular ones when the
+ * "equalizer_31band" setting is enabled.  Presets cover only the regular
+ * bands. */
+void aud_eq_set_bands_31(const double values[AUD_EQ_NBANDS_31]);
+void aud_eq_get_bands_31(double values[AUD_EQ_NBANDS_31]);
+void aud_eq_set_band_31(int band, double value);
+
 void aud_eq_apply_preset(const EqualizerPreset & preset);
 void aud_eq_update_preset(EqualizerPreset & preset);
 
@@ -19,28 +19,46 @@
 
 #include "internal.h"
 
-#include <complex>
 #include <math.h>
+#include <string.h>
+
+#include "objects.h"
+#include "threads.h"
 
 #define TWO_PI 6.2831853f
 
-#define N 512  /* size of the DFT */
-#define LOGN 9 /* log N (base 2) */
+#define LOG_MIN 8  /* smallest size (log base 2) */
+#define LOG_MAX 14 /* largest size (log base 2) */
+
+/* The input is real, so a transform of size N is done as a complex transform
+ * of size M = N/2, with the even and odd samples packed as the real and
+ * imaginary parts.  A final "split" step then separates the spectra of the
+ * even and odd samples and combines them.  The real and imaginary parts are
+ * kept in separate arrays, so that the butterflies of each step can be done
+ * four at a time using the GCC/Clang vector extensions (compiled to SSE on x86
+ * and NEON on ARM).  The tables for each size are generated once, when first
+ * needed. */
+typedef float v4sf __attribute__((vector_size(16)));
 
-typedef std::complex<float> Complex;
+struct FFTPlan
+{
+    int size;                        /* N */
+    Index<float> hamming;            /* hamming window, N */
+    Index<int> reversed;             /* bit-reversal table, M */
+    Index<float> step_re, step_im;   /* twiddle factors of each step, M - 1 */
+    Index<float> split_re, split_im; /* N-th roots of unity, M + 1 */
+};
 
-static float hamming[N];     /* hamming window, scaled to sum to 1 */
-static int reversed[N];      /* bit-reversal table */
-static Complex roots[N / 2]; /* N-th roots of unity */
-static char generated = 0;   /* set if tables have been generated */
+static aud::mutex mutex;
+static SmartPtr<FFTPlan> plans[LOG_MAX - LOG_MIN + 1];
 
-/* Reverse the order of the lowest LOGN bits in an integer. */
+/* Reverse the order of the lowest bits bits in an integer. */
 
-static int bit_reverse(int x)
+static int bit_reverse(int x, int bits)
 {
     int y = 0;
 
-    for (int n = LOGN; n--;)
+    for (int n = bits; n--;)
     {
         y = (y << 1) | (x & 1);
         x >>= 1;
@@ -51,73 +69,207 @@ static int bit_reverse(int x)
 
 /* Generate lookup tables. */
 
-static void generate_tables()
+static FFTPlan * create_plan(int logn)
+{
+    auto plan = new FFTPlan;
+    int n = 1 << logn, m = n / 2;
+
+    plan->size = n;
+
+    plan->hamming.resize(n);
+    for (int i = 0; i < n; i++)
+        plan->hamming[i] = 1 - 0.85f * cosf(i * (TWO_PI / n));
+
+    plan->reversed.resize(m);
+    for (int i = 0; i < m; i++)
+        plan->reversed[i] = bit_reverse(i, logn - 1);
+
+    /* the step with butterflies of span h uses the 2h-th roots of unity */
+    plan->step_re.resize(m - 1);
+    plan->step_im.resize(m - 1);
+
+    for (int h = 1, at = 0; h < m; at += h, h <<= 1)
+    {
+        for (int b = 0; b < h; b++)
+        {
+            plan->step_re[at + b] = cos(M_PI * b / h);
+            plan->step_im[at + b] = -sin(M_PI * b / h);
+        }
+    }
+
+    plan->split_re.resize(m + 1);
+    plan->split_im.resize(m + 1);
+
+    for (int k = 0; k <= m; k++)
+    {
+        plan->split_re[k] = cos(2 * M_PI * k / n);
+        plan->split_im[k] = -sin(2 * M_PI * k / n);
+    }
+
+    return plan;
+}
+
+static const FFTPlan & get_plan(int size)
 {
-    if (generated)
-        return;
+    int logn = LOG_MIN;
+    while (logn < LOG_MAX && (1 << logn) < size)
+        logn++;
 
-    for (int n = 0; n < N; n++)
-        hamming[n] = 1 - 0.85f * cosf(n * (TWO_PI / N));
-    for (int n = 0; n < N; n++)
-        reversed[n] = bit_reverse(n);
-    for (int n = 0; n < N / 2; n++)
-        roots[n] = exp(Complex(0, n * (TWO_PI / N)));
+    auto mh = mutex.take();
 
-    generated = 1;
+    auto & plan = plans[logn - LOG_MIN];
+    if (!plan)
+        plan.capture(create_plan(logn));
+
+    return *plan;
 }
 
 /* Perform the DFT using the Cooley-Tukey algorithm.  At each step s, where
- * s=1..log N (base 2), there are N/(2^s) groups of intertwined butterfly
+ * s=1..log M (base 2), there are M/(2^s) groups of intertwined butterfly
  * operations.  Each group contains (2^s)/2 butterflies, and each butterfly has
  * a span of (2^s)/2.  The twiddle factors are nth roots of unity where n = 2^s.
  */
 
-static void do_fft(Complex a[N])
+static void do_fft(const FFTPlan & plan, float * re, float * im)
 {
-    int half = 1;    /* (2^s)/2 */
-    int inv = N / 2; /* N/(2^s) */
+    int m = plan.size / 2;
+    const float * wr = plan.step_re.begin();
+    const float * wi = plan.step_im.begin();
 
     /* loop through steps */
-    while (inv)
+    for (int half = 1; half < m; wr += half, wi += half, half <<= 1)
     {
         /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
+        for (int g = 0; g < m; g += half << 1)
         {
+            float * ar = re + g, * ai = im + g;
+            float * br = ar + half, * bi = ai + half;
+
             /* loop through butterflies */
-            for (int b = 0, r = 0; b < half; b++, r += inv)
+            if (half >= 4)
             {
-                Complex even = a[g + b];
-                Complex odd = roots[r] * a[g + half + b];
-                a[g + b] = even + odd;
-                a[g + half + b] = even - odd;
+                for (int b = 0; b < half; b += 4)
+                {
+                    v4sf evr, evi, odr, odi, twr, twi;
+                    memcpy(&evr, ar + b, sizeof evr);
+                    memcpy(&evi, ai + b, sizeof evi);
+                    memcpy(&odr, br + b, sizeof odr);
+                    memcpy(&odi, bi + b, sizeof odi);
+                    memcpy(&twr, wr + b, sizeof twr);
+                    memcpy(&twi, wi + b, sizeof twi);
+
+                    v4sf tr = odr * twr - odi * twi;
+                    v4sf ti = odr * twi + odi * twr;
+
+                    v4sf sum_r = evr + tr, sum_i = evi + ti;
+                    v4sf diff_r = evr - tr, diff_i = evi - ti;
+
+                    memcpy(ar + b, &sum_r, sizeof sum_r);
+                    memcpy(ai + b, &sum_i, sizeof sum_i);
+                    memcpy(br + b, &diff_r, sizeof diff_r);
+                    memcpy(bi + b, &diff_i, sizeof diff_i);
+                }
             }
-        }
+            else
+            {
+                for (int b = 0; b < half; b++)
+                {
+                    float tr = br[b] * wr[b] - bi[b] * wi[b];
+                    float ti = br[b] * wi[b] + bi[b] * wr[b];
 
-        half <<= 1;
-        inv >>= 1;
+                    br[b] = ar[b] - tr;
+                    bi[b] = ai[b] - ti;
+                    ar[b] += tr;
+                    ai[b] += ti;
+                }
+            }
+        }
     }
 }
 
-/* Input is N=512 PCM samples.
- * Output is intensity of frequencies from 1 to N/2=256. */
+/* Input is N PCM samples, where N is a power of 2 from 256 to 16384.
+ * Output is intensity of frequencies from 1 to N/2. */
 
-void calc_freq(const float data[N], float freq[N / 2])
+void calc_freq(const float * data, float * freq, int size)
 {
-    generate_tables();
+    const FFTPlan & plan = get_plan(size);
+    int n = plan.size, m = n / 2;
+
+    /* working buffers, kept from one call to the next (calc_freq() is called
+     * for each frame by the visualization worker thread) */
+    static thread_local Index<float> re, im;
+    re.resize(m);
+    im.resize(m);
 
     /* input is filtered by a Hamming window */
     /* input values are in bit-reversed order */
-    Complex a[N];
-    for (int n = 0; n < N; n++)
-        a[reversed[n]] = data[n] * hamming[n];
+    for (int k = 0; k < m; k++)
+    {
+        int r = plan.reversed[k];
+        re[r] = data[2 * k] * plan.hamming[2 * k];
+        im[r] = data[2 * k + 1] * plan.hamming[2 * k + 1];
+    }
+
+    do_fft(plan, re.begin(), im.begin());
 
-    do_fft(a);
+    /* split step: X[k] = E[k] + W^k O[k], where E and O are the transforms
+     * of the even and odd samples, recovered from Z[k] and conj(Z[M-k]) */
+    for (int k = 1; k <= m; k++)
+    {
+        float zr = re[k % m], zi = im[k % m];
+        float cr = re[m - k], ci = -im[m - k];
+
+        float even_r = (zr + cr) / 2, even_i = (zi + ci) / 2;
+        float odd_r = (zi - ci) / 2, odd_i = (cr - zr) / 2;
+
+        float wr = plan.split_re[k], wi = plan.split_im[k];
+        float xr = even_r + wr * odd_r - wi * odd_i;
+        float xi = even_i + wr * odd_i + wi * odd_r;
+
+        /* output values are divided by N */
+        /* frequencies from 1 to N/2-1 are doubled */
+        float scale = (k < m) ? 2.0f / n : 1.0f / n;
+        freq[k - 1] = scale * sqrtf(xr * xr + xi * xi);
+    }
+}
 
-    /* output values are divided by N */
-    /* frequencies from 1 to N/2-1 are doubled */
-    for (int n = 0; n < N / 2 - 1; n++)
-        freq[n] = 2 * abs(a[1 + n]) / N;
+/* Sums the output of calc_freq() into bands spaced logarithmically from the
+ * lowest to the highest frequency, with the same spacing as
+ * Visualizer::compute_log_xscale().  Bins on the edge of a band are split
+ * between the neighboring bands. */
+
+void calc_freq_bands(const float * freq, int bins, float * bands, int n_bands)
+{
+    float lo = -0.5f;
+
+    for (int i = 0; i < n_bands; i++)
+    {
+        float hi = powf(bins, (float)(i + 1) / n_bands) - 0.5f;
+        int a = ceilf(lo);
+        int b = floorf(hi);
+        float sum = 0;
+
+        if (b < a)
+            sum += freq[b] * (hi - lo);
+        else
+        {
+            if (a > 0)
+                sum += freq[a - 1] * (a - lo);
+            for (; a < b; a++)
+                sum += freq[a];
+            if (b < bins)
+                sum += freq[b] * (hi - b);
+        }
+
+        bands[i] = sum;
+        lo = hi;
+    }
+}
+
+void fft_cleanup()
+{
+    auto mh = mutex.take();
 
-    /* frequency N/2 is not doubled */
-    freq[N / 2 - 1] = abs(a[N / 2]) / N;
+    for (auto & plan : plans)
+        plan.clear();
 }
@@ -23,6 +23,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <atomic>
+
 #include "index.h"
 #include "objects.h"
 
@@ -32,12 +34,58 @@ class PluginHandle;
 class VFSFile;
 class Tuple;
 
+enum class ResampleQuality;
+
 typedef bool (*DirForeachFunc)(const char * path, const char * basename,
                                void * user);
 
 /* adder.cc */
 void adder_cleanup();
 
+/* audio-simd.cc */
+/* Vectorized conversion kernels for the native-endian signed formats, chosen
+ * once according to the features of the CPU.  Each kernel processes as many
+ * samples (or frames) as it can and returns that count; the caller handles
+ * the remainder.  Kernels not available on the current CPU are null. */
+struct AudioKernels
+{
+    const char * name;
+
+    int (*from_s16)(const void * in, float * out, int samples);
+    int (*from_s24)(const void * in, float * out, int samples);
+    int (*from_s32)(const void * in, float * out, int samples);
+    int (*from_s24_3)(const void * in, float * out, int samples);
+
+    int (*to_s16)(const float * in, void * out, int samples);
+    int (*to_s24)(const float * in, void * out, int samples);
+    int (*to_s32)(const float * in, void * out, int samples);
+    int (*to_s24_3)(const float * in, void * out, int samples);
+
+    int (*interlace_stereo_16)(const void * const * in, void * out, int frames);
+    int (*interlace_stereo_32)(const void * const * in, void * out, int frames);
+    int (*deinterlace_stereo_16)(const void * in, void * const * out,
+                                 int frames);
+    int (*deinterlace_stereo_32)(const void * in, void * const * out,
+                                 int frames);
+
+    /* multiplies interleaved samples alternately by left and right (so the
+     * count processed is always even), then soft clips them if requested */
+    int (*amplify_clip)(float * data, int samples, float left, float right,
+                        bool clip);
+};
+
+const AudioKernels & audio_simd_kernels();
+
+/* audio.cc */
+float audio_volume_factor(int volume);
+void audio_amplify_clip(float * data, int channels, int frames, float left,
+                        float right, bool clip);
+
+typedef void (*AudioFilterFunc)(float * data, int samples);
+void audio_post_process(float * data, void * out, int format, int channels,
+                        int frames, AudioFilterFunc filter, float left,
+                        float right, bool clip);
+
 /* art.cc */
 void art_cache_current(const String & filename, Index<char> && data,
                        String && art_file);
@@ -56,6 +104,33 @@ void config_load();
 void config_save();
 void config_cleanup();
 
+/* A cached handle to a setting in the main ("audacious") config section, for
+ * use in performance-critical code.  The key is looked up once by connect(),
+ * after which the value is kept up to date through the "set <name>" hook, so
+ * get() is a lock-free atomic read.  Like other hooks, updates are delivered
+ * asynchronously from the main loop.  Only bool, int, and double are
+ * supported. */
+template<class T>
+class ConfigHandle
+{
+public:
+    constexpr ConfigHandle(const char * name) : m_name(name), m_value() {}
+
+    ConfigHandle(const ConfigHandle &) = delete;
+    void operator=(const ConfigHandle &) = delete;
+
+    void connect();
+    void disconnect();
+
+    T get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    static void update(void *, void * handle);
+
+    const char * const m_name;
+    std::atomic<T> m_value;
+};
+
 /* drct.cc */
 void record_init();
 void record_cleanup();
@@ -66,6 +141,7 @@ Index<float> & effect_process(Index<float> & data);
 bool effect_flush(bool force);
 Index<float> & effect_finish(Index<float> & data, bool end_of_playlist);
 int effect_adjust_delay(int delay);
+void effect_cleanup();
 
 bool effect_plugin_start(PluginHandle * plugin);
 void effect_plugin_stop(PluginHandle * plugin);
@@ -82,7 +158,9 @@ void event_queue_unpause();
 void event_queue_cancel_all();
 
 /* fft.cc */
-void calc_freq(const float data[512], float freq[256]);
+void calc_freq(const float * data, float * freq, int size = 512);
+void calc_freq_bands(const float * freq, int bins, float * bands, int n_bands);
+void fft_cleanup();
 
 /* hook.cc */
 void hook_cleanup();
@@ -95,6 +173,9 @@ bool iface_plugin_set_current(PluginHandle * plugin);
 void interface_run();
 
 /* playback.cc */
+void playback_init();
+void playback_cleanup();
+
 /* do not call these; use aud_drct_play/stop() instead */
 void playback_play(int seek_time, bool pause);
 void playback_stop(bool exiting = false);
@@ -112,6 +193,15 @@ InputPlugin * load_input_plugin(PluginHandle * decoder,
 #define PROBE_FLAG_MIGHT_HAVE_SUBTUNES (1 << 1)
 int probe_by_filename(const char * filename);
 
+/* resample.cc */
+void resample_start(int channels, int in_rate, int out_rate,
+                    ResampleQuality quality);
+Index<float> & resample_process(Index<float> & data);
+void resample_flush();
+Index<float> & resample_finish(Index<float> & data, bool end_of_playlist);
+int resample_adjust_delay(int delay);
+void resample_cleanup();
+
 /* runtime.cc */
 extern size_t misc_bytes_allocated;
 
@@ -152,11 +242,13 @@ void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
                            int rate);
 void vis_runner_flush();
 void vis_runner_enable(bool enable);
+void vis_runner_set_frames(int frames);
+void vis_runner_set_rate(int rate);
 
 /* visualization.cc */
 void vis_activate(bool activate);
 void vis_send_clear();
-void vis_send_audio(const float * data, int channels);
+void vis_send_audio(const float * data, int channels, int frames);
 
 bool vis_plugin_start(PluginHandle * plugin);
 void vis_plugin_stop(PluginHandle * plugin);
@@ -0,0 +1,551 @@
+/*
+ * metadata-cache.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "metadata-cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <thread>
+
+#include <glib/gstdio.h>
+
+#include "audstrings.h"
+#include "binary-io.h"
+#include "internal.h"
+#include "multihash.h"
+#include "plugins.h"
+#include "runtime.h"
+#include "threads.h"
+#include "tuple.h"
+
+/* The metadata cache remembers, for each local file scanned, the decoder that
+ * handles it, its tuple, and whether it has embedded album art, so that the
+ * scanner need not open the file again as long as its modification time and
+ * size are unchanged.
+ *
+ * The cache file is written once and then only read, through a memory mapping,
+ * so that it can be searched without a lock.  It consists of a header, the
+ * records, and an open-addressed hash table of record offsets.  Each record is:
+ *
+ *   hash of URI (4 bytes), URI, mtime, size, art state, decoder basename,
+ *   (field number (1 byte), value)..., 0xff, number of subtunes, subtunes...
+ *
+ * in the encoding of binary-io.h.  Fields that are derived from the URI are
+ * not stored.
+ *
+ * Files scanned during this session are kept in memory, and take precedence
+ * over the file.  So do files forgotten during this session, which are kept as
+ * items without a decoder and are left out when the file is rewritten.  Once
+ * there are enough new items (relative to the size of the file, so that the
+ * total work stays linear), the file is rewritten in the background with the
+ * new records replacing the old ones, and the new file is mapped in place of
+ * the old.  Old mappings are not released until exit, since readers may still
+ * be using them. */
+
+#define FILENAME "metadata-cache"
+#define MAGIC "AUDMETA2"
+#define BYTE_ORDER_MARK 0x01020304
+
+#define MIN_COMPACT 4096 /* new records */
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t n_slots; /* a power of two */
+    uint32_t n_records;
+    uint32_t slots_offset; /* records lie between the header and the slots */
+};
+
+struct CacheMap
+{
+    MappedFile file;
+    FileHeader header;
+};
+
+struct PendingItem
+{
+    MetadataCacheItem item;
+    int serial;
+};
+
+struct PendingRecord
+{
+    String filename;
+    MetadataCacheItem item;
+};
+
+static std::atomic<CacheMap *> current_map;
+
+static aud::mutex mutex;
+static SimpleHash<String, PendingItem> pending;
+static Index<CacheMap *> retired_maps;
+static std::thread compactor;
+static bool enabled, compacting, write_failed;
+static int serial;
+
+static void write_record(Index<char> & buf, const char * filename,
+                         const MetadataCacheItem & item)
+{
+    uint32_t hash = str_calc_hash(filename);
+    buf.insert((const char *)&hash, -1, sizeof hash);
+
+    put_string(buf, filename);
+    put_signed_number(buf, item.mtime);
+    put_signed_number(buf, item.size);
+    put_number(buf, (int)item.art);
+    put_string(buf, aud_plugin_get_basename(item.decoder));
+    put_tuple(buf, item.tuple);
+}
+
+/* reads the part of a record following the mtime and size; with a null item,
+ * just skips over it */
+static bool read_record(BinaryReader & r, const char * filename,
+                        MetadataCacheItem * item)
+{
+    int art = r.number();
+    uint64_t decoder_len = r.number();
+    const char * decoder = r.bytes(decoder_len);
+
+    if (!decoder || art > (int)EmbeddedArt::Present)
+        return false;
+
+    if (!item)
+        return read_tuple(r, nullptr);
+
+    item->art = (EmbeddedArt)art;
+    item->decoder = aud_plugin_lookup_basename(str_copy(decoder, decoder_len));
+
+    /* the plugin may have been removed or disabled since */
+    if (!item->decoder || !aud_plugin_get_enabled(item->decoder) ||
+        aud_plugin_get_type(item->decoder) != PluginType::Input)
+        return false;
+
+    Tuple tuple;
+    tuple.set_filename(filename);
+
+    if (!read_tuple(r, &tuple))
+        return false;
+
+    tuple.set_state(Tuple::Valid);
+    item->tuple = std::move(tuple);
+    return true;
+}
+
+static uint32_t get_slot(const CacheMap * map, uint32_t i)
+{
+    uint32_t offset;
+    memcpy(&offset, map->file.data + map->header.slots_offset + 4 * i, 4);
+    return offset;
+}
+
+/* reads the hash and URI of the record at the given offset */
+static bool read_key(const CacheMap * map, uint32_t offset, BinaryReader & r,
+                     uint32_t & hash, const char *& uri, uint64_t & uri_len)
+{
+    if (offset < sizeof(FileHeader) || offset >= map->header.slots_offset)
+        return false;
+
+    r = {map->file.data + offset, map->file.data + map->header.slots_offset,
+         true};
+
+    const char * hash_bytes = r.bytes(4);
+    uri_len = r.number();
+    uri = r.bytes(uri_len);
+
+    if (!r.ok)
+        return false;
+
+    memcpy(&hash, hash_bytes, 4);
+    return true;
+}
+
+static bool map_lookup(const CacheMap * map, const char * filename,
+                       MetadataCacheItem & item)
+{
+    uint32_t hash = str_calc_hash(filename);
+    uint64_t len = strlen(filename);
+    uint32_t mask = map->header.n_slots - 1;
+
+    for (uint32_t i = hash & mask, tries = 0; tries < map->header.n_slots;
+         i = (i + 1) & mask, tries++)
+    {
+        uint32_t offset = get_slot(map, i);
+        if (!offset)
+            return false;
+
+        BinaryReader r;
+        uint32_t record_hash;
+        const char * uri;
+        uint64_t uri_len;
+
+        if (!read_key(map, offset, r, record_hash, uri, uri_len))
+            return false;
+
+        if (record_hash != hash || uri_len != len || memcmp(uri, filename, len))
+            continue;
+
+        int64_t mtime = r.signed_number();
+        int64_t size = r.signed_number();
+
+        if (!r.ok || mtime != item.mtime || size != item.size)
+            return false;
+
+        return read_record(r, filename, &item);
+    }
+
+    return false;
+}
+
+static CacheMap * open_map(const char * path)
+{
+    MappedFile file;
+    if (!map_file(path, file))
+        return nullptr;
+
+    auto map = new CacheMap{file, FileHeader()};
+    FileHeader & header = map->header;
+
+    if (file.len >= (int64_t)sizeof header)
+        memcpy(&header, file.data, sizeof header);
+
+    if (file.len < (int64_t)sizeof header ||
+        memcmp(header.magic, MAGIC, sizeof header.magic) ||
+        header.byte_order != BYTE_ORDER_MARK || !header.n_slots ||
+        (header.n_slots & (header.n_slots - 1)) ||
+        header.slots_offset < sizeof header ||
+        header.slots_offset + 4 * (int64_t)header.n_slots > file.len)
+    {
+        AUDWARN("Ignoring invalid metadata cache: %s\n", path);
+        map->header = FileHeader();
+    }
+
+    return map;
+}
+
+static void close_map(CacheMap * map)
+{
+    unmap_file(map->file);
+    delete map;
+}
+
+static void put_slot(Index<uint32_t> & slots, uint32_t hash, uint32_t offset)
+{
+    uint32_t mask = slots.len() - 1;
+    uint32_t i = hash & mask;
+
+    while (slots[i])
+        i = (i + 1) & mask;
+
+    slots[i] = offset;
+}
+
+/* writes a new cache file with the given records, followed by those of the
+ * old file that they do not replace */
+static bool write_cache(const char * path, const CacheMap * old,
+                        const Index<PendingRecord> & records)
+{
+    StringBuf temp = str_concat({path, ".tmp"});
+
+    FILE * handle = g_fopen(temp, "wb");
+    if (!handle)
+    {
+        AUDERR("Cannot write %s: %s\n", (const char *)temp, strerror(errno));
+        return false;
+    }
+
+    FileHeader header = FileHeader();
+    fwrite(&header, sizeof header, 1, handle);
+
+    Index<uint32_t> hashes, offsets;
+    SimpleHash<String, bool> replaced;
+    Index<char> buf;
+    int64_t pos = sizeof header;
+
+    for (auto & record : records)
+    {
+        if (!record.item.decoder)
+        {
+            replaced.add(record.filename, true); /* forgotten */
+            continue;
+        }
+
+        buf.resize(0);
+        write_record(buf, record.filename, record.item);
+
+        if (pos + buf.len() > UINT32_MAX)
+            break;
+
+        hashes.append(str_calc_hash(record.filename));
+        offsets.append(pos);
+        replaced.add(record.filename, true);
+
+        fwrite(buf.begin(), 1, buf.len(), handle);
+        pos += buf.len();
+    }
+
+    for (uint32_t i = 0; old && i < old->header.n_slots; i++)
+    {
+        uint32_t offset = get_slot(old, i);
+        if (!offset)
+            continue;
+
+        BinaryReader r;
+        uint32_t hash;
+        const char * uri;
+        uint64_t uri_len;
+
+        if (!read_key(old, offset, r, hash, uri, uri_len))
+            continue;
+
+        if (replaced.lookup(String(str_copy(uri, uri_len))))
+            continue;
+
+        r.signed_number();
+        r.signed_number();
+
+        if (!r.ok || !read_record(r, nullptr, nullptr))
+            continue;
+
+        int64_t len = r.pos - (old->file.data + offset);
+        if (pos + len > UINT32_MAX)
+            break;
+
+        hashes.append(hash);
+        offsets.append(pos);
+
+        fwrite(old->file.data + offset, 1, len, handle);
+        pos += len;
+    }
+
+    /* keep the table at most half full */
+    uint32_t n_slots = 16;
+    while (n_slots < 2 * (uint32_t)offsets.len())
+        n_slots *= 2;
+
+    Index<uint32_t> slots;
+    slots.insert(0, n_slots);
+
+    for (int i = 0; i < offsets.len(); i++)
+        put_slot(slots, hashes[i], offsets[i]);
+
+    memcpy(header.magic, MAGIC, sizeof header.magic);
+    header.byte_order = BYTE_ORDER_MARK;
+    header.n_slots = n_slots;
+    header.n_records = offsets.len();
+    header.slots_offset = pos;
+
+    fwrite(slots.begin(), sizeof(uint32_t), n_slots, handle);
+    fseek(handle, 0, SEEK_SET);
+    fwrite(&header, sizeof header, 1, handle);
+
+    bool success = !ferror(handle);
+    success = (fclose(handle) == 0) && success;
+
+    if (!success || g_rename(temp, path) < 0)
+    {
+        AUDERR("Cannot write %s: %s\n", path, strerror(errno));
+        g_unlink(temp);
+        return false;
+    }
+
+    return true;
+}
+
+static Index<PendingRecord> take_snapshot(aud::mutex::holder &)
+{
+    Index<PendingRecord> records;
+
+    pending.iterate([&](const String & filename, PendingItem & pend) {
+        const MetadataCacheItem & item = pend.item;
+        records.append(PendingRecord{
+            filename,
+            {item.mtime, item.size, item.decoder, item.tuple.ref(), item.art}});
+    });
+
+    return records;
+}
+
+static void compact(aud::mutex::holder & mh)
+{
+    Index<PendingRecord> records = take_snapshot(mh);
+    int snapshot_serial = serial;
+
+    mh.unlock();
+
+    StringBuf path = filename_build({aud_get_path(AudPath::UserDir), FILENAME});
+
+    /* the old map is not released while we are still using it */
+    CacheMap * old = current_map.load(std::memory_order_acquire);
+    CacheMap * map = nullptr;
+
+    if (write_cache(path, old, records))
+        map = open_map(path);
+
+    mh.lock();
+
+    if (map)
+    {
+        current_map.store(map, std::memory_order_release);
+        if (old)
+            retired_maps.append(old);
+
+        /* drop what is now in the file, unless it has been replaced since */
+        for (auto & record : records)
+        {
+            auto pend = pending.lookup(record.filename);
+            if (pend && pend->serial <= snapshot_serial)
+                pending.remove(record.filename);
+        }
+    }
+    else
+        write_failed = true; /* don't keep trying until exit */
+
+    compacting = false;
+}
+
+static void compact_worker()
+{
+    auto mh = mutex.take();
+    compact(mh);
+}
+
+void metadata_cache_init()
+{
+    StringBuf path = filename_build({aud_get_path(AudPath::UserDir), FILENAME});
+    current_map.store(open_map(path), std::memory_order_release);
+
+    auto mh = mutex.take();
+    enabled = true;
+}
+
+bool metadata_cache_stat(const char * filename, MetadataCacheItem & item)
+{
+    if (strncmp(filename, "file://", 7))
+        return false;
+
+    StringBuf path = uri_to_filename(strip_subtune(filename));
+    if (!path)
+        return false;
+
+    GStatBuf st;
+    if (g_stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    /* a file may be written more than once in the same second */
+    item.mtime = (int64_t)st.st_mtime * 1000000000;
+#if defined(__APPLE__)
+    item.mtime += st.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+    item.mtime += st.st_mtim.tv_nsec;
+#endif
+
+    item.size = st.st_size;
+    return true;
+}
+
+bool metadata_cache_lookup(const char * filename, MetadataCacheItem & item)
+{
+    auto mh = mutex.take();
+
+    auto pend = pending.lookup(String(filename));
+    if (pend)
+    {
+        if (!pend->item.decoder || pend->item.mtime != item.mtime ||
+            pend->item.size != item.size)
+            return false;
+
+        item.decoder = pend->item.decoder;
+        item.tuple = pend->item.tuple.ref();
+        item.art = pend->item.art;
+        return true;
+    }
+
+    mh.unlock();
+
+    CacheMap * map = current_map.load(std::memory_order_acquire);
+    return map && map->header.n_slots && map_lookup(map, filename, item);
+}
+
+void metadata_cache_store(const char * filename, const MetadataCacheItem & item)
+{
+    auto mh = mutex.take();
+
+    if (!enabled || !item.decoder || !item.tuple.valid())
+        return;
+
+    pending.add(String(filename),
+                {{item.mtime, item.size, item.decoder, item.tuple.ref(),
+                  item.art},
+                 ++serial});
+
+    if (compacting || write_failed)
+        return;
+
+    CacheMap * map = current_map.load(std::memory_order_relaxed);
+    int n_records = map ? map->header.n_records : 0;
+
+    if (pending.n_items() >= aud::max(n_records / 2, MIN_COMPACT))
+    {
+        if (compactor.joinable())
+            compactor.join();
+
+        compacting = true;
+        compactor = std::thread(compact_worker);
+    }
+}
+
+void metadata_cache_forget(const char * filename)
+{
+    auto mh = mutex.take();
+
+    if (enabled)
+        pending.add(String(filename), {MetadataCacheItem(), ++serial});
+}
+
+void metadata_cache_cleanup()
+{
+    auto mh = mutex.take();
+    enabled = false;
+
+    if (compactor.joinable())
+    {
+        mh.unlock();
+        compactor.join();
+        mh.lock();
+    }
+
+    if (pending.n_items())
+        compact(mh);
+
+    pending.clear();
+
+    CacheMap * map = current_map.exchange(nullptr);
+    if (map)
+        close_map(map);
+
+    for (CacheMap * old : retired_maps)
+        close_map(old);
+
+    retired_maps.clear();
+}
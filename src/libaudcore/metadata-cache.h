@@ -0,0 +1,64 @@
+/*
+ * metadata-cache.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_METADATA_CACHE_H
+#define LIBAUDCORE_METADATA_CACHE_H
+
+#include <stdint.h>
+
+#include "tuple.h"
+
+class PluginHandle;
+
+enum class EmbeddedArt
+{
+    Unknown,
+    None,
+    Present
+};
+
+struct MetadataCacheItem
+{
+    int64_t mtime, size; /* of the file, when it was read (mtime in ns) */
+    PluginHandle * decoder;
+    Tuple tuple;
+    EmbeddedArt art;
+};
+
+void metadata_cache_init();
+void metadata_cache_cleanup();
+
+/* Fills in the mtime and size of a local file.  Returns false for other URIs,
+ * which are not cached. */
+bool metadata_cache_stat(const char * filename, MetadataCacheItem & item);
+
+/* Fills in the rest of the item, if there is an entry for the file with the
+ * same mtime (in nanoseconds) and size.  Safe to call from any thread. */
+bool metadata_cache_lookup(const char * filename, MetadataCacheItem & item);
+
+/* Adds or replaces the entry for a file.  The item must have a decoder and a
+ * valid tuple. */
+void metadata_cache_store(const char * filename,
+                          const MetadataCacheItem & item);
+
+/* Drops the entry for a file, so that it is read again when next scanned
+ * (after its tags are written, or when a rescan is requested). */
+void metadata_cache_forget(const char * filename);
+
+#endif // LIBAUDCORE_METADATA_CACHE_H
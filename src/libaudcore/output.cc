@@ -20,10 +20,15 @@
 #include "output.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
+
+#include "audstrings.h"
+#include "drct.h"
 #include "equalizer.h"
 #include "hook.h"
 #include "i18n.h"
@@ -31,20 +36,33 @@
 #include "internal.h"
 #include "plugin.h"
 #include "plugins.h"
+#include "ringbuf.h"
 #include "runtime.h"
 #include "threads.h"
 
 /* With Audacious 3.7, there is some support for secondary output plugins.
  * Notes and limitations:
- *  - Only one secondary output can be in use at a time.
+ *  - Any number of secondary outputs can be in use at a time, each recording
+ *    from its own point in the audio chain (see aud_drct_set_record_stream).
  *  - A reduced API is used, consisting of only open_audio(), close_audio(), and
  *    write_audio().
- *  - The primary and secondary outputs are run from the same thread, with
- *    timing controlled by the primary's period_wait().  To avoid dropouts in
- *    the primary output, the secondary's write_audio() must be able to process
- *    audio faster than realtime.
+ *  - Each secondary output is run from its own recording thread, which is fed
+ *    through a queue of "record_queue_size" milliseconds (see RecordTap).
+ *    If the secondary's write_audio() cannot keep up, the queue fills up and
+ *    the "record_overflow" setting decides what happens: the primary output
+ *    waits, the oldest audio is dropped from that recording, or the queue is
+ *    enlarged up to "record_queue_max" milliseconds (after which the primary
+ *    waits).
  *  - The secondary's write_audio() is called in a tight loop until it has
- *    caught up to the primary, and should never return a zero byte count. */
+ *    caught up, and should never return a zero byte count.
+ *  - When a secondary output is closed, its recording thread goes on to write
+ *    what was still queued, and then calls close_audio() itself, so that
+ *    playback does not wait for it.  The plugin is opened by the recording
+ *    thread too, once any earlier recording to it has been closed, so that
+ *    reopening it does not wait either (see wait_turn).  The plugin is not
+ *    cleaned up until every recording to it is finished (see wait_drained).
+ *    While a recording thread waits its turn, its queue fills up as if the
+ *    plugin were slow. */
 
 /* Locking in this module is complicated by the fact that some of the
  * output plugin functions (specifically period_wait() and drain()) are
@@ -67,6 +85,20 @@
  *   5. Call the blocking function
  *   6. Unlock the major mutex
  *
+ * In pipelined mode (the "output_thread" setting), effects are still run by
+ * the input thread, but the results are passed through a ring buffer to a
+ * separate output thread, which makes the blocking calls.  The output thread
+ * does not take the major mutex; instead, any unsafe operation that would
+ * interfere with it stops the thread first (see stop_output_thread).  The
+ * input thread may run ahead of the output thread by "output_thread_ahead"
+ * milliseconds of audio.
+ *
+ * In low-latency mode (the "low_latency" setting), the effect plugins are not
+ * pipelined, audio is written to the output plugin in pieces of half the
+ * "target_latency", and a piece is only written once the output plugin reports
+ * a delay no greater than the target.  In pipelined mode, the ring is also
+ * limited to the target.  Changes of the target take effect immediately.
+ *
  * The following classes attempt to enforce some of the rules regarding
  * locking and state data. */
 
@@ -113,6 +145,13 @@ public:
     void set_output(UnsafeLock &, bool on) { set_flag(OUTPUT, on); }
 
     void await_change(SafeLock & lock) { cond.wait(lock.minor); }
+    /* same, but gives up after the given number of milliseconds */
+    void await_change_for(SafeLock & lock, int ms)
+    {
+        cond.wait_for(lock.minor, std::chrono::milliseconds(ms));
+    }
+    /* wake threads waiting for a change not covered by the flags above */
+    void notify_change(SafeLock &) { cond.notify_all(); }
 
 private:
     static constexpr int INPUT = (1 << 0); /* input plugin connected */
@@ -140,19 +179,525 @@ private:
     }
 };
 
+/* Lock-free single-producer, single-consumer ring of samples.  The storage is
+ * a RingBuf which is kept full, so that positions map directly to memory; the
+ * read and write positions are tracked separately and wrap around freely. */
+class SampleRing
+{
+public:
+    /* not thread-safe; size is rounded up to a power of two */
+    void alloc(int size)
+    {
+        int pow2 = 1;
+        while (pow2 < size)
+            pow2 <<= 1;
+
+        m_buf.discard();
+        m_buf.alloc(pow2);
+        m_buf.fill_with(0.0f);
+        m_read.store(0, std::memory_order_relaxed);
+        m_write.store(0, std::memory_order_relaxed);
+    }
+
+    /* not thread-safe */
+    void destroy()
+    {
+        m_buf.destroy();
+        m_read.store(0, std::memory_order_relaxed);
+        m_write.store(0, std::memory_order_relaxed);
+    }
+
+    /* samples currently in the ring (safe from any thread) */
+    int len() const
+    {
+        return m_write.load(std::memory_order_acquire) -
+               m_read.load(std::memory_order_acquire);
+    }
+
+    /* producer side */
+    int space() const { return m_buf.size() - len(); }
+    unsigned write_pos() const
+    {
+        return m_write.load(std::memory_order_relaxed);
+    }
+
+    void write(const float * data, int len)
+    {
+        unsigned pos = m_write.load(std::memory_order_relaxed);
+        int offset = pos & (m_buf.size() - 1);
+        int len1 = aud::min(len, m_buf.size() - offset);
+
+        memcpy(&m_buf[offset], data, sizeof(float) * len1);
+        memcpy(&m_buf[0], data + len1, sizeof(float) * (len - len1));
+
+        m_write.store(pos + len, std::memory_order_release);
+    }
+
+    /* consumer side */
+    void read(float * data, int len)
+    {
+        unsigned pos = m_read.load(std::memory_order_relaxed);
+        int offset = pos & (m_buf.size() - 1);
+        int len1 = aud::min(len, m_buf.size() - offset);
+
+        memcpy(data, &m_buf[offset], sizeof(float) * len1);
+        memcpy(data + len1, &m_buf[0], sizeof(float) * (len - len1));
+
+        m_read.store(pos + len, std::memory_order_release);
+    }
+
+    void discard_to(unsigned pos)
+    {
+        m_read.store(pos, std::memory_order_release);
+    }
+
+private:
+    RingBuf<float> m_buf;
+    std::atomic<unsigned> m_read{0}, m_write{0};
+};
+
+/* The recording thread of an open secondary output plugin.  It is owned by
+ * the thread, which deletes it when done; the fields are protected by the
+ * mutex of the RecordTap until it is detached. */
+struct RecordReader
+{
+    OutputPlugin * plugin;
+    String filename; /* passed to open_audio() by the recording thread */
+    Tuple tuple;
+    int channels, rate;
+    unsigned read_pos;
+    bool reading; /* recording thread is reading from the ring */
+    bool failed;  /* open_audio() failed; the audio is discarded */
+    bool quit;
+    int64_t written, dropped;
+    int chunk;             /* samples written at once (20 ms) */
+    Index<float> leftover; /* still to be written once detached */
+};
+
+/* A secondary output plugin */
+struct RecordSink
+{
+    OutputPlugin * plugin;
+    OutputStream stream; /* tap point */
+    bool open;
+    int channels, rate;
+    RecordReader * reader; /* while open */
+};
+
+/* secondary output plugins with a recording thread, which may still be running
+ * after the plugin has been closed */
+static aud::mutex recording_mutex;
+static aud::condvar recording_cond;
+static Index<RecordReader *> recording_readers; /* in the order started */
+
+static void start_recording(RecordReader * reader)
+{
+    auto mh = recording_mutex.take();
+    recording_readers.append(reader);
+}
+
+static void finish_recording(RecordReader * reader)
+{
+    auto mh = recording_mutex.take();
+    recording_readers.remove(recording_readers.find(reader), 1);
+    recording_cond.notify_all();
+}
+
+static RecordReader * first_recording(OutputPlugin * plugin,
+                                      aud::mutex::holder &)
+{
+    for (RecordReader * reader : recording_readers)
+    {
+        if (!plugin || reader->plugin == plugin)
+            return reader;
+    }
+
+    return nullptr;
+}
+
+/* called by a recording thread; waits until the earlier recordings to the
+ * same plugin have written what was queued and closed the plugin */
+static void wait_turn(RecordReader * reader)
+{
+    auto mh = recording_mutex.take();
+    while (first_recording(reader->plugin, mh) != reader)
+        recording_cond.wait(mh);
+}
+
+/* waits until the recording threads of the plugin (or, if null, of every
+ * plugin) have written what was queued and closed the plugin; must not be
+ * called with the output locks held */
+static void wait_drained(OutputPlugin * plugin)
+{
+    auto mh = recording_mutex.take();
+    while (first_recording(plugin, mh))
+        recording_cond.wait(mh);
+}
+
+static bool open_audio_with_info(OutputPlugin * op, const char * filename,
+                                 const Tuple & tuple, int format, int rate,
+                                 int chans, String & error)
+{
+    op->set_info(filename, tuple);
+    return op->open_audio(format, rate, chans, error);
+}
+
+/* read by the audio thread whenever a recording queue is full */
+static ConfigHandle<int> record_overflow("record_overflow");
+
+/* read by the audio threads for each buffer (see get_target_latency) */
+static ConfigHandle<bool> low_latency("low_latency");
+static ConfigHandle<int> target_latency("target_latency");
+
+/* All the secondary outputs recording from one point in the audio chain read
+ * from a single ring, so that each buffer is copied into it only once.  The
+ * ring is kept full and addressed by free-running positions, like SampleRing;
+ * each sink has its own read position.  Samples are copied in and out without
+ * holding the mutex, which is taken only to update positions, to wait, and to
+ * enlarge the ring, and is never held while a plugin is writing. */
+class RecordTap
+{
+public:
+    /* called with the minor lock held */
+    bool active() const { return m_readers.len() > 0; }
+
+    void start_sink(RecordSink * sink, const char * filename,
+                    const Tuple & tuple);
+    void detach_sink(RecordSink * sink);
+    bool failed(RecordSink * sink);
+
+    void push(const float * data, int len);
+    RecordStats stats(RecordSink * sink);
+
+private:
+    void run(RecordReader * reader);
+    int space(aud::mutex::holder &) const;
+    bool make_space(aud::mutex::holder & mh, int len);
+    void resize(aud::mutex::holder &, int size);
+
+    void copy_in(unsigned pos, const float * data, int len);
+    void copy_out(unsigned pos, float * data, int len) const;
+
+    Index<RecordReader *> m_readers;
+    int m_max_size = 0;
+
+    RingBuf<float> m_buf;
+    unsigned m_write_pos = 0;
+    int64_t m_waits = 0;
+
+    aud::mutex m_mutex;
+    aud::condvar m_cond;
+};
+
+/* called with the minor lock held; the recording thread opens the plugin.
+ * The sizes are worked out again for each sink, since the settings or the
+ * format (after which every sink is reopened) may have changed. */
+void RecordTap::start_sink(RecordSink * sink, const char * filename,
+                           const Tuple & tuple)
+{
+    auto mh = m_mutex.take();
+
+    int size = aud::clamp(aud_get_int("record_queue_size"), 100, 60000);
+    int max = aud::clamp(aud_get_int("record_queue_max"), size, 600000);
+
+    size = aud::rescale<int64_t>(size, 1000, sink->rate) * sink->channels;
+    m_max_size = aud::rescale<int64_t>(max, 1000, sink->rate) * sink->channels;
+
+    if (!m_readers.len())
+    {
+        m_waits = 0;
+        resize(mh, size);
+    }
+    else if (m_buf.size() < size)
+        resize(mh, size);
+
+    auto reader = new RecordReader();
+    reader->plugin = sink->plugin;
+    reader->filename = String(filename);
+    reader->tuple = tuple.ref();
+    reader->channels = sink->channels;
+    reader->rate = sink->rate;
+    reader->read_pos = m_write_pos;
+    reader->chunk = aud::max(sink->rate / 50, 1) * sink->channels;
+
+    m_readers.append(reader);
+    sink->reader = reader;
+
+    start_recording(reader);
+    std::thread(&RecordTap::run, this, reader).detach();
+}
+
+/* called with the minor lock held; hands the recording thread what it has not
+ * yet read, and lets it finish on its own */
+void RecordTap::detach_sink(RecordSink * sink)
+{
+    auto mh = m_mutex.take();
+    RecordReader * reader = sink->reader;
+
+    while (reader->reading)
+        m_cond.wait(mh);
+
+    reader->leftover.resize(m_write_pos - reader->read_pos);
+    copy_out(reader->read_pos, reader->leftover.begin(),
+             reader->leftover.len());
+
+    m_readers.remove(m_readers.find(reader), 1);
+    if (!m_readers.len())
+        m_buf.destroy();
+
+    AUDINFO("Recording stopped: %" PRId64 " samples written, %" PRId64
+            " dropped, %" PRId64 " waits, %d still to write.\n",
+            reader->written, reader->dropped, m_waits,
+            reader->leftover.len());
+
+    reader->quit = true;
+    m_cond.notify_all();
+    sink->reader = nullptr;
+}
+
+/* free space, as seen by the slowest reader */
+int RecordTap::space(aud::mutex::holder &) const
+{
+    int queued = 0;
+    for (RecordReader * reader : m_readers)
+        queued = aud::max(queued, (int)(m_write_pos - reader->read_pos));
+
+    return m_buf.size() - queued;
+}
+
+/* makes room for at least one sample according to the overflow policy;
+ * returns false if the audio is to be dropped instead */
+bool RecordTap::make_space(aud::mutex::holder & mh, int len)
+{
+    auto policy = (RecordOverflow)record_overflow.get();
+
+    if (policy == RecordOverflow::Grow && m_buf.size() < m_max_size)
+    {
+        resize(mh, aud::min(2 * m_buf.size(), m_max_size));
+        AUDINFO("Recording queue enlarged to %d samples.\n", m_buf.size());
+        return true;
+    }
+
+    if (policy == RecordOverflow::Drop)
+    {
+        /* the sinks that have fallen behind skip their oldest audio, unless
+         * they are reading it right now */
+        int needed = aud::min(len, m_buf.size());
+        bool dropped = false;
+
+        for (RecordReader * reader : m_readers)
+        {
+            int excess = (int)(m_write_pos - reader->read_pos) + needed -
+                         m_buf.size();
+
+            if (excess > 0 && !reader->reading)
+            {
+                reader->read_pos += excess;
+                reader->dropped += excess;
+                dropped = true;
+            }
+        }
+
+        if (dropped)
+            return true;
+    }
+    else
+        m_waits++;
+
+    m_cond.wait(mh);
+    return true;
+}
+
+/* waits for the readers, then resizes the ring, keeping its contents */
+void RecordTap::resize(aud::mutex::holder & mh, int size)
+{
+    auto busy = [this]() {
+        for (RecordReader * reader : m_readers)
+        {
+            if (reader->reading)
+                return true;
+        }
+        return false;
+    };
+
+    while (busy())
+        m_cond.wait(mh);
+
+    unsigned start = m_write_pos;
+    for (RecordReader * reader : m_readers)
+    {
+        if ((int)(m_write_pos - reader->read_pos) > (int)(m_write_pos - start))
+            start = reader->read_pos;
+    }
+
+    Index<float> saved;
+    if (m_buf.size())
+    {
+        saved.resize(m_write_pos - start);
+        copy_out(start, saved.begin(), saved.len());
+    }
+
+    int pow2 = 1;
+    while (pow2 < size)
+        pow2 <<= 1;
+
+    m_buf.discard();
+    m_buf.alloc(pow2);
+    m_buf.fill_with(0.0f);
+
+    copy_in(start, saved.begin(), saved.len());
+}
+
+void RecordTap::copy_in(unsigned pos, const float * data, int len)
+{
+    int offset = pos & (m_buf.size() - 1);
+    int len1 = aud::min(len, m_buf.size() - offset);
+
+    memcpy(&m_buf[offset], data, sizeof(float) * len1);
+    memcpy(&m_buf[0], data + len1, sizeof(float) * (len - len1));
+}
+
+void RecordTap::copy_out(unsigned pos, float * data, int len) const
+{
+    int offset = pos & (m_buf.size() - 1);
+    int len1 = aud::min(len, m_buf.size() - offset);
+
+    memcpy(data, &m_buf[offset], sizeof(float) * len1);
+    memcpy(data + len1, &m_buf[0], sizeof(float) * (len - len1));
+}
+
+void RecordTap::push(const float * data, int len)
+{
+    auto mh = m_mutex.take();
+
+    while (len > 0)
+    {
+        int room = space(mh);
+
+        if (!room)
+        {
+            make_space(mh, len);
+            continue;
+        }
+
+        int samples = aud::min(len, room);
+        unsigned pos = m_write_pos;
+
+        mh.unlock();
+        copy_in(pos, data, samples);
+        mh.lock();
+
+        m_write_pos = pos + samples;
+        m_cond.notify_all();
+
+        data += samples;
+        len -= samples;
+    }
+}
+
+/* called with the minor lock held */
+bool RecordTap::failed(RecordSink * sink)
+{
+    auto mh = m_mutex.take();
+    return sink->reader->failed;
+}
+
+RecordStats RecordTap::stats(RecordSink * sink)
+{
+    auto mh = m_mutex.take();
+    RecordReader * reader = sink->reader;
+    return {(int)(m_write_pos - reader->read_pos), m_buf.size(),
+            reader->written, reader->dropped, m_waits};
+}
+
+static void write_all(OutputPlugin * plugin, const Index<float> & data)
+{
+    auto begin = (const char *)data.begin();
+    auto end = (const char *)data.end();
+
+    while (begin < end)
+        begin += plugin->write_audio(begin, end - begin);
+}
+
+void RecordTap::run(RecordReader * reader)
+{
+    wait_turn(reader);
+
+    String error;
+    bool opened = open_audio_with_info(reader->plugin, reader->filename,
+                                       reader->tuple, FMT_FLOAT, reader->rate,
+                                       reader->channels, error);
+    if (!opened)
+        aud_ui_show_error(error ? (const char *)error
+                                : _("Error recording output stream"));
+
+    auto mh = m_mutex.take();
+    Index<float> data;
+
+    reader->failed = !opened;
+
+    while (!reader->quit)
+    {
+        int avail = m_write_pos - reader->read_pos;
+
+        if (!avail)
+        {
+            m_cond.wait(mh);
+            continue;
+        }
+
+        if (!opened)
+        {
+            reader->read_pos += avail;
+            reader->dropped += avail;
+            m_cond.notify_all();
+            continue;
+        }
+
+        data.resize(aud::min(avail, reader->chunk));
+        unsigned pos = reader->read_pos;
+
+        reader->reading = true;
+        mh.unlock();
+        copy_out(pos, data.begin(), data.len());
+        mh.lock();
+        reader->reading = false;
+        reader->read_pos = pos + data.len();
+
+        // wake the audio thread if it is waiting for room
+        m_cond.notify_all();
+        mh.unlock();
+
+        write_all(reader->plugin, data);
+
+        mh.lock();
+        reader->written += data.len();
+    }
+
+    /* detached; the tap is not used any more */
+    mh.unlock();
+
+    if (opened)
+    {
+        write_all(reader->plugin, reader->leftover);
+        reader->plugin->close_audio();
+    }
+
+    finish_recording(reader);
+    delete reader;
+}
+
 static OutputState state;
 
 static OutputPlugin * cop; /* current (primary) output plugin */
-static OutputPlugin * sop; /* secondary output plugin */
-
-static OutputStream record_stream;
+static Index<SmartPtr<RecordSink>> sinks; /* secondary output plugins */
+static RecordTap taps[4];                  /* indexed by OutputStream */
 
 static int seek_time;
 static String in_filename;
 static Tuple in_tuple;
 static int in_format, in_channels, in_rate;
 static int effect_channels, effect_rate;
-static int sec_channels, sec_rate;
 static int out_format, out_channels, out_rate;
 static int out_bytes_per_sec, out_bytes_held;
 static int64_t in_frames, out_bytes_written;
@@ -162,6 +707,39 @@ static bool gain_info_valid;
 static Index<float> buffer1;
 static Index<char> buffer2;
 
+/* pipelined mode */
+static bool pipelined;
+static std::thread output_thread;
+static SampleRing ring;
+static int ring_ahead;            /* samples the input thread may queue */
+static int ring_chunk;            /* samples written at once by output thread */
+static int flush_serial;          /* incremented by each flush */
+static bool ring_flushed;         /* output thread should discard ... */
+static unsigned ring_flush_pos;   /* ... up to this position */
+static bool output_thread_busy;   /* output thread is writing a chunk */
+static bool output_thread_quit;
+
+/* gain applied to each buffer, recomputed by update_gain() whenever the
+ * replay gain info or one of the settings below changes */
+static float replay_gain_factor = 1; /* exactly 1 if within 1% */
+static float volume_left = 1, volume_right = 1;
+static bool soft_clip;
+
+static const char * const gain_settings[] = {
+    "enable_replay_gain", "enable_clipping_prevention", "replay_gain_mode",
+    "replay_gain_preamp", "default_gain",               "shuffle",
+    "album_shuffle",      "software_volume_control",    "sw_volume_left",
+    "sw_volume_right",    "soft_clipping"};
+
+/* returns the target latency (ms) in low-latency mode, otherwise 0 */
+static int get_target_latency()
+{
+    if (!low_latency.get())
+        return 0;
+
+    return aud::clamp(target_latency.get(), 1, 1000);
+}
+
 static inline int get_format(bool & automatic)
 {
     automatic = false;
@@ -191,14 +769,18 @@ static void setup_effects(SafeLock &)
     effect_rate = in_rate;
 
     effect_start(effect_channels, effect_rate);
-    eq_set_format(effect_channels, effect_rate);
 }
 
+static void stop_output_thread(UnsafeLock & lock);
+
 static void cleanup_output(UnsafeLock & lock)
 {
     if (!state.output())
         return;
 
+    if (pipelined)
+        stop_output_thread(lock);
+
     // avoid locking up if the input thread reaches close_audio() while
     // paused (unlikely but possible with perfect timing)
     if (out_bytes_written && !state.paused())
@@ -217,13 +799,37 @@ static void cleanup_output(UnsafeLock & lock)
     vis_runner_start_stop(false, false);
 }
 
-static void cleanup_secondary(SafeLock & lock)
+static int find_sink(OutputPlugin * plugin)
+{
+    for (int i = 0; i < sinks.len(); i++)
+    {
+        if (sinks[i]->plugin == plugin)
+            return i;
+    }
+
+    return -1;
+}
+
+static void close_sink(SafeLock & lock, RecordSink * sink)
 {
-    if (!state.secondary())
+    if (!sink->open)
         return;
 
-    state.set_secondary(lock, false);
-    sop->close_audio();
+    /* the recording thread closes the plugin */
+    taps[(int)sink->stream].detach_sink(sink);
+    sink->open = false;
+
+    bool any_open = false;
+    for (auto & s : sinks)
+        any_open = any_open || s->open;
+
+    state.set_secondary(lock, any_open);
+}
+
+static void cleanup_secondary(SafeLock & lock)
+{
+    for (auto & sink : sinks)
+        close_sink(lock, sink.get());
 }
 
 static void apply_pause(SafeLock & lock, bool pause, bool new_output = false)
@@ -240,14 +846,191 @@ static void apply_pause(SafeLock & lock, bool pause, bool new_output = false)
     state.set_paused(lock, pause);
 }
 
-static bool open_audio_with_info(OutputPlugin * op, const char * filename,
-                                 const Tuple & tuple, int format, int rate,
-                                 int chans, String & error)
+/* The outcome of opening the output plugin with each combination of format,
+ * rate, and channels is remembered (and saved in the config), so that those
+ * known to fail are not tried again at every song.  Failures are recorded only
+ * once some other combination has worked, so that an unavailable device does
+ * not make the whole cache fail.  The cache of the current plugin is discarded
+ * when the plugin is reset (which output plugins do when the device changes),
+ * and also if nothing else works. */
+struct FormatEntry
+{
+    int format, rate, channels;
+    bool works;
+};
+
+static constexpr int MAX_FORMAT_ENTRIES = 64;
+
+static OutputPlugin * formats_plugin;     /* plugin the entries are for */
+static Index<FormatEntry> format_cache;   /* oldest first */
+static Index<FormatEntry> formats_failed; /* pending until one works */
+
+static StringBuf format_cache_key(OutputPlugin * plugin)
+{
+    PluginHandle * handle = aud_plugin_by_header(plugin);
+    return str_concat({"output_formats_", aud_plugin_get_basename(handle)});
+}
+
+static void load_format_cache()
+{
+    if (formats_plugin == cop)
+        return;
+
+    formats_plugin = cop;
+    format_cache.clear();
+    formats_failed.clear();
+
+    if (!cop)
+        return;
+
+    auto list = str_list_to_index(aud_get_str(nullptr, format_cache_key(cop)),
+                                  ",");
+
+    for (int i = 0; i + 4 <= list.len(); i += 4)
+        format_cache.append(FormatEntry{str_to_int(list[i]),
+                                        str_to_int(list[i + 1]),
+                                        str_to_int(list[i + 2]),
+                                        str_to_int(list[i + 3]) != 0});
+}
+
+static void save_format_cache()
+{
+    Index<int> values;
+
+    for (auto & entry : format_cache)
+    {
+        values.append(entry.format);
+        values.append(entry.rate);
+        values.append(entry.channels);
+        values.append(entry.works);
+    }
+
+    aud_set_str(nullptr, format_cache_key(cop),
+                int_array_to_str(values.begin(), values.len()));
+}
+
+static void forget_formats()
+{
+    format_cache.clear();
+    formats_failed.clear();
+
+    if (cop)
+        save_format_cache();
+}
+
+static FormatEntry * find_format(int format, int rate, int channels)
+{
+    for (auto & entry : format_cache)
+    {
+        if (entry.format == format && entry.rate == rate &&
+            entry.channels == channels)
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+static void remember_format(const FormatEntry & result)
+{
+    FormatEntry * entry = find_format(result.format, result.rate,
+                                      result.channels);
+
+    if (entry)
+        entry->works = result.works;
+    else
+    {
+        if (format_cache.len() == MAX_FORMAT_ENTRIES)
+            format_cache.remove(0, 1);
+
+        format_cache.append(result);
+    }
+}
+
+/* tries the given rate with each fallback format in turn */
+static bool open_output(int & format, bool automatic, int rate, String & error)
+{
+    while (1)
+    {
+        FormatEntry * entry = find_format(format, rate, effect_channels);
+
+        if (entry && !entry->works)
+            AUDINFO("Format %d at %d Hz is known not to work.\n", format,
+                    rate);
+        else if (open_audio_with_info(cop, in_filename, in_tuple, format, rate,
+                                      effect_channels, error))
+        {
+            if (!entry || formats_failed.len())
+            {
+                for (auto & failed : formats_failed)
+                    remember_format(failed);
+
+                remember_format({format, rate, effect_channels, true});
+                save_format_cache();
+            }
+
+            formats_failed.clear();
+            return true;
+        }
+        else
+            formats_failed.append(FormatEntry{format, rate, effect_channels,
+                                              false});
+
+        if (automatic && format == FMT_FLOAT)
+            format = FMT_S32_NE;
+        else if (automatic && format == FMT_S32_NE)
+            format = FMT_S16_NE;
+        else if (format == FMT_S24_3NE)
+            format =
+                FMT_S24_NE; /* some output plugins support only padded 24-bit */
+        else
+            return false;
+
+        AUDINFO("Falling back to format %d.\n", format);
+    }
+}
+
+/* if the output does not support the sample rate at all, falls back to one of
+ * the common rates, which will be resampled to */
+static bool open_output_any_rate(int & format, bool automatic, int & rate,
+                                 String & error)
+{
+    int first_format = format;
+
+    rate = effect_rate;
+    if (open_output(format, automatic, rate, error))
+        return true;
+
+    for (int fallback : {48000, 44100})
+    {
+        if (fallback == effect_rate)
+            continue;
+
+        AUDINFO("Falling back to %d Hz.\n", fallback);
+
+        format = first_format;
+        rate = fallback;
+
+        if (open_output(format, automatic, rate, error))
+            return true;
+    }
+
+    return false;
+}
+
+/* the output of the effects is resampled if the output stream was opened at a
+ * different rate; the equalizer comes after the resampler */
+static void setup_resampler(SafeLock &)
 {
-    op->set_info(filename, tuple);
-    return op->open_audio(format, rate, chans, error);
+    auto quality = (ResampleQuality)aud::clamp(aud_get_int("resample_quality"),
+                                               (int)ResampleQuality::Fast,
+                                               (int)ResampleQuality::Best);
+
+    resample_start(effect_channels, effect_rate, out_rate, quality);
+    eq_set_format(out_channels, out_rate);
 }
 
+static void start_output_thread(UnsafeLock & lock);
+
 static void setup_output(UnsafeLock & lock, bool new_input, bool pause)
 {
     assert(state.input());
@@ -258,11 +1041,14 @@ static void setup_output(UnsafeLock & lock, bool new_input, bool pause)
     bool automatic;
     int format = get_format(automatic);
 
+    /* with "resample_output", a change in sample rate alone is handled by
+     * resampling instead of reopening the output */
     if (state.output() && effect_channels == out_channels &&
-        effect_rate == out_rate && !(new_input && cop->force_reopen))
+        (effect_rate == out_rate || aud_get_bool("resample_output")) &&
+        !(new_input && cop->force_reopen))
     {
-        AUDINFO("Reuse output, %d channels, %d Hz.\n", effect_channels,
-                effect_rate);
+        AUDINFO("Reuse output, %d channels, %d Hz.\n", out_channels, out_rate);
+        setup_resampler(lock);
         apply_pause(lock, pause);
         return;
     }
@@ -272,97 +1058,136 @@ static void setup_output(UnsafeLock & lock, bool new_input, bool pause)
 
     cleanup_output(lock);
 
+    load_format_cache();
+
     String error;
-    while (!open_audio_with_info(cop, in_filename, in_tuple, format,
-                                 effect_rate, effect_channels, error))
+    int first_format = format, rate;
+    bool opened = open_output_any_rate(format, automatic, rate, error);
+
+    /* perhaps the device has changed */
+    if (!opened && format_cache.len())
     {
-        if (automatic && format == FMT_FLOAT)
-            format = FMT_S32_NE;
-        else if (automatic && format == FMT_S32_NE)
-            format = FMT_S16_NE;
-        else if (format == FMT_S24_3NE)
-            format =
-                FMT_S24_NE; /* some output plugins support only padded 24-bit */
-        else
-        {
-            aud_ui_show_error(error ? (const char *)error
-                                    : _("Error opening output stream"));
-            return;
-        }
+        AUDINFO("Retrying without remembered formats.\n");
 
-        AUDINFO("Falling back to format %d.\n", format);
+        forget_formats();
+        format = first_format;
+        opened = open_output_any_rate(format, automatic, rate, error);
+    }
+
+    formats_failed.clear();
+
+    if (!opened)
+    {
+        aud_ui_show_error(error ? (const char *)error
+                                : _("Error opening output stream"));
+        return;
     }
 
     state.set_output(lock, true);
 
     out_format = format;
     out_channels = effect_channels;
-    out_rate = effect_rate;
+    out_rate = rate;
+
+    setup_resampler(lock);
 
     out_bytes_per_sec = FMT_SIZEOF(format) * out_channels * out_rate;
     out_bytes_held = 0;
     out_bytes_written = 0;
 
     apply_pause(lock, pause, true);
+
+    if (aud_get_bool("output_thread"))
+        start_output_thread(lock);
 }
 
-static void setup_secondary(SafeLock & lock, bool new_input)
+/* the tap point of each secondary output plugin can be set separately, and
+ * defaults to the "record_stream" setting */
+static StringBuf record_stream_key(PluginHandle * plugin)
 {
-    assert(state.input());
+    return str_concat({"record_stream_", aud_plugin_get_basename(plugin)});
+}
 
-    if (!sop)
-        return;
+static OutputStream get_record_stream(OutputPlugin * plugin)
+{
+    PluginHandle * handle = aud_plugin_by_header(plugin);
+    String value = aud_get_str(nullptr, record_stream_key(handle));
+    int stream = value[0] ? str_to_int(value) : aud_get_int("record_stream");
+
+    return (OutputStream)aud::clamp(stream, (int)OutputStream::AsDecoded,
+                                    (int)OutputStream::AfterEqualizer);
+}
 
+static void setup_sink(SafeLock & lock, RecordSink * sink, bool new_input)
+{
+    OutputStream stream = get_record_stream(sink->plugin);
     int rate, channels;
-    record_stream = (OutputStream)aud_get_int("record_stream");
 
-    if (record_stream < OutputStream::AfterEffects)
+    if (stream < OutputStream::AfterEffects)
     {
         rate = in_rate;
         channels = in_channels;
     }
     else
     {
-        rate = effect_rate;
+        /* these come after the resampler */
+        rate = state.output() ? out_rate : effect_rate;
         channels = effect_channels;
     }
 
-    if (state.secondary() && channels == sec_channels && rate == sec_rate &&
-        !(new_input && sop->force_reopen))
+    /* a plugin that failed to open is tried again with each song */
+    if (sink->open && stream == sink->stream && channels == sink->channels &&
+        rate == sink->rate && !(new_input && sink->plugin->force_reopen) &&
+        !(new_input && taps[(int)stream].failed(sink)))
         return;
 
-    cleanup_secondary(lock);
+    /* the earlier recording is finished by its own thread, and the new one
+     * does not open the plugin until then */
+    close_sink(lock, sink);
 
-    String error;
-    if (!open_audio_with_info(sop, in_filename, in_tuple, FMT_FLOAT, rate,
-                              channels, error))
-    {
-        aud_ui_show_error(error ? (const char *)error
-                                : _("Error recording output stream"));
-        return;
-    }
+    sink->stream = stream;
+    sink->channels = channels;
+    sink->rate = rate;
+    sink->open = true;
 
+    taps[(int)stream].start_sink(sink, in_filename, in_tuple);
     state.set_secondary(lock, true);
+}
 
-    sec_channels = channels;
-    sec_rate = rate;
+static void setup_secondary(SafeLock & lock, bool new_input)
+{
+    assert(state.input());
+
+    for (auto & sink : sinks)
+        setup_sink(lock, sink.get(), new_input);
 }
 
-static void flush_output(SafeLock &)
+static void flush_output(SafeLock & lock)
 {
     assert(state.output());
 
     out_bytes_held = 0;
     out_bytes_written = 0;
 
+    if (pipelined)
+    {
+        ring_flushed = true;
+        ring_flush_pos = ring.write_pos();
+        state.notify_change(lock);
+    }
+
+    flush_serial++;
+
+    resample_flush();
+
     cop->flush();
     vis_runner_flush();
 }
 
-static void apply_replay_gain(SafeLock &, Index<float> & data)
+static float get_replay_gain_factor()
 {
     if (!aud_get_bool("enable_replay_gain"))
-        return;
+        return 1;
 
     float factor = powf(10, aud_get_double("replay_gain_preamp") / 20);
 
@@ -390,75 +1215,114 @@ static void apply_replay_gain(SafeLock &, Index<float> & data)
     else
         factor *= powf(10, aud_get_double("default_gain") / 20);
 
-    if (factor < 0.99 || factor > 1.01)
-        audio_amplify(data.begin(), 1, data.len(), &factor);
+    return (factor < 0.99 || factor > 1.01) ? factor : 1;
 }
 
-static void write_secondary(SafeLock &, const Index<float> & data)
+static void update_gain(SafeLock &)
 {
-    assert(state.secondary());
+    replay_gain_factor = get_replay_gain_factor();
 
-    auto begin = (const char *)data.begin();
-    auto end = (const char *)data.end();
+    if (aud_get_bool("software_volume_control"))
+    {
+        volume_left = audio_volume_factor(aud_get_int("sw_volume_left"));
+        volume_right = audio_volume_factor(aud_get_int("sw_volume_right"));
+    }
+    else
+        volume_left = volume_right = 1;
 
-    while (begin < end)
-        begin += sop->write_audio(begin, end - begin);
+    soft_clip = aud_get_bool("soft_clipping");
+}
+
+static void apply_replay_gain(SafeLock &, Index<float> & data)
+{
+    if (replay_gain_factor != 1)
+        audio_amplify(data.begin(), 1, data.len(), &replay_gain_factor);
+}
+
+static bool recording(SafeLock &, OutputStream stream)
+{
+    return state.secondary() && taps[(int)stream].active();
+}
+
+static void write_secondary(SafeLock & lock, OutputStream stream,
+                            const Index<float> & data)
+{
+    if (recording(lock, stream))
+        taps[(int)stream].push(data.begin(), data.len());
 }
 
-static void write_output(UnsafeLock & lock, Index<float> & data)
+/* called from the input thread with the major lock held, or from the output
+ * thread in pipelined mode */
+static void write_output(SafeLock & lock, Index<float> & data)
 {
     assert(state.output());
 
     if (!data.len())
         return;
 
-    if (state.secondary() && record_stream == OutputStream::AfterEffects)
-        write_secondary(lock, data);
+    write_secondary(lock, OutputStream::AfterEffects, data);
 
     int out_time =
         aud::rescale<int64_t>(out_bytes_written, out_bytes_per_sec, 1000);
     vis_runner_pass_audio(out_time, data, out_channels, out_rate);
 
-    eq_filter(data.begin(), data.len());
+    /* the equalizer is run as part of the blocked post-processing pass,
+     * unless its output is needed by itself for recording */
+    AudioFilterFunc filter = eq_filter;
 
-    if (state.secondary() && record_stream == OutputStream::AfterEqualizer)
-        write_secondary(lock, data);
-
-    if (aud_get_bool("software_volume_control"))
+    if (recording(lock, OutputStream::AfterEqualizer))
     {
-        StereoVolume v = {aud_get_int("sw_volume_left"),
-                          aud_get_int("sw_volume_right")};
-        audio_amplify(data.begin(), out_channels, data.len() / out_channels, v);
+        eq_filter(data.begin(), data.len());
+        write_secondary(lock, OutputStream::AfterEqualizer, data);
+        filter = nullptr;
     }
 
-    if (aud_get_bool("soft_clipping"))
-        audio_soft_clip(data.begin(), data.len());
-
     const void * out_data = data.begin();
 
     if (out_format != FMT_FLOAT)
     {
         buffer2.resize(FMT_SIZEOF(out_format) * data.len());
-        audio_to_int(data.begin(), buffer2.begin(), out_format, data.len());
         out_data = buffer2.begin();
     }
 
+    audio_post_process(data.begin(), buffer2.begin(), out_format, out_channels,
+                       data.len() / out_channels, filter, volume_left,
+                       volume_right, soft_clip);
+
     out_bytes_held = FMT_SIZEOF(out_format) * data.len();
 
+    int target = get_target_latency();
+    int max_bytes = out_bytes_held;
+
+    if (target)
+        max_bytes = FMT_SIZEOF(out_format) * out_channels *
+                    aud::max(aud::rescale(target / 2, 1000, out_rate), 1);
+
     while (out_bytes_held && !state.resetting())
     {
         if (state.paused())
         {
             // avoid locking up if the input thread reaches close_audio() while
-            // paused (unlikely but possible with perfect timing)
-            if (!state.input())
+            // paused (unlikely but possible with perfect timing), or if the
+            // output thread is being stopped while paused
+            if (!state.input() || output_thread_quit)
                 break;
 
             state.await_change(lock);
             continue;
         }
 
-        int written = cop->write_audio(out_data, out_bytes_held);
+        // in low-latency mode, wait until the output plugin is down to the
+        // target before giving it more audio
+        int excess = target ? cop->get_delay() - target : 0;
+        if (excess > 0)
+        {
+            state.await_change_for(lock, excess);
+            continue;
+        }
+
+        int len = aud::min(out_bytes_held, max_bytes);
+        int written = cop->write_audio(out_data, len);
 
         out_data = (const char *)out_data + written;
         out_bytes_held -= written;
@@ -467,19 +1331,19 @@ static void write_output(UnsafeLock & lock, Index<float> & data)
         if (!out_bytes_held)
             break;
 
-        lock.minor.unlock();
-        cop->period_wait();
-        lock.minor.lock();
+        if (written < len)
+        {
+            lock.minor.unlock();
+            cop->period_wait();
+            lock.minor.lock();
+        }
     }
 }
 
-static bool process_audio(UnsafeLock & lock, const void * data, int size,
-                          int stop_time)
+/* returns the number of samples to process, truncated at stop_time */
+static int limit_samples(SafeLock &, int samples, int stop_time, bool & stopped)
 {
-    assert(state.input() && state.output());
-
-    int samples = size / FMT_SIZEOF(in_format);
-    bool stopped = false;
+    stopped = false;
 
     if (stop_time != -1)
     {
@@ -495,7 +1359,173 @@ static bool process_audio(UnsafeLock & lock, const void * data, int size,
         }
     }
 
-    in_frames += samples / in_channels;
+    return samples;
+}
+
+/* pipelined mode: passes audio to the output thread, waiting for room in the
+ * ring as needed; audio is dropped if a flush happens in the meantime */
+static void queue_output(SafeLock & lock, const Index<float> & data,
+                         int serial)
+{
+    const float * pos = data.begin();
+    int left = data.len();
+
+    while (left && flush_serial == serial && !state.resetting())
+    {
+        int ahead = ring_ahead;
+        int target = get_target_latency();
+
+        if (target)
+        {
+            int frames = aud::max(aud::rescale(target, 1000, out_rate), 1);
+            ahead = aud::min(ahead, out_channels * frames);
+        }
+
+        int room = aud::min(ahead - ring.len(), ring.space());
+
+        if (room <= 0)
+        {
+            // see write_output()
+            if (state.paused() && !state.input())
+                break;
+
+            state.await_change(lock);
+            continue;
+        }
+
+        int samples = aud::min(left, room);
+        ring.write(pos, samples);
+        state.notify_change(lock);
+
+        pos += samples;
+        left -= samples;
+    }
+}
+
+/* pipelined mode: takes audio from the ring and writes it to the output plugin
+ * in chunks of about 20 ms (less in low-latency mode) */
+static void output_thread_run()
+{
+    auto lock = state.lock_safe();
+    Index<float> data;
+
+    while (!output_thread_quit)
+    {
+        if (ring_flushed)
+        {
+            ring.discard_to(ring_flush_pos);
+            ring_flushed = false;
+            state.notify_change(lock);
+        }
+
+        int avail = ring.len();
+        if (!avail || state.paused() || state.resetting())
+        {
+            state.await_change(lock);
+            continue;
+        }
+
+        output_thread_busy = true;
+
+        // the chunk is further limited by write_output() in low-latency mode
+        data.resize(aud::min(avail, ring_chunk));
+
+        lock.minor.unlock();
+        ring.read(data.begin(), data.len());
+        lock.minor.lock();
+
+        // wake the input thread if it is waiting for room
+        state.notify_change(lock);
+
+        // audio read before a flush is dropped
+        if (!ring_flushed)
+            write_output(lock, data);
+
+        output_thread_busy = false;
+        state.notify_change(lock);
+    }
+}
+
+static void start_output_thread(UnsafeLock & lock)
+{
+    assert(state.output() && !pipelined);
+
+    // in low-latency mode, the ring is further limited by queue_output()
+    int ahead = aud::clamp(aud_get_int("output_thread_ahead"), 20, 10000);
+    int chunk = 20;
+
+    ring_ahead = aud::max(aud::rescale(ahead, 1000, out_rate), 1);
+    ring_chunk = aud::max(aud::rescale(chunk, 1000, out_rate), 1);
+    ring_ahead *= out_channels;
+    ring_chunk *= out_channels;
+    ring.alloc(ring_ahead);
+
+    ring_flushed = false;
+    output_thread_busy = false;
+    output_thread_quit = false;
+    pipelined = true;
+
+    output_thread = std::thread(output_thread_run);
+}
+
+static void stop_output_thread(UnsafeLock & lock)
+{
+    assert(pipelined);
+
+    // let the output thread finish the queued audio first, unless it is being
+    // thrown away anyway (this is the pipelined equivalent of drain())
+    while ((ring.len() || output_thread_busy) && !ring_flushed &&
+           !state.paused() && !state.resetting())
+        state.await_change(lock);
+
+    output_thread_quit = true;
+    state.notify_change(lock);
+
+    lock.minor.unlock();
+    output_thread.join();
+    lock.minor.lock();
+
+    output_thread_quit = false;
+    pipelined = false;
+    ring.destroy();
+}
+
+/* processes the input audio, which has been placed in buffer1 */
+static void process_buffer(UnsafeLock & lock)
+{
+    assert(state.input() && state.output());
+
+    in_frames += buffer1.len() / in_channels;
+
+    write_secondary(lock, OutputStream::AsDecoded, buffer1);
+
+    apply_replay_gain(lock, buffer1);
+
+    write_secondary(lock, OutputStream::AfterReplayGain, buffer1);
+
+    if (!pipelined)
+    {
+        write_output(lock, resample_process(effect_process(buffer1)));
+        return;
+    }
+
+    // effects are run without the minor lock so that the output thread is not
+    // held up; the major lock still prevents a reset in the meantime
+    int serial = flush_serial;
+
+    lock.minor.unlock();
+    auto & data = resample_process(effect_process(buffer1));
+    lock.minor.lock();
+
+    queue_output(lock, data, serial);
+}
+
+static bool process_audio(UnsafeLock & lock, const void * data, int size,
+                          int stop_time)
+{
+    bool stopped;
+    int samples =
+        limit_samples(lock, size / FMT_SIZEOF(in_format), stop_time, stopped);
 
     buffer1.resize(samples);
 
@@ -504,16 +1534,35 @@ static bool process_audio(UnsafeLock & lock, const void * data, int size,
     else
         audio_from_int(data, in_format, buffer1.begin(), samples);
 
-    if (state.secondary() && record_stream == OutputStream::AsDecoded)
-        write_secondary(lock, buffer1);
+    process_buffer(lock);
+    return !stopped;
+}
 
-    apply_replay_gain(lock, buffer1);
+/* takes over a buffer of samples already converted to floating point, instead
+ * of copying it; buffer1's previous allocation is handed back for reuse */
+static bool process_audio(UnsafeLock & lock, Index<float> & data,
+                          int stop_time)
+{
+    /* a plugin error; the samples would be misread otherwise */
+    if (in_format != FMT_FLOAT)
+    {
+        AUDERR("Float samples written to a stream of format %d.\n",
+               in_format);
+        data.resize(0);
+        return true;
+    }
 
-    if (state.secondary() && record_stream == OutputStream::AfterReplayGain)
-        write_secondary(lock, buffer1);
+    bool stopped;
+    int samples = limit_samples(lock, data.len(), stop_time, stopped);
 
-    write_output(lock, effect_process(buffer1));
+    Index<float> spare = std::move(buffer1);
+    buffer1 = std::move(data);
+    data = std::move(spare);
+
+    buffer1.resize(samples);
+    data.resize(0);
 
+    process_buffer(lock);
     return !stopped;
 }
 
@@ -522,7 +1571,13 @@ static void finish_effects(UnsafeLock & lock, bool end_of_playlist)
     assert(state.output());
 
     buffer1.resize(0);
-    write_output(lock, effect_finish(buffer1, end_of_playlist));
+    auto & data = resample_finish(effect_finish(buffer1, end_of_playlist),
+                                  end_of_playlist);
+
+    if (pipelined)
+        queue_output(lock, data, flush_serial);
+    else
+        write_output(lock, data);
 }
 
 bool output_open_audio(const String & filename, const Tuple & tuple, int format,
@@ -539,6 +1594,7 @@ bool output_open_audio(const String & filename, const Tuple & tuple, int format,
 
     seek_time = start_time;
     gain_info_valid = false;
+    update_gain(lock);
 
     in_filename = filename;
     in_tuple = tuple.ref();
@@ -572,6 +1628,7 @@ void output_set_replay_gain(const ReplayGainInfo & info)
     {
         gain_info = info;
         gain_info_valid = true;
+        update_gain(lock);
 
         AUDINFO("Replay Gain info:\n");
         AUDINFO(" album gain: %f dB\n", info.album_gain);
@@ -581,8 +1638,9 @@ void output_set_replay_gain(const ReplayGainInfo & info)
     }
 }
 
-/* returns false if stop_time is reached */
-bool output_write_audio(const void * data, int size, int stop_time)
+/* waits until the output is ready for audio and then calls process() */
+template<class F>
+static bool write_audio_with(F process)
 {
     while (1)
     {
@@ -591,13 +1649,29 @@ bool output_write_audio(const void * data, int size, int stop_time)
             return false;
 
         if (state.output() && !state.resetting())
-            return process_audio(lock, data, size, stop_time);
+            return process(lock);
 
         lock.major.unlock();
         state.await_change(lock);
     }
 }
 
+/* returns false if stop_time is reached */
+bool output_write_audio(const void * data, int size, int stop_time)
+{
+    return write_audio_with([&](UnsafeLock & lock) {
+        return process_audio(lock, data, size, stop_time);
+    });
+}
+
+/* returns false if stop_time is reached */
+bool output_write_audio(Index<float> && data, int stop_time)
+{
+    return write_audio_with([&](UnsafeLock & lock) {
+        return process_audio(lock, data, stop_time);
+    });
+}
+
 void output_flush(int time, bool force)
 {
     auto lock = state.lock_safe();
@@ -635,23 +1709,31 @@ void output_pause(bool pause)
         apply_pause(lock, pause);
 }
 
+/* returns the amount of audio passed to output_write_audio() that has not yet
+ * been heard, in milliseconds */
+static int get_latency(SafeLock &)
+{
+    int delay = 0;
+
+    if (state.output())
+    {
+        delay = cop->get_delay();
+        delay += aud::rescale<int64_t>(out_bytes_held, out_bytes_per_sec, 1000);
+        delay += aud::rescale(ring.len() / out_channels, out_rate, 1000);
+    }
+
+    return effect_adjust_delay(resample_adjust_delay(delay));
+}
+
 int output_get_time()
 {
     auto lock = state.lock_safe();
-    int time = 0, delay = 0;
+    int time = 0;
 
     if (state.input())
     {
-        if (state.output())
-        {
-            delay = cop->get_delay();
-            delay +=
-                aud::rescale<int64_t>(out_bytes_held, out_bytes_per_sec, 1000);
-        }
-
-        delay = effect_adjust_delay(delay);
         time = aud::rescale<int64_t>(in_frames, in_rate, 1000);
-        time = seek_time + aud::max(time - delay, 0);
+        time = seek_time + aud::max(time - get_latency(lock), 0);
     }
 
     return time;
@@ -703,6 +1785,24 @@ void output_drain()
 
 static void output_reset(OutputReset type, OutputPlugin * op)
 {
+    /* a secondary plugin may become primary, once its recording has finished
+     * (which is not waited for with the output locked) */
+    bool was_secondary = false;
+    if (type == OutputReset::ResetPlugin && op)
+    {
+        auto lock = state.lock_safe();
+        int i = find_sink(op);
+        if (i >= 0)
+        {
+            close_sink(lock, sinks[i].get());
+            sinks.remove(i, 1);
+            was_secondary = true;
+        }
+    }
+
+    if (was_secondary)
+        wait_drained(op);
+
     auto lock1 = state.lock_safe();
 
     state.set_resetting(lock1, true);
@@ -719,20 +1819,15 @@ static void output_reset(OutputReset type, OutputPlugin * op)
     /* this does not reset the secondary plugin */
     if (type == OutputReset::ResetPlugin)
     {
+        /* resetting the same plugin means the device may have changed */
+        if (op == cop && formats_plugin == cop)
+            forget_formats();
+
         if (cop)
             cop->cleanup();
 
-        if (op)
-        {
-            /* secondary plugin may become primary */
-            if (op == sop)
-            {
-                cleanup_secondary(lock2);
-                sop = nullptr;
-            }
-            else if (!op->init())
-                op = nullptr;
-        }
+        if (op && !was_secondary && !op->init())
+            op = nullptr;
 
         cop = op;
     }
@@ -753,6 +1848,39 @@ static void output_reset(OutputReset type, OutputPlugin * op)
 
 EXPORT void aud_output_reset(OutputReset type) { output_reset(type, cop); }
 
+EXPORT OutputStream aud_drct_get_record_stream(PluginHandle * plugin)
+{
+    return get_record_stream((OutputPlugin *)aud_plugin_get_header(plugin));
+}
+
+EXPORT void aud_drct_set_record_stream(PluginHandle * plugin,
+                                       OutputStream stream)
+{
+    aud_set_int(nullptr, record_stream_key(plugin), (int)stream);
+
+    auto lock = state.lock_safe();
+    if (state.input() && aud_get_bool("record"))
+        setup_secondary(lock, false);
+}
+
+EXPORT RecordStats aud_drct_get_record_stats(PluginHandle * plugin)
+{
+    auto lock = state.lock_safe();
+    int i = find_sink((OutputPlugin *)aud_plugin_get_header(plugin));
+
+    if (i < 0 || !sinks[i]->open)
+        return RecordStats();
+
+    RecordSink * sink = sinks[i].get();
+    return taps[(int)sink->stream].stats(sink);
+}
+
+EXPORT int aud_drct_get_latency()
+{
+    auto lock = state.lock_safe();
+    return state.input() ? get_latency(lock) : 0;
+}
+
 EXPORT StereoVolume aud_drct_get_volume()
 {
     auto lock = state.lock_safe();
@@ -788,10 +1916,6 @@ PluginHandle * output_plugin_get_current()
     return cop ? aud_plugin_by_header(cop) : nullptr;
 }
 
-PluginHandle * output_plugin_get_secondary()
-{
-    return sop ? aud_plugin_by_header(sop) : nullptr;
-}
 
 bool output_plugin_set_current(PluginHandle * plugin)
 {
@@ -801,22 +1925,40 @@ bool output_plugin_set_current(PluginHandle * plugin)
     return (!plugin || cop);
 }
 
-bool output_plugin_set_secondary(PluginHandle * plugin)
+bool output_plugin_add_secondary(PluginHandle * plugin)
 {
-    auto lock = state.lock_safe();
+    auto op = (OutputPlugin *)aud_plugin_get_header(plugin);
+    if (!op || !op->init())
+        return false;
 
-    cleanup_secondary(lock);
-    if (sop)
-        sop->cleanup();
+    auto lock = state.lock_safe();
 
-    sop = plugin ? (OutputPlugin *)aud_plugin_get_header(plugin) : nullptr;
-    if (sop && !sop->init())
-        sop = nullptr;
+    RecordSink * sink = new RecordSink();
+    sink->plugin = op;
+    sinks.append(SmartPtr<RecordSink>(sink));
 
     if (state.input() && aud_get_bool("record"))
-        setup_secondary(lock, false);
+        setup_sink(lock, sink, false);
+
+    return true;
+}
+
+void output_plugin_remove_secondary(PluginHandle * plugin)
+{
+    auto op = (OutputPlugin *)aud_plugin_get_header(plugin);
+    auto lock = state.lock_safe();
+
+    int i = find_sink(op);
+    if (i < 0)
+        return;
+
+    close_sink(lock, sinks[i].get());
+    sinks.remove(i, 1);
 
-    return (!plugin || sop);
+    /* the recording thread still uses the plugin until it has finished */
+    lock.minor.unlock();
+    wait_drained(op);
+    op->cleanup();
 }
 
 static void record_settings_changed(void *, void *)
@@ -829,14 +1971,44 @@ static void record_settings_changed(void *, void *)
         cleanup_secondary(lock);
 }
 
+static void gain_settings_changed(void *, void *)
+{
+    auto lock = state.lock_safe();
+    update_gain(lock);
+}
+
 void output_init()
 {
+    for (auto name : gain_settings)
+        hook_associate(str_concat({"set ", name}), gain_settings_changed,
+                       nullptr);
+
     hook_associate("set record", record_settings_changed, nullptr);
     hook_associate("set record_stream", record_settings_changed, nullptr);
+
+    record_overflow.connect();
+    low_latency.connect();
+    target_latency.connect();
+
+    auto lock = state.lock_safe();
+    update_gain(lock);
 }
 
 void output_cleanup()
 {
+    for (auto name : gain_settings)
+        hook_dissociate(str_concat({"set ", name}), gain_settings_changed);
+
     hook_dissociate("set record", record_settings_changed);
     hook_dissociate("set record_stream", record_settings_changed);
+
+    record_overflow.disconnect();
+    low_latency.disconnect();
+    target_latency.disconnect();
+
+    formats_plugin = nullptr;
+    format_cache.clear();
+    formats_failed.clear();
+
+    wait_drained(nullptr);
 }
@@ -21,6 +21,7 @@
 #define LIBAUDCORE_OUTPUT_H
 
 #include <libaudcore/audio.h>
+#include <libaudcore/index.h>
 #include <libaudcore/objects.h>
 
 class PluginHandle;
@@ -34,6 +35,7 @@ bool output_open_audio(const String & filename, const Tuple & tuple, int format,
 void output_set_tuple(const Tuple & tuple);
 void output_set_replay_gain(const ReplayGainInfo & info);
 bool output_write_audio(const void * data, int size, int stop_time);
+bool output_write_audio(Index<float> && data, int stop_time);
 void output_flush(int time, bool force = false);
 void output_resume();
 void output_pause(bool pause);
@@ -44,8 +46,8 @@ void output_close_audio();
 void output_drain();
 
 PluginHandle * output_plugin_get_current();
-PluginHandle * output_plugin_get_secondary();
 bool output_plugin_set_current(PluginHandle * plugin);
-bool output_plugin_set_secondary(PluginHandle * plugin);
+bool output_plugin_add_secondary(PluginHandle * plugin);
+void output_plugin_remove_secondary(PluginHandle * plugin);
 
 #endif
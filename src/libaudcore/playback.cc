@@ -31,13 +31,28 @@
  *
  * Note that this file and playlist.cc each have their own mutex.  The one in
  * playlist.cc is conceptually the "outer" mutex and must be locked first (in
- * situations where both need to be locked) in order to avoid deadlock.
+ * situations where both need to be locked) in order to avoid deadlock.  The
+ * same goes for the per-playlist locks in playlist.cc, which are taken after
+ * its mutex but still before the one here.  Nothing in this file may call into
+ * the playlist while holding its own mutex.
+ *
+ * With gapless pre-roll enabled, the next song in the playlist is opened and
+ * decoded into a side buffer by a separate "pre-roll" thread, a few seconds
+ * before the current song ends.  The InputPlugin functions below recognize the
+ * pre-roll thread and redirect its calls to the side buffer.  If the song does
+ * come up next, the pre-roll is "promoted": the side buffer is written to the
+ * output, the pre-roll thread carries on as the decoder of the current song,
+ * and the playback thread waits for it to finish.  Otherwise, the pre-roll is
+ * cancelled and the song is played the usual way.  A cancelled pre-roll thread
+ * is not waited for, since it may be stuck opening a network stream; it deletes
+ * its PreRoll itself when it finishes.
  */
 
 #include "drct.h"
 #include "internal.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "audstrings.h"
 #include "hook.h"
@@ -49,6 +64,7 @@
 #include "plugin.h"
 #include "plugins-internal.h"
 #include "plugins.h"
+#include "probe.h"
 #include "runtime.h"
 #include "threads.h"
 
@@ -77,6 +93,7 @@ struct PlaybackInfo
 
     // set by playback thread
     String filename;
+    InputPlugin * ip = nullptr;
     int length = -1;
     int time_offset = 0;
     int stop_time = -1;
@@ -91,9 +108,37 @@ struct PlaybackInfo
     bool ready = false;
     bool ended = false;
     bool error = false;
+    bool preroll_checked = false;
     String error_s;
 };
 
+struct PreRoll
+{
+    String filename;
+    PluginHandle * decoder = nullptr;
+    Tuple tuple;
+    std::thread thread;
+
+    // set by pre-roll thread
+    InputPlugin * ip = nullptr;
+    VFSFile file;
+    bool opened = false;
+    int format = 0, rate = 0, channels = 0;
+    ReplayGainInfo gain{};
+    bool gain_valid = false;
+    bool tuple_changed = false;
+    int bitrate = 0;
+    Index<float> buffer; // already converted to floating point
+    int buffer_max = 0;  // in samples
+    bool finished = false;
+    bool result = false;
+
+    // set by playback thread
+    bool cancel = false;
+    bool promoted = false;
+    bool orphaned = false; // cancelled and no longer referenced
+};
+
 static aud::mutex mutex;
 static aud::condvar cond;
 
@@ -105,6 +150,38 @@ static QueuedFunc end_queue;
 static bool song_finished = false;
 static int failed_entries = 0;
 
+// pending pre-roll, not yet promoted or cancelled
+static PreRoll * preroll = nullptr;
+// pre-roll being decoded by the calling thread, until it is promoted
+static thread_local PreRoll * this_preroll = nullptr;
+// cancelled pre-roll threads still running
+static int orphaned_prerolls = 0;
+
+// settings read from the playback thread
+static ConfigHandle<bool> repeat("repeat");
+static ConfigHandle<bool> no_playlist_advance("no_playlist_advance");
+static ConfigHandle<bool> show_numbers_in_pl("show_numbers_in_pl");
+static ConfigHandle<bool> gapless_preroll("gapless_preroll");
+static ConfigHandle<int> preroll_seconds("preroll_seconds");
+
+void playback_init()
+{
+    repeat.connect();
+    no_playlist_advance.connect();
+    show_numbers_in_pl.connect();
+    gapless_preroll.connect();
+    preroll_seconds.connect();
+}
+
+void playback_cleanup()
+{
+    repeat.disconnect();
+    no_playlist_advance.disconnect();
+    show_numbers_in_pl.disconnect();
+    gapless_preroll.disconnect();
+    preroll_seconds.disconnect();
+}
+
 // check that the playback thread is not lagging
 static bool in_sync(aud::mutex::holder &)
 {
@@ -162,7 +239,7 @@ void playback_set_info(int entry, Tuple && tuple)
 }
 
 // cleanup common to both playback_play() and playback_stop()
-static void playback_cleanup(aud::mutex::holder &)
+static void reset_playback(aud::mutex::holder &)
 {
     pb_state.playing = false;
     pb_control = PlaybackControl();
@@ -195,7 +272,7 @@ void playback_stop(bool exiting)
         output_flush(0, exiting);
 
     if (pb_state.playing)
-        playback_cleanup(mh);
+        reset_playback(mh);
 
     if (pb_state.thread_running)
     {
@@ -208,6 +285,10 @@ void playback_stop(bool exiting)
             cond.wait(mh);
     }
 
+    // cancelled pre-roll threads must also be gone before plugins are unloaded
+    while (exiting && orphaned_prerolls)
+        cond.wait(mh);
+
     // miscellaneous cleanup
     failed_entries = 0;
 }
@@ -284,13 +365,16 @@ static bool setup_playback(const DecodeInfo & dec)
 
     // check that we have all the necessary data
     if (!pb_info.filename || !pb_info.tuple.valid() || !dec.ip ||
-        (!dec.ip->input_info.keys[InputKey::Scheme] && !dec.file))
+        (!dec.ip->input_info.keys[InputKey::Scheme] && !dec.file &&
+         !dec.preopened))
     {
         pb_info.error = true;
         pb_info.error_s = std::move(dec.error);
         return false;
     }
 
+    pb_info.ip = dec.ip;
+
     // get various other bits of info from the tuple
     pb_info.length = pb_info.tuple.get_int(Tuple::Length);
     pb_info.time_offset = aud::max(0, pb_info.tuple.get_int(Tuple::StartTime));
@@ -314,8 +398,7 @@ static bool check_playback_repeat()
         return false;
 
     // check whether we need to repeat
-    if (pb_control.repeat_a >= 0 ||
-        (aud_get_bool("repeat") && aud_get_bool("no_playlist_advance")))
+    if (pb_control.repeat_a >= 0 || (repeat.get() && no_playlist_advance.get()))
     {
         // treat the repeat as a seek (takes effect at open_audio())
         pb_control.seek = pb_control.repeat_a;
@@ -333,19 +416,243 @@ static bool check_playback_repeat()
     return false;
 }
 
+static void splice_preroll(aud::mutex::holder & mh, PreRoll * pr);
+
+// pre-roll thread
+static void preroll_run(PreRoll * pr)
+{
+    auto mh = mutex.take();
+    String filename = pr->filename;
+    PluginHandle * decoder = pr->decoder;
+    mh.unlock();
+
+    VFSFile file;
+    InputPlugin * ip = nullptr;
+
+    if (!decoder)
+        decoder = aud_file_find_decoder(filename, false, file);
+    if (decoder)
+        ip = load_input_plugin(decoder);
+    if (ip && !open_input_file(filename, "r", ip, file))
+        ip = nullptr;
+
+    mh.lock();
+
+    // the same plugin cannot play two files at once unless it says so
+    if (ip && ip == pb_info.ip &&
+        !(ip->input_info.flags & InputPlugin::FlagConcurrent))
+        ip = nullptr;
+
+    if (ip && !pr->cancel)
+    {
+        pr->ip = ip;
+        pr->decoder = decoder;
+        mh.unlock();
+
+        this_preroll = pr;
+        bool result = ip->play(filename, file);
+
+        mh.lock();
+
+        // in case play() returned without checking in since being promoted
+        if (this_preroll && pr->promoted)
+            splice_preroll(mh, pr);
+
+        this_preroll = nullptr;
+        pr->result = result;
+
+        if (pr->promoted)
+            pr->file = std::move(file);
+    }
+
+    pr->finished = true;
+
+    if (pr->orphaned)
+    {
+        delete pr;
+        orphaned_prerolls--;
+    }
+
+    cond.notify_all();
+
+    // the file, if still here, is closed after unlocking
+    mh.unlock();
+}
+
+// playback thread helper; starts a pre-roll if the current song is about to
+// end (called after each write)
+static void check_preroll()
+{
+    if (!gapless_preroll.get())
+        return;
+
+    auto mh = mutex.take();
+
+    if (!is_ready(mh) || pb_info.preroll_checked ||
+        pb_info.length <= 0 || pb_control.repeat_a >= 0 ||
+        (repeat.get() && no_playlist_advance.get()))
+        return;
+
+    int end = pb_info.length;
+    if (pb_info.stop_time >= 0)
+        end = aud::min(end, pb_info.stop_time);
+
+    int serial = pb_state.playback_serial;
+    mh.unlock();
+
+    // the output is not queried while this mutex is held
+    if (output_get_time() < end - 1000 * preroll_seconds.get())
+        return;
+
+    mh.lock();
+
+    if (!is_ready(mh) || pb_info.preroll_checked)
+        return;
+
+    pb_info.preroll_checked = true;
+    mh.unlock();
+
+    // due to mutex ordering, we cannot call into the playlist while locked
+    String filename;
+    PluginHandle * decoder;
+    Tuple tuple;
+    if (!playback_entry_predict_next(serial, filename, decoder, tuple))
+        return;
+
+    // segments of a larger file (e.g. from a cuesheet) are not handled
+    if (tuple.get_int(Tuple::StartTime) > 0 ||
+        tuple.get_int(Tuple::EndTime) > 0 || tuple.get_str(Tuple::AudioFile))
+        return;
+
+    mh.lock();
+
+    if (!in_sync(mh) || preroll)
+        return;
+
+    AUDINFO("Pre-rolling %s.\n", (const char *)filename);
+
+    preroll = new PreRoll;
+    preroll->filename = filename;
+    preroll->decoder = decoder;
+    preroll->tuple = std::move(tuple);
+    preroll->thread = std::thread(preroll_run, preroll);
+}
+
+// playback thread helper; the pre-roll thread is not waited for
+static void cancel_preroll(aud::mutex::holder &)
+{
+    PreRoll * pr = preroll;
+    if (!pr)
+        return;
+
+    preroll = nullptr;
+    pr->cancel = true;
+    pr->thread.detach();
+
+    if (pr->finished)
+        delete pr;
+    else
+    {
+        pr->orphaned = true;
+        orphaned_prerolls++;
+        cond.notify_all();
+    }
+}
+
+// playback thread helper; returns the filename and decoder of the pre-roll,
+// if it has opened its file
+static String peek_preroll(PluginHandle *& decoder)
+{
+    auto mh = mutex.take();
+
+    if (!preroll || !preroll->opened || preroll->finished)
+        return String();
+
+    decoder = preroll->decoder;
+    return preroll->filename;
+}
+
+// playback thread helper; if the current song was pre-rolled, lets the
+// pre-roll thread play it and waits for it to finish
+static bool play_preroll(DecodeInfo & dec)
+{
+    auto mh = mutex.take();
+
+    PreRoll * pr = preroll;
+    if (!pr)
+        return false;
+
+    if (!in_sync(mh) || pr->filename != pb_info.filename || !pr->opened ||
+        pr->finished || pb_info.time_offset > 0 || pb_info.stop_time >= 0)
+    {
+        AUDINFO("Pre-roll of %s not used.\n", (const char *)pr->filename);
+        cancel_preroll(mh);
+        return false;
+    }
+
+    AUDINFO("Using pre-roll of %s.\n", (const char *)pr->filename);
+
+    preroll = nullptr;
+    pr->promoted = true;
+
+    pb_info.ip = pr->ip;
+    pb_info.bitrate = pr->bitrate;
+
+    // replay gain info from the decoder supersedes that from the tuple
+    if (pr->gain_valid)
+    {
+        pb_info.gain = pr->gain;
+        pb_info.gain_valid = true;
+    }
+
+    cond.notify_all();
+
+    while (!pr->finished)
+        cond.wait(mh);
+
+    if (!pr->result)
+        pb_info.error = true;
+
+    dec.ip = pr->ip;
+    dec.file = std::move(pr->file);
+
+    mh.unlock();
+    pr->thread.join();
+    delete pr;
+
+    return true;
+}
+
 // playback thread helper
 static void run_playback()
 {
+    // if the song has been pre-rolled, the file is already open
+    PluginHandle * preroll_decoder = nullptr;
+    String preroll_filename = peek_preroll(preroll_decoder);
+
     // due to mutex ordering, we cannot call into the playlist while locked
-    DecodeInfo dec = playback_entry_read(pb_state.playback_serial);
+    DecodeInfo dec = playback_entry_read(pb_state.playback_serial,
+                                         preroll_filename, preroll_decoder);
 
     if (!setup_playback(dec))
+    {
+        auto mh = mutex.take();
+        cancel_preroll(mh);
         return;
+    }
 
-    while (1)
+    for (bool first = true;; first = false)
     {
-        // hand off control to input plugin
-        if (!dec.ip->play(pb_info.filename, dec.file))
+        // hand off control to input plugin, unless the pre-roll thread has
+        // already started playing the song
+        bool played = first && play_preroll(dec);
+
+        // the file was left closed if the pre-roll was expected to be used
+        if (!played && !dec.file &&
+            !open_input_file(pb_info.filename, "r", dec.ip, dec.file,
+                             &pb_info.error_s))
+            pb_info.error = true;
+        else if (!played && !dec.ip->play(pb_info.filename, dec.file))
             pb_info.error = true;
 
         // close audio (no-op if it wasn't opened)
@@ -406,6 +713,9 @@ static void playback_thread()
         // update playback thread serial number
         pb_state.playback_serial = pb_state.control_serial;
 
+        if (!play)
+            cancel_preroll(mh);
+
         mh.unlock();
 
         if (play)
@@ -447,7 +757,7 @@ void playback_play(int seek_time, bool pause)
         output_flush(0);
 
     if (pb_state.playing)
-        playback_cleanup(mh);
+        reset_playback(mh);
 
     // set up "play" command
     pb_state.playing = true;
@@ -495,10 +805,10 @@ EXPORT void aud_drct_seek(int time)
     request_seek(mh, time);
 }
 
-EXPORT void InputPlugin::open_audio(int format, int rate, int channels)
+static void open_audio_locked(aud::mutex::holder & mh, int format, int rate,
+                              int channels)
 {
     // don't open audio if playback thread is lagging
-    auto mh = mutex.take();
     if (!in_sync(mh))
         return;
 
@@ -525,9 +835,44 @@ EXPORT void InputPlugin::open_audio(int format, int rate, int channels)
     pb_info.ready = true;
 }
 
+static PreRoll * get_preroll(aud::mutex::holder & mh);
+
+EXPORT void InputPlugin::open_audio(int format, int rate, int channels)
+{
+    auto mh = mutex.take();
+    PreRoll * pr = get_preroll(mh);
+
+    if (!pr)
+        open_audio_locked(mh, format, rate, channels);
+    else if (pr->buffer.len() && (format != pr->format || rate != pr->rate ||
+                                  channels != pr->channels))
+    {
+        // the side buffer holds only one format; give up on the pre-roll
+        pr->cancel = true;
+    }
+    else
+    {
+        int seconds = aud::clamp(preroll_seconds.get(), 1, 30);
+
+        pr->opened = true;
+        pr->format = format;
+        pr->rate = rate;
+        pr->channels = channels;
+        pr->buffer_max = channels * rate * seconds;
+    }
+}
+
 EXPORT void InputPlugin::set_replay_gain(const ReplayGainInfo & gain)
 {
     auto mh = mutex.take();
+    PreRoll * pr = get_preroll(mh);
+
+    if (pr)
+    {
+        pr->gain = gain;
+        pr->gain_valid = true;
+        return;
+    }
 
     pb_info.gain = gain;
     pb_info.gain_valid = true;
@@ -536,7 +881,10 @@ EXPORT void InputPlugin::set_replay_gain(const ReplayGainInfo & gain)
         output_set_replay_gain(gain);
 }
 
-EXPORT void InputPlugin::write_audio(const void * data, int length)
+// playback thread helper; write() is called with the stop time and returns
+// false if the stop time was reached or output_flush() was called
+template<class F>
+static void write_audio_with(F write)
 {
     auto mh = mutex.take();
     if (!in_sync(mh))
@@ -551,8 +899,11 @@ EXPORT void InputPlugin::write_audio(const void * data, int length)
     // it's okay to call output_write_audio() even if we are no longer in sync,
     // since it will return immediately if output_flush() has been called
     int stop_time = (b >= 0) ? b : pb_info.stop_time;
-    if (output_write_audio(data, length, stop_time))
+    if (write(stop_time))
+    {
+        check_preroll();
         return;
+    }
 
     mh.lock();
 
@@ -572,10 +923,129 @@ EXPORT void InputPlugin::write_audio(const void * data, int length)
     }
 }
 
+// pre-roll thread helper; called once the pre-roll has been promoted, to bring
+// the output up to date with what was decoded ahead of time
+static void splice_preroll(aud::mutex::holder & mh, PreRoll * pr)
+{
+    this_preroll = nullptr;
+
+    Index<float> buffer = std::move(pr->buffer);
+    bool tuple_changed = pr->tuple_changed;
+    Tuple tuple = std::move(pr->tuple);
+
+    open_audio_locked(mh, pr->format, pr->rate, pr->channels);
+
+    // the buffer is useless if a seek was requested in the meantime
+    if (pb_control.seek >= 0)
+        buffer.clear();
+
+    mh.unlock();
+
+    if (tuple_changed)
+        playback_entry_set_tuple(pb_state.playback_serial, std::move(tuple));
+
+    // the buffer is handed over by move rather than copied
+    if (buffer.len())
+    {
+        write_audio_with([&](int stop_time) {
+            return output_write_audio(std::move(buffer), stop_time);
+        });
+    }
+
+    mh.lock();
+}
+
+// returns the pre-roll being decoded by the calling thread, or nullptr if
+// there is none (any longer)
+static PreRoll * get_preroll(aud::mutex::holder & mh)
+{
+    PreRoll * pr = this_preroll;
+    if (!pr)
+        return nullptr;
+
+    if (pr->promoted)
+    {
+        splice_preroll(mh, pr);
+        return nullptr;
+    }
+
+    return pr;
+}
+
+// pre-roll thread helper; returns false if the data is to be written to the
+// output after all.  <floats> is set if the data was passed as floating-point
+// samples, which is only valid for a stream opened with FMT_FLOAT.
+static bool preroll_write(const void * data, int length, bool floats)
+{
+    auto mh = mutex.take();
+
+    while (1)
+    {
+        PreRoll * pr = get_preroll(mh);
+        if (!pr)
+            return false;
+
+        if (pr->cancel)
+            return true;
+
+        // rejected like output_write_audio() does without a pre-roll
+        if (floats && pr->format != FMT_FLOAT)
+        {
+            AUDERR("Float samples written to a stream of format %d.\n",
+                   pr->format);
+            return true;
+        }
+
+        // wait to be promoted or cancelled if the buffer is full
+        int samples = length / FMT_SIZEOF(pr->format);
+        if (!pr->buffer.len() || pr->buffer.len() + samples <= pr->buffer_max)
+        {
+            // convert now, so that the splice needs no copy
+            int old_len = pr->buffer.len();
+            pr->buffer.resize(old_len + samples);
+
+            float * dest = pr->buffer.begin() + old_len;
+            if (pr->format == FMT_FLOAT)
+                memcpy(dest, data, sizeof(float) * samples);
+            else
+                audio_from_int(data, pr->format, dest, samples);
+
+            return true;
+        }
+
+        cond.wait(mh);
+    }
+}
+
+EXPORT void InputPlugin::write_audio(const void * data, int length)
+{
+    if (this_preroll && preroll_write(data, length, false))
+        return;
+
+    write_audio_with([&](int stop_time) {
+        return output_write_audio(data, length, stop_time);
+    });
+}
+
+EXPORT void InputPlugin::write_audio(Index<float> && data)
+{
+    if (this_preroll &&
+        preroll_write(data.begin(), sizeof(float) * data.len(), true))
+    {
+        data.resize(0);
+        return;
+    }
+
+    write_audio_with([&](int stop_time) {
+        return output_write_audio(std::move(data), stop_time);
+    });
+}
+
 EXPORT Tuple InputPlugin::get_playback_tuple()
 {
     auto mh = mutex.take();
-    Tuple tuple = pb_info.tuple.ref();
+    PreRoll * pr = get_preroll(mh);
+    Tuple tuple = pr ? pr->tuple.ref() : pb_info.tuple.ref();
 
     // tuples passed to us from input plugins do not have fallback fields
     // generated; for consistency, tuples passed back should not either
@@ -585,6 +1055,18 @@ EXPORT Tuple InputPlugin::get_playback_tuple()
 
 EXPORT void InputPlugin::set_playback_tuple(Tuple && tuple)
 {
+    {
+        auto mh = mutex.take();
+        PreRoll * pr = get_preroll(mh);
+
+        if (pr)
+        {
+            pr->tuple = std::move(tuple);
+            pr->tuple_changed = true;
+            return;
+        }
+    }
+
     // due to mutex ordering, we cannot call into the playlist while locked;
     // instead, playback_entry_set_tuple() calls back into first
     // playback_check_serial() and then eventually playback_set_info()
@@ -594,6 +1076,14 @@ EXPORT void InputPlugin::set_playback_tuple(Tuple && tuple)
 EXPORT void InputPlugin::set_stream_bitrate(int bitrate)
 {
     auto mh = mutex.take();
+    PreRoll * pr = get_preroll(mh);
+
+    if (pr)
+    {
+        pr->bitrate = bitrate;
+        return;
+    }
+
     pb_info.bitrate = bitrate;
 
     if (is_ready(mh))
@@ -603,6 +1093,11 @@ EXPORT void InputPlugin::set_stream_bitrate(int bitrate)
 EXPORT bool InputPlugin::check_stop()
 {
     auto mh = mutex.take();
+    PreRoll * pr = get_preroll(mh);
+
+    if (pr)
+        return pr->cancel;
+
     return !is_ready(mh) || pb_info.ended || pb_info.error;
 }
 
@@ -611,6 +1106,9 @@ EXPORT int InputPlugin::check_seek()
     auto mh = mutex.take();
     int seek = -1;
 
+    if (get_preroll(mh))
+        return seek;
+
     if (is_ready(mh) && pb_control.seek >= 0 && pb_info.length > 0)
     {
         seek = pb_info.time_offset + aud::min(pb_control.seek, pb_info.length);
@@ -649,7 +1147,7 @@ EXPORT String aud_drct_get_title()
     if (!is_ready(mh))
         return String();
 
-    StringBuf prefix = aud_get_bool("show_numbers_in_pl")
+    StringBuf prefix = show_numbers_in_pl.get()
                            ? str_printf("%d. ", 1 + pb_info.entry)
                            : StringBuf(0);
 
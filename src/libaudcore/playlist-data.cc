@@ -18,14 +18,26 @@
  */
 
 #include "playlist-data.h"
+#include "playlist-internal.h"
 
+#include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <thread>
+
+#include "audstrings.h"
+#include "metadata-cache.h"
 #include "runtime.h"
 #include "scanner.h"
 #include "tuple-compiler.h"
 
+#define MAX_ALBUM_TRIES 64 /* random picks before scanning for an album */
+#define MAX_SORT_THREADS 8
+#define MIN_SORT_CHUNK 4096 /* entries sorted by each thread */
+
 #define NO_POS                                                                 \
     {                                                                          \
         -1, false                                                              \
@@ -47,8 +59,9 @@ struct PlaylistEntry
     Tuple tuple;
     String error;
     int number;
-    int length;
-    int shuffle_num;
+    int slot; /* in the metadata columns */
+    int shuffle_num;    /* 0 if not yet played in shuffle order */
+    int unplayed_index; /* in m_shuffle_unplayed, or -1 */
     bool selected, queued;
 };
 
@@ -79,15 +92,14 @@ void PlaylistEntry::set_tuple(Tuple && new_tuple)
     if (!new_tuple.valid())
         new_tuple.set_filename(filename);
 
-    length = aud::max(0, new_tuple.get_int(Tuple::Length));
     tuple = std::move(new_tuple);
 
     format();
 }
 
 PlaylistEntry::PlaylistEntry(PlaylistAddItem && item)
-    : filename(item.filename), decoder(item.decoder), number(-1), length(0),
-      shuffle_num(0), selected(false), queued(false)
+    : filename(item.filename), decoder(item.decoder), number(-1), slot(-1),
+      shuffle_num(0), unplayed_index(-1), selected(false), queued(false)
 {
     set_tuple(std::move(item.tuple));
 }
@@ -114,7 +126,8 @@ PlaylistData::PlaylistData(Playlist::ID * id, const char * title)
     : modified(true), scan_status(NotScanning), title(title), resume_time(0),
       m_id(id), m_position(nullptr), m_focus(nullptr), m_selected_count(0),
       m_last_shuffle_num(0), m_total_length(0), m_selected_length(0),
-      m_last_update(), m_next_update(), m_position_changed(false)
+      m_last_update(), m_next_update(), m_position_changed(false),
+      m_save_changes(), m_saved_len(0)
 {
 }
 
@@ -158,41 +171,160 @@ Tuple PlaylistData::entry_tuple(int i, String * error) const
     return entry ? entry->tuple.ref() : Tuple();
 }
 
+String PlaylistData::entry_column_str(int i, Column column) const
+{
+    assert(column >= 0 && column < LengthColumn);
+
+    auto entry = entry_at(i);
+    return entry ? m_str_columns[column][entry->slot] : String();
+}
+
+PlaylistData::Column PlaylistData::field_column(Tuple::Field field) // static
+{
+    switch (field)
+    {
+    case Tuple::Title:
+        return TitleColumn;
+    case Tuple::Artist:
+        return ArtistColumn;
+    case Tuple::Album:
+        return AlbumColumn;
+    case Tuple::Length:
+        return LengthColumn;
+    case Tuple::Track:
+        return TrackColumn;
+    case Tuple::Year:
+        return YearColumn;
+    default:
+        return NoColumn;
+    }
+}
+
+static const Tuple::Field column_fields[PlaylistData::n_columns] = {
+    Tuple::Title, Tuple::Artist, Tuple::Album,
+    Tuple::Length, Tuple::Track, Tuple::Year};
+
 static bool same_album(const Tuple & a, const Tuple & b)
 {
     String album = a.get_str(Tuple::Album);
     return (album && album == b.get_str(Tuple::Album));
 }
 
+int PlaylistData::alloc_slot()
+{
+    int n_free = m_free_slots.len();
+
+    if (n_free)
+    {
+        int slot = m_free_slots[n_free - 1];
+        m_free_slots.remove(n_free - 1, 1);
+        return slot;
+    }
+
+    for (auto & column : m_str_columns)
+        column.append();
+    for (auto & column : m_int_columns)
+        column.append(INT_MIN);
+
+    m_valid_column.append(false);
+    return m_valid_column.len() - 1;
+}
+
+void PlaylistData::free_slot(PlaylistEntry * entry)
+{
+    /* release the pooled strings now */
+    for (auto & column : m_str_columns)
+        column[entry->slot] = String();
+
+    m_free_slots.append(entry->slot);
+    entry->slot = -1;
+}
+
+void PlaylistData::update_columns(const PlaylistEntry * entry)
+{
+    const Tuple & tuple = entry->tuple;
+    int slot = entry->slot;
+
+    for (int c = 0; c < LengthColumn; c++)
+        m_str_columns[c][slot] = tuple.get_str(column_fields[c]);
+
+    for (int c = LengthColumn; c < n_columns; c++)
+    {
+        Tuple::Field field = column_fields[c];
+        m_int_columns[c - LengthColumn][slot] =
+            (tuple.get_value_type(field) == Tuple::Int) ? tuple.get_int(field)
+                                                        : INT_MIN;
+    }
+
+    m_valid_column[slot] = tuple.valid();
+}
+
+int PlaylistData::entry_length(const PlaylistEntry * entry) const
+{
+    return aud::max(0, m_int_columns[0][entry->slot]);
+}
+
+/* same order as the tuple comparisons in playlist-utils.cc */
+int PlaylistData::compare_columns(Column column, int slot_a,
+                                  int slot_b) const
+{
+    if (column < LengthColumn)
+    {
+        const String & a = m_str_columns[column][slot_a];
+        const String & b = m_str_columns[column][slot_b];
+
+        if (a == b)
+            return 0;
+        if (!a)
+            return -1;
+
+        return (!b) ? 1 : str_compare(a, b);
+    }
+
+    int a = m_int_columns[column - LengthColumn][slot_a];
+    int b = m_int_columns[column - LengthColumn][slot_b];
+
+    return (a < b) ? -1 : (a > b);
+}
+
 void PlaylistData::set_entry_tuple(PlaylistEntry * entry, Tuple && tuple)
 {
-    m_total_length -= entry->length;
-    if (entry->selected)
-        m_selected_length -= entry->length;
+    int old_length = entry_length(entry);
 
     entry->set_tuple(std::move(tuple));
+    update_columns(entry);
+
+    int new_length = entry_length(entry);
 
-    m_total_length += entry->length;
+    m_total_length += new_length - old_length;
     if (entry->selected)
-        m_selected_length += entry->length;
+        m_selected_length += new_length - old_length;
 }
 
-void PlaylistData::queue_update(Playlist::UpdateLevel level, int at, int count,
-                                int flags)
+static void merge_update(Playlist::Update & update, Playlist::UpdateLevel level,
+                         int at, int count, int n_entries)
 {
-    if (m_next_update.level)
+    if (update.level)
     {
-        m_next_update.level = aud::max(m_next_update.level, level);
-        m_next_update.before = aud::min(m_next_update.before, at);
-        m_next_update.after =
-            aud::min(m_next_update.after, m_entries.len() - at - count);
+        update.level = aud::max(update.level, level);
+        update.before = aud::min(update.before, at);
+        update.after = aud::min(update.after, n_entries - at - count);
     }
     else
     {
-        m_next_update.level = level;
-        m_next_update.before = at;
-        m_next_update.after = m_entries.len() - at - count;
+        update.level = level;
+        update.before = at;
+        update.after = n_entries - at - count;
     }
+}
+
+void PlaylistData::queue_update(Playlist::UpdateLevel level, int at, int count,
+                                int flags)
+{
+    merge_update(m_next_update, level, at, count, m_entries.len());
+
+    if (level >= Playlist::Metadata)
+        merge_update(m_save_changes, level, at, count, m_entries.len());
 
     if ((flags & QueueChanged))
         m_next_update.queue_changed = true;
@@ -213,6 +345,24 @@ void PlaylistData::cancel_updates()
     m_position_changed = false;
 }
 
+Playlist::Update PlaylistData::take_save_changes(int & saved_len)
+{
+    Playlist::Update changes = m_save_changes;
+    saved_len = m_saved_len;
+
+    reset_save_changes(false);
+    return changes;
+}
+
+void PlaylistData::reset_save_changes(bool all_changed)
+{
+    m_save_changes = Playlist::Update();
+    m_saved_len = m_entries.len();
+
+    if (all_changed)
+        m_save_changes.level = Playlist::Structure;
+}
+
 void PlaylistData::swap_updates(bool & position_changed)
 {
     m_last_update = m_next_update;
@@ -236,7 +386,12 @@ void PlaylistData::insert_items(int at, Index<PlaylistAddItem> && items)
     {
         auto entry = new PlaylistEntry(std::move(item));
         m_entries[i++].capture(entry);
-        m_total_length += entry->length;
+
+        entry->slot = alloc_slot();
+        update_columns(entry);
+        m_total_length += entry_length(entry);
+
+        shuffle_add(entry);
     }
 
     items.clear();
@@ -286,10 +441,12 @@ void PlaylistData::remove_entries(int at, int number)
         if (entry->selected)
         {
             m_selected_count--;
-            m_selected_length -= entry->length;
+            m_selected_length -= entry_length(entry);
         }
 
-        m_total_length -= entry->length;
+        m_total_length -= entry_length(entry);
+        free_slot(entry);
+        shuffle_remove(entry);
     }
 
     m_entries.remove(at, number);
@@ -382,12 +539,12 @@ void PlaylistData::select_entry(int entry_num, bool selected)
     if (selected)
     {
         m_selected_count++;
-        m_selected_length += entry->length;
+        m_selected_length += entry_length(entry);
     }
     else
     {
         m_selected_count--;
-        m_selected_length -= entry->length;
+        m_selected_length -= entry_length(entry);
     }
 
     queue_update(Playlist::Selection, entry_num, 1);
@@ -528,7 +685,9 @@ void PlaylistData::remove_selected()
                 update_flags |= QueueChanged;
             }
 
-            m_total_length -= entry->length;
+            m_total_length -= entry_length(entry);
+            free_slot(entry);
+            shuffle_remove(entry);
             after = 0;
         }
         else
@@ -557,11 +716,231 @@ void PlaylistData::remove_selected()
     }
 }
 
+/* Appends a collation key for the given string, that is, a byte string that
+ * compares (with memcmp) in the same order as the string does with
+ * str_compare().  Letters are folded to lower case, and each run of digits is
+ * replaced by the character '0', the number of significant digits, and the
+ * digits themselves, so that numbers compare by value.  None of these bytes
+ * are zero, so the key can be terminated by a zero byte, which makes keys of
+ * several fields compare field by field.  A null string sorts first. */
+static void append_string_key(Index<char> & key, const char * str)
+{
+    if (!str)
+    {
+        key.append(0);
+        return;
+    }
+
+    key.append(1);
+
+    while (*str)
+    {
+        unsigned char c = *str++;
+
+        if (c >= '0' && c <= '9')
+        {
+            while (c == '0' && *str >= '0' && *str <= '9')
+                c = *str++;
+
+            const char * digits = str - 1;
+            int n_digits = (c == '0') ? 0 : 1;
+
+            while (*str >= '0' && *str <= '9')
+            {
+                str++;
+                n_digits++;
+            }
+
+            /* absurdly long numbers are truncated */
+            n_digits = aud::min(n_digits, 254);
+
+            key.append('0');
+            key.append(1 + n_digits);
+            key.insert(digits, -1, n_digits);
+        }
+        else
+        {
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+
+            key.append(c);
+        }
+    }
+
+    key.append(0);
+}
+
+/* appends a key comparing as the integer does; unset (INT_MIN) sorts first */
+static void append_int_key(Index<char> & key, int value)
+{
+    unsigned bits = (unsigned)value ^ 0x80000000u;
+
+    for (int shift = 24; shift >= 0; shift -= 8)
+        key.append((char)(bits >> shift));
+}
+
+/* Sorts the items in separate chunks in parallel (with a stable sort), then
+ * merges the sorted chunks in pairs, also in parallel. */
+template<class F>
+static void parallel_stable_sort(Index<int> & items, F less)
+{
+    int n_items = items.len();
+    int n_chunks = aud::clamp((int)std::thread::hardware_concurrency(), 1,
+                              MAX_SORT_THREADS);
+
+    n_chunks = aud::clamp(n_items / MIN_SORT_CHUNK, 1, n_chunks);
+
+    int bounds[MAX_SORT_THREADS + 1];
+    for (int i = 0; i <= n_chunks; i++)
+        bounds[i] = (int)((int64_t)n_items * i / n_chunks);
+
+    auto sort_chunk = [&](int i) {
+        std::stable_sort(items.begin() + bounds[i],
+                         items.begin() + bounds[i + 1], less);
+    };
+
+    Index<std::thread> threads;
+
+    for (int i = 1; i < n_chunks; i++)
+        threads.append(sort_chunk, i);
+
+    sort_chunk(0);
+
+    for (auto & thread : threads)
+        thread.join();
+
+    Index<int> temp;
+    temp.resize(n_items);
+
+    for (int width = 1; width < n_chunks; width *= 2)
+    {
+        auto merge_chunks = [&](int i) {
+            int lo = bounds[i], mid = bounds[i + width];
+            int hi = bounds[aud::min(i + 2 * width, n_chunks)];
+
+            std::merge(items.begin() + lo, items.begin() + mid,
+                       items.begin() + mid, items.begin() + hi,
+                       temp.begin() + lo, less);
+        };
+
+        threads.clear();
+
+        for (int i = 0; i < n_chunks; i += 2 * width)
+        {
+            if (i + width >= n_chunks)
+            {
+                /* odd chunk out */
+                std::copy(items.begin() + bounds[i], items.end(),
+                          temp.begin() + bounds[i]);
+            }
+            else
+                threads.append(merge_chunks, i);
+        }
+
+        for (auto & thread : threads)
+            thread.join();
+
+        std::swap(items, temp);
+    }
+}
+
+void PlaylistData::sort_entries_by_keys(
+    Index<EntryPtr> & entries, const Index<PlaylistSortKey> & keys) const
+{
+    int n_entries = entries.len();
+    int n_keys = keys.len();
+
+    /* the key of each field of each entry, in order */
+    Index<char> key_data;
+    Index<int> key_offsets;
+
+    for (auto & entry : entries)
+    {
+        for (auto & key : keys)
+        {
+            key_offsets.append(key_data.len());
+
+            Column column = field_column(key.field);
+
+            if (key.filename_compare || key.field == Tuple::Invalid)
+                continue;
+            else if (column != NoColumn && column < LengthColumn)
+                append_string_key(key_data,
+                                  m_str_columns[column][entry->slot]);
+            else if (column != NoColumn)
+                append_int_key(key_data, m_int_columns[column - LengthColumn]
+                                                      [entry->slot]);
+            else if (Tuple::field_get_type(key.field) == Tuple::String)
+                append_string_key(key_data, entry->tuple.get_str(key.field));
+            else
+                append_int_key(key_data,
+                               (entry->tuple.get_value_type(key.field) ==
+                                Tuple::Int)
+                                   ? entry->tuple.get_int(key.field)
+                                   : INT_MIN);
+        }
+    }
+
+    key_offsets.append(key_data.len());
+
+    auto less = [&](int a, int b) {
+        for (int k = 0; k < n_keys; k++)
+        {
+            int cmp;
+
+            if (keys[k].filename_compare)
+                cmp = keys[k].filename_compare(entries[a]->filename,
+                                               entries[b]->filename);
+            else
+            {
+                int i = a * n_keys + k, j = b * n_keys + k;
+                int len_a = key_offsets[i + 1] - key_offsets[i];
+                int len_b = key_offsets[j + 1] - key_offsets[j];
+
+                cmp = memcmp(key_data.begin() + key_offsets[i],
+                             key_data.begin() + key_offsets[j],
+                             aud::min(len_a, len_b));
+                if (!cmp)
+                    cmp = len_a - len_b;
+            }
+
+            if (cmp)
+                return cmp < 0;
+        }
+
+        return false;
+    };
+
+    Index<int> order;
+    order.resize(n_entries);
+
+    for (int i = 0; i < n_entries; i++)
+        order[i] = i;
+
+    parallel_stable_sort(order, less);
+
+    Index<EntryPtr> sorted;
+    sorted.insert(0, n_entries);
+
+    for (int i = 0; i < n_entries; i++)
+        sorted[i] = std::move(entries[order[i]]);
+
+    entries = std::move(sorted);
+}
+
 void PlaylistData::sort_entries(Index<EntryPtr> & entries,
-                                const CompareData & data) // static
+                                const CompareData & data) const
 {
-    entries.sort([data](const EntryPtr & a, const EntryPtr & b) {
-        if (data.filename_compare)
+    if (data.keys)
+    {
+        sort_entries_by_keys(entries, *data.keys);
+        return;
+    }
+
+    entries.sort([this, data](const EntryPtr & a, const EntryPtr & b) {
+        if (data.column != NoColumn)
+            return compare_columns(data.column, a->slot, b->slot);
+        else if (data.filename_compare)
             return data.filename_compare(a->filename, b->filename);
         else
             return data.tuple_compare(a->tuple, b->tuple);
@@ -601,6 +980,36 @@ void PlaylistData::sort_selected(const CompareData & data)
     queue_update(Playlist::Structure, 0, n_entries);
 }
 
+/* entries with an empty field are not duplicates of each other; entries not
+ * yet scanned are deliberately left alone, since their fields are not known */
+void PlaylistData::remove_duplicates(Column column)
+{
+    select_all(false);
+    sort({nullptr, nullptr, column, nullptr});
+
+    auto is_set = [this, column](int slot) {
+        if (!m_valid_column[slot])
+            return false;
+        if (column < LengthColumn)
+            return (bool)m_str_columns[column][slot];
+
+        return m_int_columns[column - LengthColumn][slot] != INT_MIN;
+    };
+
+    int n_entries = m_entries.len();
+
+    for (int i = 1; i < n_entries; i++)
+    {
+        int a = m_entries[i - 1]->slot;
+        int b = m_entries[i]->slot;
+
+        if (is_set(a) && is_set(b) && compare_columns(column, a, b) == 0)
+            select_entry(i, true);
+    }
+
+    remove_selected();
+}
+
 void PlaylistData::reverse_order()
 {
     int n_entries = m_entries.len();
@@ -782,24 +1191,76 @@ void PlaylistData::queue_remove_selected()
                      QueueChanged);
 }
 
-int PlaylistData::shuffle_pos_before(int ref_pos) const
+/* returns the index of the entry in m_shuffle_played, or -1 */
+int PlaylistData::shuffle_find(const PlaylistEntry * entry) const
 {
-    auto ref_entry = entry_at(ref_pos);
-    if (!ref_entry)
+    if (!entry->shuffle_num)
         return -1;
 
-    const PlaylistEntry * found = nullptr;
-    for (auto & entry : m_entries)
+    int lo = 0, hi = m_shuffle_played.len();
+
+    while (lo < hi)
     {
-        if (entry->shuffle_num > 0 &&
-            entry->shuffle_num < ref_entry->shuffle_num &&
-            (!found || entry->shuffle_num > found->shuffle_num))
-        {
-            found = entry.get();
-        }
+        int mid = (lo + hi) / 2;
+        int num = m_shuffle_played[mid]->shuffle_num;
+
+        if (num < entry->shuffle_num)
+            lo = mid + 1;
+        else if (num > entry->shuffle_num)
+            hi = mid;
+        else
+            return mid;
+    }
+
+    return -1;
+}
+
+void PlaylistData::shuffle_add(PlaylistEntry * entry)
+{
+    entry->shuffle_num = 0;
+    entry->unplayed_index = m_shuffle_unplayed.len();
+    m_shuffle_unplayed.append(entry);
+}
+
+void PlaylistData::shuffle_remove(PlaylistEntry * entry)
+{
+    if (entry->unplayed_index >= 0)
+    {
+        /* move the last entry into its place */
+        PlaylistEntry * last = m_shuffle_unplayed[m_shuffle_unplayed.len() - 1];
+        m_shuffle_unplayed[entry->unplayed_index] = last;
+        last->unplayed_index = entry->unplayed_index;
+
+        m_shuffle_unplayed.remove(m_shuffle_unplayed.len() - 1, 1);
+        entry->unplayed_index = -1;
     }
+    else
+    {
+        int index = shuffle_find(entry);
+        if (index >= 0)
+            m_shuffle_played.remove(index, 1);
 
-    return found ? found->number : -1;
+        entry->shuffle_num = 0;
+    }
+}
+
+/* moves the entry to the end of the shuffle order */
+void PlaylistData::shuffle_mark_played(PlaylistEntry * entry)
+{
+    shuffle_remove(entry);
+
+    entry->shuffle_num = ++m_last_shuffle_num;
+    m_shuffle_played.append(entry);
+}
+
+int PlaylistData::shuffle_pos_before(int ref_pos) const
+{
+    auto ref_entry = entry_at(ref_pos);
+    if (!ref_entry)
+        return -1;
+
+    int index = shuffle_find(ref_entry);
+    return (index > 0) ? m_shuffle_played[index - 1]->number : -1;
 }
 
 PlaylistData::PosChange PlaylistData::shuffle_pos_after(int ref_pos,
@@ -811,22 +1272,11 @@ PlaylistData::PosChange PlaylistData::shuffle_pos_after(int ref_pos,
 
     // the reference entry can be beyond the end of the shuffle list
     // if we are looking ahead multiple entries, as in next_album()
-    if (ref_entry->shuffle_num > 0)
-    {
-        // look for the next entry in the existing shuffle order
-        const PlaylistEntry * next = nullptr;
-        for (auto & entry : m_entries)
-        {
-            if (entry->shuffle_num > ref_entry->shuffle_num &&
-                (!next || entry->shuffle_num < next->shuffle_num))
-            {
-                next = entry.get();
-            }
-        }
+    int index = shuffle_find(ref_entry);
 
-        if (next)
-            return {next->number, false};
-    }
+    // look for the next entry in the existing shuffle order
+    if (index >= 0 && index + 1 < m_shuffle_played.len())
+        return {m_shuffle_played[index + 1]->number, false};
 
     if (by_album)
     {
@@ -842,6 +1292,26 @@ PlaylistData::PosChange PlaylistData::shuffle_pos_after(int ref_pos,
 PlaylistData::PosChange PlaylistData::shuffle_pos_random(bool repeat,
                                                          bool by_album) const
 {
+    // choose among all entries if repeating, otherwise among those not
+    // already played
+    int n_choices = repeat ? m_entries.len() : m_shuffle_unplayed.len();
+    if (!n_choices)
+        return NO_POS;
+
+    // optionally choose only the first entry in an album; picking entries at
+    // random until one is the first in its album keeps the choice uniform
+    for (int tries = 0; tries < (by_album ? MAX_ALBUM_TRIES : 1); tries++)
+    {
+        int i = rand() % n_choices;
+        auto entry = repeat ? m_entries[i].get() : m_shuffle_unplayed[i];
+        auto prev_entry = entry_at(entry->number - 1);
+
+        if (!by_album || !prev_entry ||
+            !same_album(entry->tuple, prev_entry->tuple))
+            return {entry->number, true};
+    }
+
+    // in playlists of long albums, fall back to looking through all entries
     Index<const PlaylistEntry *> choices;
     const PlaylistEntry * prev_entry = nullptr;
 
@@ -927,7 +1397,7 @@ void PlaylistData::change_position(PosChange change)
 
     /* move entry to top of shuffle list */
     if (m_position && change.update_shuffle)
-        m_position->shuffle_num = ++m_last_shuffle_num;
+        shuffle_mark_played(m_position);
 
     /* remove from queue if it's the first entry */
     if (m_queued.len() && m_position == m_queued[0])
@@ -960,27 +1430,19 @@ bool PlaylistData::change_position_to_next(bool repeat, int hint_pos)
 void PlaylistData::shuffle_reset()
 {
     m_last_shuffle_num = 0;
+    m_shuffle_played.clear();
+    m_shuffle_unplayed.clear();
 
     for (auto & entry : m_entries)
-        entry->shuffle_num = 0;
+        shuffle_add(entry.get());
 }
 
 Index<int> PlaylistData::shuffle_history() const
 {
     Index<int> history;
 
-    // create a list of all entries in the shuffle list
-    for (auto & entry : m_entries)
-    {
-        if (entry->shuffle_num)
-            history.append(entry->number);
-    }
-
-    // sort by shuffle order
-    history.sort([this](int entry_a, int entry_b) {
-        return m_entries[entry_a]->shuffle_num -
-               m_entries[entry_b]->shuffle_num;
-    });
+    for (auto entry : m_shuffle_played)
+        history.append(entry->number);
 
     return history;
 }
@@ -994,7 +1456,7 @@ void PlaylistData::shuffle_replay(const Index<int> & history)
     {
         auto entry = entry_at(entry_num);
         if (entry)
-            entry->shuffle_num = ++m_last_shuffle_num;
+            shuffle_mark_played(entry);
     }
 }
 
@@ -1026,6 +1488,21 @@ bool PlaylistData::next_song(bool repeat)
     return true;
 }
 
+// guesses the entry that next_song() will move to, without moving there; a
+// random choice (in shuffle mode) cannot be predicted, so -1 is returned
+int PlaylistData::predict_next_song(bool repeat) const
+{
+    bool shuffle = aud_get_bool("shuffle");
+    bool by_album = aud_get_bool("album_shuffle");
+    bool repeated = false;
+
+    auto change = pos_after(position(), shuffle, by_album);
+    if (change.new_pos < 0 && !(shuffle && !m_queued.len()))
+        change = pos_new_full(repeat, shuffle, by_album, -1, repeated);
+
+    return change.new_pos;
+}
+
 bool PlaylistData::prev_album()
 {
     bool shuffle = aud_get_bool("shuffle");
@@ -1186,8 +1663,12 @@ bool PlaylistData::entry_needs_rescan(PlaylistEntry * entry, bool need_decoder,
 
 void PlaylistData::reformat_titles()
 {
+    /* the fallbacks may have changed */
     for (auto & entry : m_entries)
+    {
         entry->format();
+        update_columns(entry.get());
+    }
 
     queue_update(Playlist::Metadata, 0, m_entries.len());
 }
@@ -1197,7 +1678,11 @@ void PlaylistData::reset_tuples(bool selected_only)
     for (auto & entry : m_entries)
     {
         if (!selected_only || entry->selected)
+        {
+            /* read the file, not what is cached of it */
+            metadata_cache_forget(entry->filename);
             set_entry_tuple(entry.get(), Tuple());
+        }
     }
 
     queue_update(Playlist::Metadata, 0, m_entries.len());
@@ -20,11 +20,15 @@
 #ifndef PLAYLIST_DATA_H
 #define PLAYLIST_DATA_H
 
+#include <mutex>
+#include <shared_mutex>
+
 #include "playlist.h"
 #include "scanner.h"
 
 class TupleCompiler;
 struct PlaylistEntry;
+struct PlaylistSortKey;
 
 class PlaylistData
 {
@@ -44,25 +48,74 @@ public:
         ScanEnding
     };
 
+    /* metadata fields kept in columns (see set_entry_tuple) */
+    enum Column
+    {
+        NoColumn = -1,
+        TitleColumn,
+        ArtistColumn,
+        AlbumColumn,
+        LengthColumn, /* first integer column */
+        TrackColumn,
+        YearColumn,
+        n_columns
+    };
+
     struct CompareData
     {
         Playlist::StringCompareFunc filename_compare;
         Playlist::TupleCompareFunc tuple_compare;
+        Column column;                       /* takes precedence if set */
+        const Index<PlaylistSortKey> * keys; /* takes precedence if set */
     };
 
+    /* state kept for a playlist whose entries have not yet been loaded from
+     * the playlist store (see load_deferred() in playlist.cc) */
+    struct Deferred
+    {
+        String path;
+        int n_entries = 0;
+        int64_t total_length = 0;
+        int position = -1;
+        Index<int> shuffle_history;
+        bool loading = false; /* the mutex is released while loading */
+        bool failed = false;  /* the file is left alone, and never saved */
+    };
+
+    typedef std::unique_lock<std::shared_mutex> WriteLock;
+    typedef std::shared_lock<std::shared_mutex> ReadLock;
+
     PlaylistData(Playlist::ID * m_id, const char * title);
     ~PlaylistData();
 
+    /* Any change to the playlist is made with the write lock held, as well as
+     * the mutex in playlist.cc.  Functions that only read the entries (or the
+     * position, focus, selection, or queue) can hold either one. */
+    WriteLock write_lock() { return WriteLock(m_lock); }
+    ReadLock read_lock() const { return ReadLock(m_lock); }
+
     PlaylistEntry * entry_at(int i);
     const PlaylistEntry * entry_at(int i) const;
 
     String entry_filename(int i) const;
     PluginHandle * entry_decoder(int i, String * error = nullptr) const;
     Tuple entry_tuple(int i, String * error = nullptr) const;
+    String entry_column_str(int i, Column column) const;
+
+    static Column field_column(Tuple::Field field);
 
     void cancel_updates();
     void swap_updates(bool & position_changed);
 
+    /* The entries changed (at the Metadata level or above) since the playlist
+     * was last saved are tracked in the same form as an update, along with the
+     * number of entries at that time, so that only the change need be saved.
+     * take_save_changes() returns them and starts over from the current state;
+     * reset_save_changes() just starts over, optionally with every entry
+     * marked as changed. */
+    Playlist::Update take_save_changes(int & saved_len);
+    void reset_save_changes(bool all_changed);
+
     void insert_items(int at, Index<PlaylistAddItem> && items);
     void remove_entries(int at, int number);
 
@@ -81,6 +134,7 @@ public:
 
     void sort(const CompareData & data);
     void sort_selected(const CompareData & data);
+    void remove_duplicates(Column column);
 
     void reverse_order();
     void randomize_order();
@@ -102,6 +156,7 @@ public:
 
     bool prev_song();
     bool next_song(bool repeat);
+    int predict_next_song(bool repeat) const;
     bool prev_album();
     bool next_album(bool repeat);
 
@@ -147,13 +202,22 @@ private:
     typedef SmartPtr<PlaylistEntry, delete_entry> EntryPtr;
 
     void number_entries(int at, int length);
+
+    int alloc_slot();
+    void free_slot(PlaylistEntry * entry);
+    void update_columns(const PlaylistEntry * entry);
+    int entry_length(const PlaylistEntry * entry) const;
+    int compare_columns(Column column, int slot_a, int slot_b) const;
+
     void set_entry_tuple(PlaylistEntry * entry, Tuple && tuple);
     void queue_update(Playlist::UpdateLevel level, int at, int count,
                       int flags = 0);
     void queue_position_change();
 
-    static void sort_entries(Index<EntryPtr> & entries,
-                             const CompareData & data);
+    void sort_entries(Index<EntryPtr> & entries,
+                      const CompareData & data) const;
+    void sort_entries_by_keys(Index<EntryPtr> & entries,
+                              const Index<PlaylistSortKey> & keys) const;
 
     int shuffle_pos_before(int ref_pos) const;
     PosChange shuffle_pos_after(int ref_pos, bool by_album) const;
@@ -168,6 +232,11 @@ private:
 
     void change_position(PosChange change);
     bool change_position_to_next(bool repeat, int hint_pos);
+
+    int shuffle_find(const PlaylistEntry * entry) const;
+    void shuffle_add(PlaylistEntry * entry);
+    void shuffle_remove(PlaylistEntry * entry);
+    void shuffle_mark_played(PlaylistEntry * entry);
     void shuffle_reset();
 
     PlaylistEntry * find_unselected_focus();
@@ -177,17 +246,40 @@ public:
     ScanStatus scan_status;
     String filename, title;
     int resume_time;
+    SmartPtr<Deferred> deferred;
 
 private:
     Playlist::ID * m_id;
+    mutable std::shared_mutex m_lock;
     Index<EntryPtr> m_entries;
     PlaylistEntry *m_position, *m_focus;
     int m_selected_count;
     int m_last_shuffle_num;
+
+    /* The shuffle order is kept as the list of entries played so far (in
+     * order of shuffle_num) and the list of entries not yet played (in no
+     * particular order).  Each entry knows its index in the second list, and
+     * its index in the first can be found by a binary search, so moving
+     * through the shuffle order does not require scanning the playlist. */
+    Index<PlaylistEntry *> m_shuffle_played;
+    Index<PlaylistEntry *> m_shuffle_unplayed;
     Index<PlaylistEntry *> m_queued;
     int64_t m_total_length, m_selected_length;
+
+    /* Copies of the most used metadata fields, one contiguous array per field,
+     * indexed by the slot of each entry.  Unlike the entry number, the slot
+     * does not change when the playlist is reordered.  The strings are pooled,
+     * so equal strings can usually be recognized by comparing pointers.  Unset
+     * integers are stored as INT_MIN, so that they sort first. */
+    Index<String> m_str_columns[LengthColumn];
+    Index<int> m_int_columns[n_columns - LengthColumn];
+    Index<bool> m_valid_column;
+    Index<int> m_free_slots;
     Playlist::Update m_last_update, m_next_update;
     bool m_position_changed;
+
+    Playlist::Update m_save_changes;
+    int m_saved_len;
 };
 
 /* callbacks or "signals" (in the QObject sense) */
@@ -25,12 +25,21 @@
 
 class InputPlugin;
 
+/* one key of a multi-key sort: filenames are compared if filename_compare is
+ * set, otherwise a collation key is built from the given metadata field */
+struct PlaylistSortKey
+{
+    Playlist::StringCompareFunc filename_compare;
+    Tuple::Field field;
+};
+
 struct DecodeInfo
 {
     String filename;
     InputPlugin * ip = nullptr;
     VFSFile file;
     String error;
+    bool preopened = false; // file left closed, the pre-roll has it open
 };
 
 /* extended handle for accessing internal playlist functions */
@@ -47,8 +56,31 @@ public:
     bool get_modified() const;
     void set_modified(bool modified) const;
 
+    /* Returns the entries changed since the playlist was last saved (before
+     * and after are the numbers of unchanged entries at the start and end) and
+     * its length at that time, then clears the modified flag.  The level is
+     * NoUpdate if no entries have changed.  Setting the modified flag marks
+     * every entry as changed; clearing it marks none. */
+    Update take_save_changes(int & saved_len) const;
+
+    /* Marks a new playlist as saved in the playlist store with the given
+     * title, number of entries, and total length, without loading it.  The
+     * entries are loaded from the file when first needed. */
+    void set_deferred(const char * path, const char * title, int n_entries,
+                      int64_t total_length) const;
+
     bool insert_flat_playlist(const char * filename) const;
     void insert_flat_items(int at, Index<PlaylistAddItem> && items) const;
+
+    void sort_by_keys(const Index<PlaylistSortKey> & keys,
+                      bool selected_only) const;
+
+    /* These use the copies of the most used metadata fields kept in columns,
+     * and are much faster than going through the tuples of a large playlist.
+     * The first returns false if the sort scheme is not one of those fields,
+     * in which case nothing is done. */
+    bool remove_duplicates_by_column(SortType scheme) const;
+    String entry_field(int entry_num, Tuple::Field field) const;
 };
 
 /* playlist.cc */
@@ -60,13 +92,24 @@ void playlist_end();
 void playlist_load_state();
 void playlist_save_state();
 
-DecodeInfo playback_entry_read(int serial);
+DecodeInfo playback_entry_read(int serial, const char * open_filename,
+                               PluginHandle * open_decoder);
+bool playback_entry_predict_next(int serial, String & filename,
+                                 PluginHandle *& decoder, Tuple & tuple);
 void playback_entry_set_tuple(int serial, Tuple && tuple);
 
 /* playlist-cache.cc */
 void playlist_cache_load(Index<PlaylistAddItem> & items);
 void playlist_cache_clear();
 
+/* playlist-store.cc */
+bool playlist_store_peek(const char * path, String & title, int & n_entries,
+                         int64_t & total_length);
+bool playlist_store_load(const char * path, String & title,
+                         Index<PlaylistAddItem> & items);
+bool playlist_store_save(const char * path, const PlaylistEx & playlist);
+void playlist_store_cleanup();
+
 /* playlist-files.cc */
 bool playlist_load(const char * filename, String & title,
                    Index<PlaylistAddItem> & items);
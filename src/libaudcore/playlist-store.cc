@@ -0,0 +1,794 @@
+/*
+ * playlist-store.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "playlist-internal.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "audstrings.h"
+#include "binary-io.h"
+#include "multihash.h"
+#include "plugins.h"
+#include "runtime.h"
+#include "threads.h"
+
+/* The playlists in the user's playlist folder are kept in a binary format of
+ * their own, so that they can be loaded quickly and saved incrementally.  A
+ * file starts with a snapshot of the playlist:
+ *
+ *   - a header;
+ *   - a table of strings (filenames, decoders, and the most used metadata
+ *     fields, each distinct string stored once), as NUL-terminated strings
+ *     followed by an array of their offsets;
+ *   - an array of fixed-size entry records, with those strings as indexes and
+ *     the integer fields as plain numbers;
+ *   - the other fields of each tuple, as written by put_tuple().
+ *
+ * The snapshot is followed by a journal of changes, each of which replaces a
+ * range of entries with new ones (which covers adding, removing, and updating
+ * entries) or changes the title.  Saving a playlist appends one such change,
+ * covering the entries changed since the last save, unless the journal has
+ * grown large compared to the snapshot, in which case a new snapshot is
+ * written in place of the file.  Each change carries a checksum, so that a
+ * change cut short (by a crash, for example) is ignored when loading. */
+
+#define MAGIC "AUDPLST1"
+#define BYTE_ORDER_MARK 0x01020304
+#define NO_STRING UINT32_MAX
+
+#define MIN_JOURNAL 65536 /* bytes */
+
+enum
+{
+    HasTuple = (1 << 0)
+};
+
+enum JournalOp
+{
+    SpliceOp = 1,
+    TitleOp
+};
+
+struct StoreHeader
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t n_entries;
+    uint32_t n_strings;
+    uint32_t title;          /* string index */
+    uint32_t strings_offset; /* array of string offsets */
+    uint32_t entries_offset; /* array of StoreEntry */
+    uint32_t extra_offset;   /* other tuple fields */
+    uint32_t journal_offset; /* end of the snapshot */
+};
+
+struct StoreEntry
+{
+    uint32_t filename, decoder;  /* string indexes */
+    uint32_t title, artist, album;
+    int32_t length, track, year; /* INT_MIN if not set */
+    uint32_t extra;              /* offset of the other fields */
+    uint32_t flags;
+};
+
+static const Tuple::Field str_columns[] = {Tuple::Title, Tuple::Artist,
+                                           Tuple::Album};
+static const Tuple::Field int_columns[] = {Tuple::Length, Tuple::Track,
+                                           Tuple::Year};
+
+/* what is known about each file loaded or saved during this session;
+ * playlists are saved from the main thread but may be loaded from any */
+struct StoreInfo
+{
+    int n_entries;
+    int64_t snapshot_len, journal_len;
+    String title;
+};
+
+static aud::mutex mutex;
+static SimpleHash<String, StoreInfo> store_info;
+
+static bool get_info(const char * path, StoreInfo & info)
+{
+    auto mh = mutex.take();
+    StoreInfo * found = store_info.lookup(String(path));
+    if (!found)
+        return false;
+
+    info = *found;
+    return true;
+}
+
+static void set_info(const char * path, StoreInfo && info)
+{
+    auto mh = mutex.take();
+    store_info.add(String(path), std::move(info));
+}
+
+static void forget_info(const char * path)
+{
+    auto mh = mutex.take();
+    store_info.remove(String(path));
+}
+
+static uint32_t checksum(const char * data, int len)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+
+    return hash;
+}
+
+static PluginHandle * find_decoder(const char * name)
+{
+    if (!name || !name[0])
+        return nullptr;
+
+    PluginHandle * decoder = aud_plugin_lookup_basename(name);
+    if (!decoder || aud_plugin_get_type(decoder) != PluginType::Input)
+        return nullptr;
+
+    return decoder;
+}
+
+/* ---- loading ---- */
+
+struct Snapshot
+{
+    const MappedFile & file;
+    StoreHeader header;
+    Index<String> strings;
+};
+
+static bool read_string(const Snapshot & snap, uint32_t index, String & str)
+{
+    const StoreHeader & header = snap.header;
+    const char * data = snap.file.data;
+
+    if (index == NO_STRING)
+    {
+        str = String();
+        return true;
+    }
+
+    if (index >= header.n_strings)
+        return false;
+
+    uint32_t offset;
+    memcpy(&offset, data + header.strings_offset + 4 * index, 4);
+
+    if (offset < sizeof header || offset >= header.strings_offset ||
+        !memchr(data + offset, 0, header.strings_offset - offset))
+        return false;
+
+    str = String(data + offset);
+    return true;
+}
+
+static bool read_strings(Snapshot & snap)
+{
+    snap.strings.insert(0, snap.header.n_strings);
+
+    for (uint32_t i = 0; i < snap.header.n_strings; i++)
+    {
+        if (!read_string(snap, i, snap.strings[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool get_string(const Snapshot & snap, uint32_t index, String & str)
+{
+    if (index == NO_STRING)
+    {
+        str = String();
+        return true;
+    }
+
+    if (index >= (uint32_t)snap.strings.len())
+        return false;
+
+    str = snap.strings[index];
+    return true;
+}
+
+static bool read_entry(const Snapshot & snap, const StoreEntry & rec,
+                       Index<PluginHandle *> & decoders, PlaylistAddItem & item)
+{
+    String decoder;
+
+    if (!get_string(snap, rec.filename, item.filename) || !item.filename ||
+        !get_string(snap, rec.decoder, decoder))
+        return false;
+
+    /* decoders are looked up once for each distinct name */
+    if (decoder)
+    {
+        if (!decoders[rec.decoder])
+            decoders[rec.decoder] = find_decoder(decoder);
+
+        item.decoder = decoders[rec.decoder];
+    }
+
+    if (!(rec.flags & HasTuple))
+        return true;
+
+    const uint32_t str_values[] = {rec.title, rec.artist, rec.album};
+    const int32_t int_values[] = {rec.length, rec.track, rec.year};
+
+    Tuple tuple;
+    tuple.set_filename(item.filename);
+
+    for (int i = 0; i < aud::n_elems(str_columns); i++)
+    {
+        String str;
+        if (!get_string(snap, str_values[i], str))
+            return false;
+        if (str)
+            tuple.set_str(str_columns[i], str);
+    }
+
+    for (int i = 0; i < aud::n_elems(int_columns); i++)
+    {
+        if (int_values[i] != INT_MIN)
+            tuple.set_int(int_columns[i], int_values[i]);
+    }
+
+    const StoreHeader & header = snap.header;
+    if (rec.extra < header.extra_offset || rec.extra >= header.journal_offset)
+        return false;
+
+    BinaryReader r = {snap.file.data + rec.extra,
+                      snap.file.data + header.journal_offset, true};
+    if (!read_tuple(r, &tuple))
+        return false;
+
+    tuple.set_state(Tuple::Valid);
+    item.tuple = std::move(tuple);
+    return true;
+}
+
+static bool read_header(Snapshot & snap)
+{
+    const MappedFile & file = snap.file;
+    StoreHeader & header = snap.header;
+
+    if (file.len < (int64_t)sizeof header)
+        return false;
+
+    memcpy(&header, file.data, sizeof header);
+
+    return !memcmp(header.magic, MAGIC, sizeof header.magic) &&
+           header.byte_order == BYTE_ORDER_MARK &&
+           header.strings_offset >= sizeof header &&
+           header.entries_offset >= header.strings_offset &&
+           header.extra_offset >= header.entries_offset &&
+           header.journal_offset >= header.extra_offset &&
+           header.journal_offset <= file.len &&
+           4 * (int64_t)header.n_strings <=
+               header.entries_offset - header.strings_offset &&
+           header.n_entries * (int64_t)sizeof(StoreEntry) <=
+               header.extra_offset - header.entries_offset;
+}
+
+static bool read_snapshot(Snapshot & snap, String & title,
+                          Index<PlaylistAddItem> & items)
+{
+    const MappedFile & file = snap.file;
+    const StoreHeader & header = snap.header;
+
+    if (!read_strings(snap) || !get_string(snap, header.title, title))
+        return false;
+
+    Index<PluginHandle *> decoders;
+    decoders.insert(0, header.n_strings);
+
+    items.insert(0, header.n_entries);
+
+    for (uint32_t i = 0; i < header.n_entries; i++)
+    {
+        StoreEntry rec;
+        memcpy(&rec, file.data + header.entries_offset + i * sizeof rec,
+               sizeof rec);
+
+        if (!read_entry(snap, rec, decoders, items[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool read_journal_entry(BinaryReader & r, PlaylistAddItem & item)
+{
+    uint64_t len = r.number();
+    const char * filename = r.bytes(len);
+    if (!filename || !len)
+        return false;
+
+    item.filename = String(str_copy(filename, len));
+
+    len = r.number();
+    const char * decoder = r.bytes(len);
+    if (!decoder)
+        return false;
+
+    item.decoder = find_decoder(str_copy(decoder, len));
+
+    const char * flags = r.bytes(1);
+    if (!flags)
+        return false;
+
+    if (!(*flags & HasTuple))
+        return true;
+
+    Tuple tuple;
+    tuple.set_filename(item.filename);
+
+    if (!read_tuple(r, &tuple))
+        return false;
+
+    tuple.set_state(Tuple::Valid);
+    item.tuple = std::move(tuple);
+    return true;
+}
+
+static int entry_length(const PlaylistAddItem & item)
+{
+    return aud::max(0, item.tuple.get_int(Tuple::Length));
+}
+
+/* if items is null, only the title, the number of entries, and (if lengths is
+ * not null) the length of each entry are updated */
+static bool apply_change(int op, BinaryReader & r, String & title,
+                         Index<PlaylistAddItem> * items, Index<int> * lengths,
+                         int & n_entries)
+{
+    if (op == TitleOp)
+    {
+        uint64_t len = r.number();
+        const char * str = r.bytes(len);
+        if (!str)
+            return false;
+
+        title = String(str_copy(str, len));
+        return true;
+    }
+
+    if (op != SpliceOp)
+        return false;
+
+    uint64_t at = r.number();
+    uint64_t removed = r.number();
+    uint64_t inserted = r.number();
+
+    if (!r.ok || at + removed > (uint64_t)n_entries ||
+        inserted > (uint64_t)(r.end - r.pos))
+        return false;
+
+    n_entries += inserted - removed;
+
+    if (!items && !lengths)
+        return true;
+
+    Index<PlaylistAddItem> new_items;
+    new_items.insert(0, inserted);
+
+    for (auto & item : new_items)
+    {
+        if (!read_journal_entry(r, item))
+            return false;
+    }
+
+    if (items)
+    {
+        items->remove(at, removed);
+        items->move_from(new_items, 0, at, -1, true, true);
+    }
+    else
+    {
+        Index<int> new_lengths;
+        for (auto & item : new_items)
+            new_lengths.append(entry_length(item));
+
+        lengths->remove(at, removed);
+        lengths->move_from(new_lengths, 0, at, -1, true, true);
+    }
+
+    return true;
+}
+
+/* applies the changes in the journal, up to the first one that is incomplete
+ * or invalid; returns the offset of the end of the last one applied */
+static int64_t read_journal(const MappedFile & file, int64_t offset,
+                            String & title, Index<PlaylistAddItem> * items,
+                            Index<int> * lengths, int & n_entries)
+{
+    while (offset < file.len)
+    {
+        BinaryReader r = {file.data + offset, file.data + file.len, true};
+
+        const char * op = r.bytes(1);
+        uint64_t len = r.number();
+        const char * payload = r.bytes(len);
+        const char * sum_bytes = r.bytes(4);
+
+        if (!sum_bytes)
+            break;
+
+        uint32_t sum;
+        memcpy(&sum, sum_bytes, 4);
+        if (sum != checksum(payload, len))
+            break;
+
+        BinaryReader pr = {payload, payload + len, true};
+        if (!apply_change(*op, pr, title, items, lengths, n_entries))
+            break;
+
+        offset = r.pos - file.data;
+    }
+
+    return offset;
+}
+
+/* reads only the title, the number of entries, and their total length (the
+ * entries added by the journal are read, but not those of the snapshot) */
+bool playlist_store_peek(const char * path, String & title, int & n_entries,
+                         int64_t & total_length)
+{
+    MappedFile file;
+    if (!map_file(path, file))
+        return false;
+
+    Snapshot snap = {file, StoreHeader(), Index<String>()};
+    const StoreHeader & header = snap.header;
+    bool valid = read_header(snap) && read_string(snap, header.title, title) &&
+                 header.n_entries <= INT_MAX;
+
+    if (valid)
+    {
+        Index<int> lengths;
+        lengths.insert(0, header.n_entries);
+
+        for (uint32_t i = 0; i < header.n_entries; i++)
+        {
+            StoreEntry rec;
+            memcpy(&rec, file.data + header.entries_offset + i * sizeof rec,
+                   sizeof rec);
+
+            if ((rec.flags & HasTuple))
+                lengths[i] = aud::max(0, rec.length);
+        }
+
+        n_entries = header.n_entries;
+        read_journal(file, header.journal_offset, title, nullptr, &lengths,
+                     n_entries);
+
+        total_length = 0;
+        for (int length : lengths)
+            total_length += length;
+    }
+    else
+        AUDWARN("Ignoring invalid playlist: %s\n", path);
+
+    unmap_file(file);
+    return valid;
+}
+
+bool playlist_store_load(const char * path, String & title,
+                         Index<PlaylistAddItem> & items)
+{
+    MappedFile file;
+    if (!map_file(path, file))
+        return false;
+
+    Snapshot snap = {file, StoreHeader(), Index<String>()};
+
+    if (!read_header(snap) || !read_snapshot(snap, title, items))
+    {
+        AUDWARN("Ignoring invalid playlist: %s\n", path);
+        unmap_file(file);
+        items.clear();
+        return false;
+    }
+
+    int n_entries = items.len();
+    int64_t snapshot_len = snap.header.journal_offset;
+    int64_t end =
+        read_journal(file, snapshot_len, title, &items, nullptr, n_entries);
+
+    /* if the journal ends with garbage, nothing more can be appended to it;
+     * the next save will write a new snapshot */
+    if (end < file.len)
+        AUDWARN("Discarding incomplete changes to playlist: %s\n", path);
+    else
+        set_info(path, {n_entries, snapshot_len, end - snapshot_len, title});
+
+    unmap_file(file);
+    return true;
+}
+
+/* ---- saving ---- */
+
+struct StringTable
+{
+    SimpleHash<String, uint32_t> ids;
+    Index<char> data;
+    Index<uint32_t> offsets;
+
+    uint32_t add(const String & str)
+    {
+        if (!str)
+            return NO_STRING;
+
+        uint32_t * id = ids.lookup(str);
+        if (id)
+            return *id;
+
+        offsets.append(sizeof(StoreHeader) + data.len());
+        data.insert(str, -1, strlen(str) + 1);
+        return *ids.add(str, offsets.len() - 1);
+    }
+};
+
+static bool write_file(const char * path, const Index<char> * parts[],
+                       int n_parts)
+{
+    StringBuf temp = str_concat({path, ".tmp"});
+
+    FILE * handle = g_fopen(temp, "wb");
+    if (!handle)
+    {
+        AUDERR("Cannot write %s: %s\n", (const char *)temp, strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < n_parts; i++)
+        fwrite(parts[i]->begin(), 1, parts[i]->len(), handle);
+
+    bool success = !ferror(handle);
+    success = (fclose(handle) == 0) && success;
+
+    if (!success || g_rename(temp, path) < 0)
+    {
+        AUDERR("Cannot write %s: %s\n", path, strerror(errno));
+        g_unlink(temp);
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_snapshot(const char * path, const PlaylistEx & playlist,
+                           const String & title)
+{
+    StringTable strings;
+    Index<char> entries, extra;
+
+    uint64_t skip = 0;
+    for (auto field : str_columns)
+        skip |= (uint64_t)1 << field;
+    for (auto field : int_columns)
+        skip |= (uint64_t)1 << field;
+
+    int n_entries = playlist.n_entries();
+
+    for (int i = 0; i < n_entries; i++)
+    {
+        PluginHandle * decoder = playlist.entry_decoder(i, Playlist::NoWait);
+        Tuple tuple = playlist.entry_tuple(i, Playlist::NoWait);
+
+        StoreEntry rec = StoreEntry();
+        rec.filename = strings.add(playlist.entry_filename(i));
+        rec.decoder =
+            decoder ? strings.add(String(aud_plugin_get_basename(decoder)))
+                    : NO_STRING;
+        rec.title = rec.artist = rec.album = NO_STRING;
+        rec.length = rec.track = rec.year = INT_MIN;
+
+        if (tuple.valid())
+        {
+            uint32_t * str_values[] = {&rec.title, &rec.artist, &rec.album};
+            int32_t * int_values[] = {&rec.length, &rec.track, &rec.year};
+
+            for (int c = 0; c < aud::n_elems(str_columns); c++)
+                *str_values[c] = strings.add(tuple.get_str(str_columns[c]));
+
+            for (int c = 0; c < aud::n_elems(int_columns); c++)
+            {
+                if (tuple.is_set(int_columns[c]))
+                    *int_values[c] = tuple.get_int(int_columns[c]);
+            }
+
+            rec.extra = extra.len();
+            rec.flags |= HasTuple;
+            put_tuple(extra, tuple, skip);
+        }
+
+        entries.insert((const char *)&rec, -1, sizeof rec);
+    }
+
+    StoreHeader header = StoreHeader();
+    memcpy(header.magic, MAGIC, sizeof header.magic);
+    header.byte_order = BYTE_ORDER_MARK;
+    header.n_entries = n_entries;
+    header.title = strings.add(title);
+    header.n_strings = strings.offsets.len();
+
+    int64_t strings_offset = sizeof header + strings.data.len();
+    int64_t entries_offset = strings_offset + 4 * strings.offsets.len();
+    int64_t extra_offset = entries_offset + entries.len();
+    int64_t journal_offset = extra_offset + extra.len();
+
+    if (journal_offset > UINT32_MAX)
+    {
+        AUDERR("Playlist too large to save: %s\n", path);
+        return false;
+    }
+
+    header.strings_offset = strings_offset;
+    header.entries_offset = entries_offset;
+    header.extra_offset = extra_offset;
+    header.journal_offset = journal_offset;
+
+    /* make the offsets of the other fields absolute */
+    for (int i = 0; i < n_entries; i++)
+    {
+        StoreEntry rec;
+        char * data = &entries[i * sizeof rec];
+
+        memcpy(&rec, data, sizeof rec);
+        if ((rec.flags & HasTuple))
+            rec.extra += extra_offset;
+        memcpy(data, &rec, sizeof rec);
+    }
+
+    Index<char> header_data, offsets_data;
+    header_data.insert((const char *)&header, 0, sizeof header);
+    offsets_data.insert((const char *)strings.offsets.begin(), 0,
+                        4 * strings.offsets.len());
+
+    const Index<char> * parts[] = {&header_data, &strings.data, &offsets_data,
+                                   &entries, &extra};
+
+    if (!write_file(path, parts, aud::n_elems(parts)))
+        return false;
+
+    set_info(path, {n_entries, journal_offset, 0, title});
+    return true;
+}
+
+static void put_journal_entry(Index<char> & buf, const PlaylistEx & playlist,
+                              int entry)
+{
+    PluginHandle * decoder = playlist.entry_decoder(entry, Playlist::NoWait);
+    Tuple tuple = playlist.entry_tuple(entry, Playlist::NoWait);
+
+    put_string(buf, playlist.entry_filename(entry));
+    put_string(buf, decoder ? aud_plugin_get_basename(decoder) : "");
+    buf.append((char)(tuple.valid() ? HasTuple : 0));
+
+    if (tuple.valid())
+        put_tuple(buf, tuple);
+}
+
+static void put_change(Index<char> & journal, JournalOp op,
+                       const Index<char> & payload)
+{
+    uint32_t sum = checksum(payload.begin(), payload.len());
+
+    journal.append((char)op);
+    put_number(journal, payload.len());
+    journal.insert(payload.begin(), -1, payload.len());
+    journal.insert((const char *)&sum, -1, sizeof sum);
+}
+
+/* returns false if a new snapshot should be written instead */
+static bool append_changes(const char * path, const PlaylistEx & playlist,
+                           const String & title,
+                           const Playlist::Update & changes, int saved_len)
+{
+    StoreInfo info;
+    if (!get_info(path, info) || info.n_entries != saved_len)
+        return false;
+
+    int n_entries = playlist.n_entries();
+    Index<char> journal, payload;
+
+    if (changes.level)
+    {
+        int before = changes.before, after = changes.after;
+        if (before < 0 || after < 0 || before + after > saved_len ||
+            before + after > n_entries)
+            return false;
+
+        put_number(payload, before);
+        put_number(payload, saved_len - before - after);
+        put_number(payload, n_entries - before - after);
+
+        for (int i = before; i < n_entries - after; i++)
+            put_journal_entry(payload, playlist, i);
+
+        put_change(journal, SpliceOp, payload);
+    }
+
+    if (title != info.title)
+    {
+        payload.resize(0);
+        put_string(payload, title ? title : "");
+        put_change(journal, TitleOp, payload);
+    }
+
+    if (!journal.len())
+        return true;
+
+    int64_t journal_len = info.journal_len + journal.len();
+    if (journal_len > aud::max(info.snapshot_len / 2, (int64_t)MIN_JOURNAL))
+        return false;
+
+    FILE * handle = g_fopen(path, "ab");
+    bool success = false;
+
+    if (handle)
+    {
+        success = (fwrite(journal.begin(), 1, journal.len(), handle) ==
+                   (size_t)journal.len());
+        success = (fclose(handle) == 0) && success;
+    }
+
+    /* the end of the file is now in doubt; start over with a new snapshot */
+    if (!success)
+    {
+        AUDERR("Cannot write %s: %s\n", path, strerror(errno));
+        forget_info(path);
+        return false;
+    }
+
+    set_info(path, {n_entries, info.snapshot_len, journal_len, title});
+    return true;
+}
+
+bool playlist_store_save(const char * path, const PlaylistEx & playlist)
+{
+    int saved_len;
+    Playlist::Update changes = playlist.take_save_changes(saved_len);
+    String title = playlist.get_title();
+
+    if (append_changes(path, playlist, title, changes, saved_len) ||
+        write_snapshot(path, playlist, title))
+        return true;
+
+    /* try again next time */
+    playlist.set_modified(true);
+    return false;
+}
+
+void playlist_store_cleanup()
+{
+    auto mh = mutex.take();
+    store_info.clear();
+}
@@ -174,20 +174,63 @@ static_assert(aud::n_elems(filename_comparisons) == Playlist::n_sort_types &&
                   aud::n_elems(tuple_comparisons) == Playlist::n_sort_types,
               "Update playlist comparison functions");
 
+static const Tuple::Field sort_fields[] = {
+    Tuple::Invalid,        // path
+    Tuple::Invalid,        // filename
+    Tuple::Title,          // title
+    Tuple::Album,          // album
+    Tuple::Artist,         // artist
+    Tuple::AlbumArtist,    // album artist
+    Tuple::Year,           // date
+    Tuple::Genre,          // genre
+    Tuple::Track,          // track
+    Tuple::FormattedTitle, // formatted title
+    Tuple::Length,         // length
+    Tuple::Comment,        // comment
+    Tuple::Publisher,      // publisher
+    Tuple::CatalogNum,     // catalog number
+    Tuple::Disc            // disc number
+};
+
+static_assert(aud::n_elems(sort_fields) == Playlist::n_sort_types,
+              "Update playlist sort fields");
+
+/* rather than calling the comparison functions above, a collation key is built
+ * once for each entry from the metadata field of each scheme */
+static Index<PlaylistSortKey>
+get_sort_keys(const Index<Playlist::SortType> & schemes)
+{
+    Index<PlaylistSortKey> keys;
+
+    for (Playlist::SortType scheme : schemes)
+        keys.append(PlaylistSortKey{filename_comparisons[scheme],
+                                    sort_fields[scheme]});
+
+    return keys;
+}
+
 EXPORT void Playlist::sort_entries(SortType scheme) const
 {
-    if (filename_comparisons[scheme])
-        sort_by_filename(filename_comparisons[scheme]);
-    else if (tuple_comparisons[scheme])
-        sort_by_tuple(tuple_comparisons[scheme]);
+    Index<SortType> schemes;
+    schemes.append(scheme);
+    sort_entries(schemes);
 }
 
 EXPORT void Playlist::sort_selected(SortType scheme) const
 {
-    if (filename_comparisons[scheme])
-        sort_selected_by_filename(filename_comparisons[scheme]);
-    else if (tuple_comparisons[scheme])
-        sort_selected_by_tuple(tuple_comparisons[scheme]);
+    Index<SortType> schemes;
+    schemes.append(scheme);
+    sort_selected(schemes);
+}
+
+EXPORT void Playlist::sort_entries(const Index<SortType> & schemes) const
+{
+    PlaylistEx(*this).sort_by_keys(get_sort_keys(schemes), false);
+}
+
+EXPORT void Playlist::sort_selected(const Index<SortType> & schemes) const
+{
+    PlaylistEx(*this).sort_by_keys(get_sort_keys(schemes), true);
 }
 
 /* FIXME: this considers empty fields as duplicates */
@@ -197,6 +240,9 @@ EXPORT void Playlist::remove_duplicates(SortType scheme) const
     if (entries < 1)
         return;
 
+    if (PlaylistEx(*this).remove_duplicates_by_column(scheme))
+        return;
+
     select_all(false);
 
     if (filename_comparisons[scheme])
@@ -278,8 +324,7 @@ EXPORT void Playlist::select_by_patterns(const Tuple & patterns) const
             if (!entry_selected(i))
                 continue;
 
-            Tuple tuple = entry_tuple(i);
-            String string = tuple.get_str(field);
+            String string = PlaylistEx(*this).entry_field(i, field);
 
             if (!string ||
                 !g_regex_match(regex, string, (GRegexMatchFlags)0, nullptr))
@@ -329,15 +374,39 @@ static void load_playlists_real()
     {
         const char * number = order[i];
 
+        PlaylistEx playlist =
+            PlaylistEx::insert_with_stamp(count + i, atoi(number));
+
+        /* the entries are loaded when first needed */
+        String title;
+        int n_entries;
+        int64_t total_length;
         StringBuf path =
-            filename_build({folder, str_concat({number, ".audpl"})});
+            filename_build({folder, str_concat({number, ".audplb"})});
+
+        if (playlist_store_peek(path, title, n_entries, total_length))
+        {
+            playlist.set_deferred(path, title, n_entries, total_length);
+            continue;
+        }
+
+        /* if the file is there but cannot be read, the older formats are
+         * gone; the playlist is left to fail when loaded, so that it is never
+         * saved over the file */
+        if (g_file_test(path, G_FILE_TEST_EXISTS))
+        {
+            AUDERR("Cannot read playlist: %s\n", (const char *)path);
+            playlist.set_deferred(path, playlist.get_title(), 0, 0);
+            continue;
+        }
+
+        /* older text formats, converted when next saved */
+        path = filename_build({folder, str_concat({number, ".audpl"})});
         if (!g_file_test(path, G_FILE_TEST_EXISTS))
             path = filename_build({folder, str_concat({number, ".xspf"})});
 
-        PlaylistEx playlist =
-            PlaylistEx::insert_with_stamp(count + i, atoi(number));
         playlist.insert_flat_playlist(filename_to_uri(path));
-        playlist.set_modified(g_str_has_suffix(path, ".xspf"));
+        playlist.set_modified(true);
     }
 
     if (!Playlist::n_playlists())
@@ -358,13 +427,14 @@ static void save_playlists_real()
     {
         PlaylistEx playlist = Playlist::by_index(i);
         StringBuf number = int_to_str(playlist.stamp());
-        StringBuf name = str_concat({number, ".audpl"});
+        StringBuf name = str_concat({number, ".audplb"});
 
-        if (playlist.get_modified())
+        /* if the playlist could not be saved, keep any older file */
+        if (playlist.get_modified() &&
+            !playlist_store_save(filename_build({folder, name}), playlist))
         {
-            StringBuf path = filename_build({folder, name});
-            playlist.save_to_file(filename_to_uri(path), Playlist::NoWait);
-            playlist.set_modified(false);
+            saved.add(String(str_concat({number, ".audpl"})), true);
+            saved.add(String(str_concat({number, ".xspf"})), true);
         }
 
         order.append(String(number));
@@ -380,7 +450,7 @@ static void save_playlists_real()
         VFSFile::write_file(order_path, (const char *)order_string,
                             order_string.len());
 
-    /* clean up deleted playlists and files from old naming scheme */
+    /* clean up deleted playlists and files from old naming schemes */
 
     g_unlink(make_playlist_path(0));
 
@@ -391,7 +461,8 @@ static void save_playlists_real()
     const char * name;
     while ((name = g_dir_read_name(dir)))
     {
-        if (!g_str_has_suffix(name, ".audpl") &&
+        if (!g_str_has_suffix(name, ".audplb") &&
+            !g_str_has_suffix(name, ".audpl") &&
             !g_str_has_suffix(name, ".xspf"))
             continue;
 
@@ -33,6 +33,7 @@
 #include "internal.h"
 #include "list.h"
 #include "mainloop.h"
+#include "metadata-cache.h"
 #include "multihash.h"
 #include "parse.h"
 #include "playlist-data.h"
@@ -64,30 +65,79 @@ enum class UpdateState
 
 #define STATE_FILE "playlist-state"
 
-#define ENTER_GET_PLAYLIST(...)                                                \
+/* does not load a deferred playlist; for accessors that need only the title,
+ * index, and such */
+#define ENTER_LOOKUP_PLAYLIST(...)                                             \
     auto mh = mutex.take();                                                    \
     PlaylistData * playlist = m_id ? m_id->data : nullptr;                     \
     if (!playlist)                                                             \
     return __VA_ARGS__
 
+/* fails if a deferred playlist is removed while loading, or cannot be loaded */
+#define ENTER_FIND_PLAYLIST(...)                                               \
+    ENTER_LOOKUP_PLAYLIST(__VA_ARGS__);                                        \
+    if (playlist->deferred && !(playlist = load_deferred(mh, m_id)))           \
+    return __VA_ARGS__
+
+#define ENTER_GET_PLAYLIST(...)                                                \
+    ENTER_FIND_PLAYLIST(__VA_ARGS__);                                          \
+    auto wh = playlist->write_lock()
+
+/* the mutex is released once the playlist is found and read-locked */
+#define ENTER_READ_PLAYLIST(...)                                               \
+    ENTER_FIND_PLAYLIST(__VA_ARGS__);                                          \
+    auto rh = playlist->read_lock();                                           \
+    mh.unlock()
+
 #define SIMPLE_WRAPPER(type, failcode, func, ...)                              \
     ENTER_GET_PLAYLIST(failcode);                                              \
     return playlist->func(__VA_ARGS__)
 
+#define READ_WRAPPER(type, failcode, func, ...)                                \
+    ENTER_READ_PLAYLIST(failcode);                                             \
+    return playlist->func(__VA_ARGS__)
+
 #define SIMPLE_VOID_WRAPPER(func, ...)                                         \
     ENTER_GET_PLAYLIST();                                                      \
     playlist->func(__VA_ARGS__)
 
+/* answers for a deferred playlist from the state kept for it, without loading
+ * it (see load_deferred()) */
+#define DEFERRED_WRAPPER(type, failcode, deferred_func, func)                  \
+    ENTER_LOOKUP_PLAYLIST(failcode);                                           \
+    if (playlist->deferred)                                                    \
+        return deferred_func(*playlist->deferred);                             \
+    auto rh = playlist->read_lock();                                           \
+    mh.unlock();                                                               \
+    return playlist->func()
+
 static const char * const default_title = N_("New Playlist");
 static const char * const temp_title = N_("Now Playing");
 
+/*
+ * The mutex protects the table of playlists and the state shared between them
+ * (the active and playing playlists, the scan list, and pending updates).  In
+ * addition, each playlist has its own read/write lock (see PlaylistData).
+ * Changes are made with both held, while accessors that only read the entries
+ * release the mutex as soon as they have read-locked the playlist, so that
+ * they do not wait for work on other playlists.  The locks are always taken in
+ * this order, and no more than one playlist is locked at a time:
+ *
+ *   1. the mutex here
+ *   2. the lock of a playlist
+ *   3. the mutex in playback.cc (see playback_set_info(), playback_play())
+ *
+ * A playlist is never locked while waiting for a scan (see wait_for_entry()),
+ * and is write-locked once more before it is deleted, so that it outlives any
+ * readers.
+ */
 static aud::mutex mutex;
 static aud::condvar condvar;
 
 /*
  * Each playlist is associated with its own ID struct, which contains a unique
- * integer "stamp" (this is the source of the internal filenames 1000.audpl,
- * 1001.audpl, etc.)  The ID struct also serves as a "weak" pointer to the
+ * integer "stamp" (this is the source of the internal filenames 1000.audplb,
+ * 1001.audplb, etc.)  The ID struct also serves as a "weak" pointer to the
  * actual data, and persists even after the playlist itself is destroyed.
  * The IDs are stored in a hash table, allowing lookup by stamp.
  *
@@ -138,6 +188,8 @@ static bool scan_enabled_nominal, scan_enabled;
 static int scan_playlist, scan_row;
 static List<ScanItem> scan_list;
 
+static void queue_global_update(Playlist::UpdateLevel level, int flags = 0);
+
 static void scan_finish(ScanRequest * request);
 static void scan_cancel(PlaylistEntry * entry);
 static void scan_restart();
@@ -168,6 +220,123 @@ static void number_playlists(int at, int length)
         playlists[i]->id()->index = i;
 }
 
+/* focuses and selects the current entry (or the first one) */
+static void set_initial_focus(PlaylistData * playlist)
+{
+    int focus = playlist->position();
+    if (focus < 0 && playlist->n_entries())
+        focus = 0;
+
+    if (focus >= 0)
+    {
+        playlist->set_focus(focus);
+        playlist->select_entry(focus, true);
+    }
+}
+
+/*
+ * At startup, only the active and playing playlists are loaded from the
+ * playlist store.  The others are created with just their title, number of
+ * entries, and total length, and loaded the first time their entries are
+ * needed, so that a large number of saved playlists costs neither time nor
+ * memory until they are opened.  The state read from the playlist-state file
+ * is kept until then, and accessors that need nothing else answer from it.
+ *
+ * Called with the mutex held and the playlist not locked.  The mutex is
+ * released while the file is read, so the playlist may have been removed by
+ * the time it is loaded.  A playlist whose file cannot be read is left empty
+ * and deferred, and is never saved, so that the file is not overwritten.
+ * Returns the playlist if it is loaded, otherwise null.
+ */
+static PlaylistData * load_deferred(aud::mutex::holder & mh, Playlist::ID * id)
+{
+    PlaylistData * playlist = id->data;
+
+    /* wait if another thread is already loading it */
+    while (playlist && playlist->deferred && playlist->deferred->loading)
+    {
+        condvar.wait(mh);
+        playlist = id->data;
+    }
+
+    if (!playlist || !playlist->deferred)
+        return playlist;
+    if (playlist->deferred->failed)
+        return nullptr;
+
+    String path = playlist->deferred->path;
+    playlist->deferred->loading = true;
+
+    mh.unlock();
+
+    String title;
+    Index<PlaylistAddItem> items;
+    bool loaded = playlist_store_load(path, title, items);
+
+    mh.lock();
+    condvar.notify_all();
+
+    if (!(playlist = id->data))
+        return nullptr;
+
+    auto & deferred = playlist->deferred;
+    deferred->loading = false;
+
+    if (!loaded)
+    {
+        AUDERR("Cannot load playlist: %s\n", (const char *)path);
+
+        deferred->failed = true;
+        deferred->n_entries = 0;
+        deferred->total_length = 0;
+
+        queue_global_update(Playlist::Structure);
+        return nullptr;
+    }
+
+    auto wh = playlist->write_lock();
+
+    /* the title in the file is ignored; it may have been changed since */
+    playlist->insert_items(0, std::move(items));
+
+    if (deferred->position >= 0)
+        playlist->set_position(deferred->position);
+    if (deferred->shuffle_history.len())
+        playlist->shuffle_replay(deferred->shuffle_history);
+
+    set_initial_focus(playlist);
+
+    /* nothing has changed since the playlist was saved */
+    playlist->modified = false;
+    playlist->reset_save_changes(false);
+
+    deferred.clear();
+    return playlist;
+}
+
+/* what the accessors will return once the playlist is loaded (see
+ * load_deferred() and set_initial_focus()) */
+static int deferred_n_entries(const PlaylistData::Deferred & deferred)
+{
+    return deferred.n_entries;
+}
+
+static int deferred_position(const PlaylistData::Deferred & deferred)
+{
+    return (deferred.position < deferred.n_entries) ? deferred.position : -1;
+}
+
+static int deferred_focus(const PlaylistData::Deferred & deferred)
+{
+    int position = deferred_position(deferred);
+    return (position < 0 && deferred.n_entries) ? 0 : position;
+}
+
+static int64_t deferred_total_length(const PlaylistData::Deferred & deferred)
+{
+    return deferred.total_length;
+}
+
 EXPORT void Playlist::process_pending_update()
 {
     auto mh = mutex.take();
@@ -230,7 +399,7 @@ static void queue_update_hooks(int hooks)
     queue_update();
 }
 
-static void queue_global_update(Playlist::UpdateLevel level, int flags = 0)
+static void queue_global_update(Playlist::UpdateLevel level, int flags)
 {
     if (level == Playlist::Structure)
         scan_restart();
@@ -259,7 +428,7 @@ EXPORT bool Playlist::update_pending_any()
 
 EXPORT bool Playlist::scan_in_progress() const
 {
-    ENTER_GET_PLAYLIST(false);
+    ENTER_LOOKUP_PLAYLIST(false);
     return (playlist->scan_status != PlaylistData::NotScanning);
 }
 
@@ -371,17 +540,18 @@ static bool scan_queue_next_entry()
 
 static void scan_schedule()
 {
+    int max_pending = scanner_max_pending();
     int scheduled = 0;
 
     for (ScanItem * item = scan_list.head(); item; item = scan_list.next(item))
     {
-        if (++scheduled >= SCAN_THREADS)
+        if (++scheduled >= max_pending)
             return;
     }
 
     while (scan_queue_next_entry())
     {
-        if (++scheduled >= SCAN_THREADS)
+        if (++scheduled >= max_pending)
             return;
     }
 }
@@ -403,6 +573,8 @@ static void scan_finish(ScanRequest * request)
 
     scan_list.remove(item);
 
+    auto wh = playlist->write_lock();
+
     // only use delayed update if a scan is still in progress
     int update_flags = 0;
     if (scan_enabled && playlist->scan_status != PlaylistData::NotScanning)
@@ -411,6 +583,7 @@ static void scan_finish(ScanRequest * request)
     playlist->update_entry_from_scan(entry, request, update_flags);
 
     delete item;
+    wh.unlock();
 
     scan_check_complete(playlist);
     scan_schedule();
@@ -552,7 +725,10 @@ static void pl_hook_reformat_titles(void *, void *)
     PlaylistData::update_formatter();
 
     for (auto & playlist : playlists)
+    {
+        auto wh = playlist->write_lock();
         playlist->reformat_titles();
+    }
 }
 
 static void pl_hook_trigger_scan(void *, void *)
@@ -621,6 +797,7 @@ void playlist_end()
     hook_dissociate("set metadata_on_play", pl_hook_trigger_scan);
 
     playlist_cache_clear();
+    playlist_store_cleanup();
 
     auto mh = mutex.take();
 
@@ -640,17 +817,24 @@ void playlist_end()
     PlaylistData::cleanup_formatter();
 }
 
-EXPORT int Playlist::n_entries() const { SIMPLE_WRAPPER(int, 0, n_entries); }
+EXPORT int Playlist::n_entries() const
+{
+    DEFERRED_WRAPPER(int, 0, deferred_n_entries, n_entries);
+}
+
 EXPORT void Playlist::remove_entries(int at, int number) const
 {
     SIMPLE_VOID_WRAPPER(remove_entries, at, number);
 }
 EXPORT String Playlist::entry_filename(int entry_num) const
 {
-    SIMPLE_WRAPPER(String, String(), entry_filename, entry_num);
+    READ_WRAPPER(String, String(), entry_filename, entry_num);
 }
 
-EXPORT int Playlist::get_position() const { SIMPLE_WRAPPER(int, -1, position); }
+EXPORT int Playlist::get_position() const
+{
+    DEFERRED_WRAPPER(int, -1, deferred_position, position);
+}
 EXPORT void Playlist::set_position(int entry_num) const
 {
     SIMPLE_VOID_WRAPPER(set_position, entry_num);
@@ -671,14 +855,17 @@ EXPORT bool Playlist::next_album(bool repeat) const
 {
     SIMPLE_WRAPPER(bool, false, next_album, repeat);
 }
-EXPORT int Playlist::get_focus() const { SIMPLE_WRAPPER(int, -1, focus); }
+EXPORT int Playlist::get_focus() const
+{
+    DEFERRED_WRAPPER(int, -1, deferred_focus, focus);
+}
 EXPORT void Playlist::set_focus(int entry_num) const
 {
     SIMPLE_VOID_WRAPPER(set_focus, entry_num);
 }
 EXPORT bool Playlist::entry_selected(int entry_num) const
 {
-    SIMPLE_WRAPPER(bool, false, entry_selected, entry_num);
+    READ_WRAPPER(bool, false, entry_selected, entry_num);
 }
 EXPORT void Playlist::select_entry(int entry_num, bool selected) const
 {
@@ -686,7 +873,7 @@ EXPORT void Playlist::select_entry(int entry_num, bool selected) const
 }
 EXPORT int Playlist::n_selected(int at, int number) const
 {
-    SIMPLE_WRAPPER(int, 0, n_selected, at, number);
+    READ_WRAPPER(int, 0, n_selected, at, number);
 }
 EXPORT void Playlist::select_all(bool selected) const
 {
@@ -703,19 +890,23 @@ EXPORT void Playlist::remove_selected() const
 
 EXPORT void Playlist::sort_by_filename(StringCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort, {compare, nullptr});
+    SIMPLE_VOID_WRAPPER(sort,
+                        {compare, nullptr, PlaylistData::NoColumn, nullptr});
 }
 EXPORT void Playlist::sort_by_tuple(TupleCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort, {nullptr, compare});
+    SIMPLE_VOID_WRAPPER(sort,
+                        {nullptr, compare, PlaylistData::NoColumn, nullptr});
 }
 EXPORT void Playlist::sort_selected_by_filename(StringCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort_selected, {compare, nullptr});
+    SIMPLE_VOID_WRAPPER(sort_selected,
+                        {compare, nullptr, PlaylistData::NoColumn, nullptr});
 }
 EXPORT void Playlist::sort_selected_by_tuple(TupleCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort_selected, {nullptr, compare});
+    SIMPLE_VOID_WRAPPER(sort_selected,
+                        {nullptr, compare, PlaylistData::NoColumn, nullptr});
 }
 EXPORT void Playlist::reverse_order() const
 {
@@ -745,14 +936,14 @@ EXPORT void Playlist::rescan_selected() const
 
 EXPORT int64_t Playlist::total_length_ms() const
 {
-    SIMPLE_WRAPPER(int64_t, 0, total_length);
+    DEFERRED_WRAPPER(int64_t, 0, deferred_total_length, total_length);
 }
 EXPORT int64_t Playlist::selected_length_ms() const
 {
-    SIMPLE_WRAPPER(int64_t, 0, selected_length);
+    READ_WRAPPER(int64_t, 0, selected_length);
 }
 
-EXPORT int Playlist::n_queued() const { SIMPLE_WRAPPER(int, 0, n_queued); }
+EXPORT int Playlist::n_queued() const { READ_WRAPPER(int, 0, n_queued); }
 EXPORT void Playlist::queue_insert(int at, int entry_num) const
 {
     SIMPLE_VOID_WRAPPER(queue_insert, at, entry_num);
@@ -763,11 +954,11 @@ EXPORT void Playlist::queue_insert_selected(int at) const
 }
 EXPORT int Playlist::queue_get_entry(int at) const
 {
-    SIMPLE_WRAPPER(int, -1, queue_get_entry, at);
+    READ_WRAPPER(int, -1, queue_get_entry, at);
 }
 EXPORT int Playlist::queue_find_entry(int entry_num) const
 {
-    SIMPLE_WRAPPER(int, -1, queue_find_entry, entry_num);
+    READ_WRAPPER(int, -1, queue_find_entry, entry_num);
 }
 EXPORT void Playlist::queue_remove(int at, int number) const
 {
@@ -778,13 +969,17 @@ EXPORT void Playlist::queue_remove_selected() const
     SIMPLE_VOID_WRAPPER(queue_remove_selected);
 }
 
+/* updates are tracked for deferred playlists too, and may be read with only
+ * the mutex held */
 EXPORT bool Playlist::update_pending() const
 {
-    SIMPLE_WRAPPER(bool, false, update_pending);
+    ENTER_LOOKUP_PLAYLIST(false);
+    return playlist->update_pending();
 }
 EXPORT Playlist::Update Playlist::update_detail() const
 {
-    SIMPLE_WRAPPER(Update, Update(), last_update);
+    ENTER_LOOKUP_PLAYLIST(Update());
+    return playlist->last_update();
 }
 
 void PlaylistEx::insert_flat_items(int at,
@@ -793,15 +988,73 @@ void PlaylistEx::insert_flat_items(int at,
     SIMPLE_VOID_WRAPPER(insert_items, at, std::move(items));
 }
 
+static PlaylistData::Column sort_column(Playlist::SortType scheme)
+{
+    switch (scheme)
+    {
+    case Playlist::Title:
+        return PlaylistData::TitleColumn;
+    case Playlist::Album:
+        return PlaylistData::AlbumColumn;
+    case Playlist::Artist:
+        return PlaylistData::ArtistColumn;
+    case Playlist::Date:
+        return PlaylistData::YearColumn;
+    case Playlist::Track:
+        return PlaylistData::TrackColumn;
+    case Playlist::Length:
+        return PlaylistData::LengthColumn;
+    default:
+        return PlaylistData::NoColumn;
+    }
+}
+
+void PlaylistEx::sort_by_keys(const Index<PlaylistSortKey> & keys,
+                              bool selected_only) const
+{
+    ENTER_GET_PLAYLIST();
+
+    PlaylistData::CompareData data = {nullptr, nullptr,
+                                      PlaylistData::NoColumn, &keys};
+
+    if (selected_only)
+        playlist->sort_selected(data);
+    else
+        playlist->sort(data);
+}
+
+bool PlaylistEx::remove_duplicates_by_column(SortType scheme) const
+{
+    auto column = sort_column(scheme);
+    if (column == PlaylistData::NoColumn)
+        return false;
+
+    ENTER_GET_PLAYLIST(true);
+    playlist->remove_duplicates(column);
+    return true;
+}
+
+String PlaylistEx::entry_field(int entry_num, Tuple::Field field) const
+{
+    auto column = PlaylistData::field_column(field);
+    if (column == PlaylistData::NoColumn ||
+        column >= PlaylistData::LengthColumn)
+        return entry_tuple(entry_num).get_str(field);
+
+    ENTER_FIND_PLAYLIST(String());
+    wait_for_entry(mh, playlist, entry_num, false, true);
+    return playlist->entry_column_str(entry_num, column);
+}
+
 EXPORT int Playlist::index() const
 {
-    ENTER_GET_PLAYLIST(-1);
+    ENTER_LOOKUP_PLAYLIST(-1);
     return m_id->index;
 }
 
 EXPORT int PlaylistEx::stamp() const
 {
-    ENTER_GET_PLAYLIST(-1);
+    ENTER_LOOKUP_PLAYLIST(-1);
     return m_id->stamp;
 }
 
@@ -842,8 +1095,11 @@ static Playlist::ID * insert_playlist_locked(int at, int stamp = -1)
 
 static Playlist::ID * get_blank_locked()
 {
-    if (!strcmp(active_id->data->title, _(default_title)) &&
-        !active_id->data->n_entries())
+    auto playlist = active_id->data;
+    int n_entries = playlist->deferred ? playlist->deferred->n_entries
+                                       : playlist->n_entries();
+
+    if (!strcmp(playlist->title, _(default_title)) && !n_entries)
         return active_id;
 
     return insert_playlist_locked(active_id->index + 1);
@@ -897,7 +1153,10 @@ EXPORT void Playlist::reorder_playlists(int from, int to, int count)
 
 EXPORT void Playlist::remove_playlist() const
 {
-    ENTER_GET_PLAYLIST();
+    ENTER_LOOKUP_PLAYLIST();
+
+    /* wait for any readers; no more can find the playlist */
+    playlist->write_lock();
 
     int at = m_id->index;
     playlists.remove(at, 1);
@@ -936,7 +1195,7 @@ EXPORT void Playlist::set_filename(const char * filename) const
 
 EXPORT String Playlist::get_filename() const
 {
-    ENTER_GET_PLAYLIST(String());
+    ENTER_LOOKUP_PLAYLIST(String());
     return playlist->filename;
 }
 
@@ -952,22 +1211,52 @@ EXPORT void Playlist::set_title(const char * title) const
 
 EXPORT String Playlist::get_title() const
 {
-    ENTER_GET_PLAYLIST(String());
+    ENTER_LOOKUP_PLAYLIST(String());
     return playlist->title;
 }
 
+void PlaylistEx::set_deferred(const char * path, const char * title,
+                              int n_entries, int64_t total_length) const
+{
+    ENTER_LOOKUP_PLAYLIST();
+    auto wh = playlist->write_lock();
+
+    playlist->title = String(title);
+    playlist->modified = false;
+    auto deferred = new PlaylistData::Deferred();
+    deferred->path = String(path);
+    deferred->n_entries = n_entries;
+    deferred->total_length = total_length;
+    playlist->deferred.capture(deferred);
+
+    queue_global_update(Metadata);
+}
+
 void PlaylistEx::set_modified(bool modified) const
 {
     ENTER_GET_PLAYLIST();
     playlist->modified = modified;
+    playlist->reset_save_changes(modified);
 }
 
 bool PlaylistEx::get_modified() const
 {
-    ENTER_GET_PLAYLIST(false);
+    ENTER_LOOKUP_PLAYLIST(false);
+
+    /* don't save over a file that could not be loaded */
+    if (playlist->deferred && playlist->deferred->failed)
+        return false;
+
     return playlist->modified;
 }
 
+Playlist::Update PlaylistEx::take_save_changes(int & saved_len) const
+{
+    ENTER_GET_PLAYLIST(Update());
+    playlist->modified = false;
+    return playlist->take_save_changes(saved_len);
+}
+
 EXPORT void Playlist::activate() const
 {
     ENTER_GET_PLAYLIST();
@@ -1083,29 +1372,46 @@ EXPORT Playlist Playlist::temporary_playlist()
 EXPORT PluginHandle * Playlist::entry_decoder(int entry_num, GetMode mode,
                                               String * error) const
 {
-    ENTER_GET_PLAYLIST(nullptr);
-    wait_for_entry(mh, playlist, entry_num, (mode == Wait), false);
+    if (mode == NoWait)
+    {
+        READ_WRAPPER(PluginHandle *, nullptr, entry_decoder, entry_num, error);
+    }
+
+    ENTER_FIND_PLAYLIST(nullptr);
+    wait_for_entry(mh, playlist, entry_num, true, false);
     return playlist->entry_decoder(entry_num, error);
 }
 
 EXPORT Tuple Playlist::entry_tuple(int entry_num, GetMode mode,
                                    String * error) const
 {
-    ENTER_GET_PLAYLIST(Tuple());
-    wait_for_entry(mh, playlist, entry_num, false, (mode == Wait));
+    if (mode == NoWait)
+    {
+        READ_WRAPPER(Tuple, Tuple(), entry_tuple, entry_num, error);
+    }
+
+    ENTER_FIND_PLAYLIST(Tuple());
+    wait_for_entry(mh, playlist, entry_num, false, true);
     return playlist->entry_tuple(entry_num, error);
 }
 
 EXPORT void Playlist::rescan_file(const char * filename)
 {
+    metadata_cache_forget(filename);
+
     auto mh = mutex.take();
 
     for (auto & playlist : playlists)
+    {
+        auto wh = playlist->write_lock();
         playlist->reset_tuple_of_file(filename);
+    }
 }
 
-// called from playback thread
-DecodeInfo playback_entry_read(int serial)
+// called from playback thread; if the song has already been opened (by the
+// pre-roll thread) as <open_filename>, it is not opened again
+DecodeInfo playback_entry_read(int serial, const char * open_filename,
+                               PluginHandle * open_decoder)
 {
     auto mh = mutex.take();
     DecodeInfo dec;
@@ -1121,6 +1427,15 @@ DecodeInfo playback_entry_read(int serial)
         ScanRequest * request = item->request;
         item->handled_by_playback = true;
 
+        bool preopened = open_filename && request->filename == open_filename;
+        if (preopened)
+        {
+            if (!request->decoder)
+                request->decoder = open_decoder;
+
+            request->flags = (request->flags & ~SCAN_FILE) | SCAN_PLUGIN;
+        }
+
         mh.unlock();
         request->run();
         mh.lock();
@@ -1139,6 +1454,7 @@ DecodeInfo playback_entry_read(int serial)
             dec.ip = request->ip;
             dec.file = std::move(request->file);
             dec.error = std::move(request->error);
+            dec.preopened = preopened;
         }
 
         delete request;
@@ -1147,13 +1463,53 @@ DecodeInfo playback_entry_read(int serial)
     return dec;
 }
 
+// called from playback thread; guesses the song to be played after the current
+// one, so that it can be decoded ahead of time
+bool playback_entry_predict_next(int serial, String & filename,
+                                 PluginHandle *& decoder, Tuple & tuple)
+{
+    auto mh = mutex.take();
+
+    if (!playback_check_serial(serial))
+        return false;
+
+    // these are handled by end_cb() in playback.cc
+    if (aud_get_bool("no_playlist_advance") ||
+        aud_get_bool("stop_after_current_song"))
+        return false;
+
+    auto playlist = playing_id->data;
+    int pos = playlist->predict_next_song(aud_get_bool("repeat"));
+    if (pos < 0 || pos == playlist->position())
+        return false;
+
+    filename = playlist->entry_filename(pos);
+    decoder = playlist->entry_decoder(pos);
+    tuple = playlist->entry_tuple(pos);
+
+    return true;
+}
+
 // called from playback thread
 void playback_entry_set_tuple(int serial, Tuple && tuple)
 {
     auto mh = mutex.take();
 
     if (playback_check_serial(serial))
+    {
+        auto wh = playing_id->data->write_lock();
         playing_id->data->update_playback_entry(std::move(tuple));
+    }
+}
+
+static void save_shuffle_history(FILE * handle, const Index<int> & history)
+{
+    for (int i = 0; i < history.len(); i += 16)
+    {
+        int count = aud::min(16, history.len() - i);
+        auto list = int_array_to_str(&history[i], count);
+        fprintf(handle, "shuffle %s\n", (const char *)list);
+    }
 }
 
 void playlist_save_state()
@@ -1181,16 +1537,16 @@ void playlist_save_state()
         if (playlist->filename)
             fprintf(handle, "filename %s\n", (const char *)playlist->filename);
 
-        fprintf(handle, "position %d\n", playlist->position());
-
-        /* save shuffle history */
-        auto history = playlist->shuffle_history();
-
-        for (int i = 0; i < history.len(); i += 16)
+        /* save position and shuffle history */
+        if (playlist->deferred)
         {
-            int count = aud::min(16, history.len() - i);
-            auto list = int_array_to_str(&history[i], count);
-            fprintf(handle, "shuffle %s\n", (const char *)list);
+            fprintf(handle, "position %d\n", playlist->deferred->position);
+            save_shuffle_history(handle, playlist->deferred->shuffle_history);
+        }
+        else
+        {
+            fprintf(handle, "position %d\n", playlist->position());
+            save_shuffle_history(handle, playlist->shuffle_history());
         }
 
         /* resume state is stored per-playlist for historical reasons */
@@ -1204,9 +1560,8 @@ void playlist_save_state()
     fclose(handle);
 }
 
-void playlist_load_state()
+static void read_state_file()
 {
-    auto mh = mutex.take();
     int playlist_num;
 
     const char * user_dir = aud_get_path(AudPath::UserDir);
@@ -1233,6 +1588,7 @@ void playlist_load_state()
            playlist_num < playlists.len())
     {
         PlaylistData * playlist = playlists[playlist_num].get();
+        auto wh = playlist->write_lock();
 
         parser.next();
 
@@ -1243,7 +1599,11 @@ void playlist_load_state()
         int position = -1;
         if (parser.get_int("position", position))
         {
-            playlist->set_position(position);
+            if (playlist->deferred)
+                playlist->deferred->position = position;
+            else
+                playlist->set_position(position);
+
             parser.next();
         }
 
@@ -1257,7 +1617,9 @@ void playlist_load_state()
                 history.append(str_to_int(str));
         }
 
-        if (history.len())
+        if (playlist->deferred)
+            playlist->deferred->shuffle_history = std::move(history);
+        else if (history.len())
             playlist->shuffle_replay(history);
 
         /* resume state is stored per-playlist for historical reasons */
@@ -1278,20 +1640,29 @@ void playlist_load_state()
     }
 
     fclose(handle);
+}
+
+void playlist_load_state()
+{
+    auto mh = mutex.take();
+
+    read_state_file();
 
     /* set initial focus and selection */
     for (auto & playlist : playlists)
     {
-        int focus = playlist->position();
-        if (focus < 0 && playlist->n_entries())
-            focus = 0;
-
-        if (focus >= 0)
+        if (!playlist->deferred)
         {
-            playlist->set_focus(focus);
-            playlist->select_entry(focus, true);
+            auto wh = playlist->write_lock();
+            set_initial_focus(playlist.get());
         }
     }
+
+    /* the active and playing playlists are needed right away */
+    load_deferred(mh, active_id);
+
+    if (resume_playlist >= 0 && resume_playlist < playlists.len())
+        load_deferred(mh, playlists[resume_playlist]->id());
 }
 
 EXPORT void aud_resume()
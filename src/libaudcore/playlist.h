@@ -370,12 +370,32 @@ public:
     bool scan_in_progress() const;
     static bool scan_in_progress_any();
 
+    /* Returns the current state of the background scanner.  Local files and
+     * remote locations are scanned by separate groups of threads, each sized
+     * according to how long a scan takes and how much of that time is spent
+     * waiting for I/O, unless the "scan_threads" setting fixes the number. */
+    struct ScanStats
+    {
+        int local_threads, remote_threads;
+        float local_rate, remote_rate;  /* files scanned per second, recently */
+        int local_latency, remote_latency; /* average time per file, in ms */
+    };
+
+    static ScanStats scan_stats();
+
     /* --- UTILITY API --- */
 
     /* Sorts entries according to a preset scheme. */
     void sort_entries(SortType scheme) const;
     void sort_selected(SortType scheme) const;
 
+    /* Sorts entries according to several preset schemes, each one deciding
+     * only between entries that are equal according to the ones before it
+     * (for example: album artist, then date, then disc, then track).  Entries
+     * that are equal according to all the schemes keep their relative order. */
+    void sort_entries(const Index<SortType> & schemes) const;
+    void sort_selected(const Index<SortType> & schemes) const;
+
     /* Removes duplicate entries according to a preset scheme.
      * The current implementation also sorts the playlist. */
     void remove_duplicates(SortType scheme) const;
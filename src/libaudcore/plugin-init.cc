@@ -99,7 +99,7 @@ static bool start_plugin(PluginType type, PluginHandle * p,
     bool success;
 
     if (secondary)
-        success = output_plugin_set_secondary(p);
+        success = output_plugin_add_secondary(p);
     else if (table[type].is_single)
         success = table[type].f.s.set_current(p);
     else
@@ -170,12 +170,14 @@ static void start_plugins(PluginType type)
 
         if (type == PluginType::Output)
         {
-            PluginHandle * sel;
-            if ((sel = find_selected(type, PluginEnabled::Secondary)))
+            for (PluginHandle * p : aud_plugin_list(type))
             {
-                AUDINFO("Starting secondary output plugin %s.\n",
-                        aud_plugin_get_name(sel));
-                start_plugin(type, sel, true);
+                if (plugin_get_enabled(p) == PluginEnabled::Secondary)
+                {
+                    AUDINFO("Starting secondary output plugin %s.\n",
+                            aud_plugin_get_name(p));
+                    start_plugin(type, p, true);
+                }
             }
         }
     }
@@ -218,10 +220,16 @@ static void stop_plugins(PluginType type)
         AUDINFO("Shutting down %s.\n", aud_plugin_get_name(p));
         table[type].f.s.set_current(nullptr);
 
-        if (type == PluginType::Output && (p = output_plugin_get_secondary()))
+        if (type == PluginType::Output)
         {
-            AUDINFO("Shutting down %s.\n", aud_plugin_get_name(p));
-            output_plugin_set_secondary(nullptr);
+            for (PluginHandle * sec : aud_plugin_list(type))
+            {
+                if (plugin_get_enabled(sec) == PluginEnabled::Secondary)
+                {
+                    AUDINFO("Shutting down %s.\n", aud_plugin_get_name(sec));
+                    output_plugin_remove_secondary(sec);
+                }
+            }
         }
     }
     else if (table[type].f.m.stop)
@@ -341,10 +349,6 @@ bool plugin_enable_secondary(PluginHandle * plugin, bool enable)
 
     if (enable)
     {
-        PluginHandle * old;
-        if ((old = output_plugin_get_secondary()))
-            plugin_enable_secondary(old, false);
-
         AUDINFO("Enabling secondary output plugin %s.\n",
                 aud_plugin_get_name(plugin));
         plugin_set_enabled(plugin, PluginEnabled::Secondary);
@@ -355,7 +359,7 @@ bool plugin_enable_secondary(PluginHandle * plugin, bool enable)
         AUDINFO("Disabling secondary output plugin %s.\n",
                 aud_plugin_get_name(plugin));
         plugin_set_enabled(plugin, PluginEnabled::Disabled);
-        output_plugin_set_secondary(nullptr);
+        output_plugin_remove_secondary(plugin);
         return true;
     }
 }
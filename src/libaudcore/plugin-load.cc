@@ -56,6 +56,9 @@ bool plugin_check_flags(int flags)
         break;
     }
 
+    /* not a requirement */
+    flags &= ~PluginStateless;
+
     return !flags;
 }
 
@@ -47,8 +47,8 @@ struct PluginPreferences;
  * the API tables), increment _AUD_PLUGIN_VERSION *and* set
  * _AUD_PLUGIN_VERSION_MIN to the same value. */
 
-#define _AUD_PLUGIN_VERSION_MIN 48 /* 3.8-devel */
-#define _AUD_PLUGIN_VERSION 48     /* 3.8-devel */
+#define _AUD_PLUGIN_VERSION_MIN 49 /* 3.8-devel */
+#define _AUD_PLUGIN_VERSION 49     /* 3.8-devel */
 
 /* Default priority. */
 #define _AUD_PLUGIN_DEFAULT_PRIO 5
@@ -103,8 +103,9 @@ struct PluginPreferences;
 /* plugin flags */
 enum
 {
-    PluginGLibOnly = 0x1, // plugin requires GLib main loop
-    PluginQtOnly = 0x2    // plugin requires Qt main loop
+    PluginGLibOnly = 0x1,  // plugin requires GLib main loop
+    PluginQtOnly = 0x2,    // plugin requires Qt main loop
+    PluginStateless = 0x4  // effect plugin may process chunks in parallel
 };
 
 struct PluginInfo
@@ -289,7 +290,12 @@ public:
     /* Performs effect processing.  process() may modify the audio samples in
      * place and return a reference to the same buffer, or it may return a
      * reference to an internal working buffer.  The number of output samples
-     * need not be the same as the number of input samples. */
+     * need not be the same as the number of input samples.
+     *
+     * With the pipelined effect scheduler, process() is called from a worker
+     * thread dedicated to the plugin.  A plugin flagged PluginStateless keeps
+     * no state from one call to the next; its process() may be called from
+     * several threads at once and must process the audio in place. */
     virtual Index<float> & process(Index<float> & data) = 0;
 
     /* Optional.  A seek is taking place; any buffers should be discarded.
@@ -349,7 +355,12 @@ public:
          * to the second song in the file "somefile.sid".
          * 3. When one of the songs is played, Audacious opens the file and
          * calls play() with a file name modified in this way. */
-        FlagSubtunes = (1 << 1)
+        FlagSubtunes = (1 << 1),
+
+        /* Indicates that play() may be called for a second file while the
+         * first is still playing.  This allows the next song in the playlist
+         * to be decoded ahead of time for gapless playback. */
+        FlagConcurrent = (1 << 2)
     };
 
     struct InputInfo
@@ -461,6 +472,13 @@ protected:
      * been written (though it may not yet be heard by the user). */
     static void write_audio(const void * data, int length);
 
+    /* Like write_audio() above, but takes over a buffer of floating-point
+     * samples instead of copying it.  Can be used only if FMT_FLOAT was passed
+     * to open_audio(); otherwise the data is discarded.  On return, <data> is
+     * left empty, but may keep an allocation which can be reused for the next
+     * call. */
+    static void write_audio(Index<float> && data);
+
     /* Returns the current tuple for the stream. */
     static Tuple get_playback_tuple();
 
@@ -510,8 +528,10 @@ public:
 class LIBAUDCORE_PUBLIC VisPlugin : public DockablePlugin, public Visualizer
 {
 public:
-    constexpr VisPlugin(PluginInfo info, int type_mask)
-        : DockablePlugin(PluginType::Vis, info), Visualizer(type_mask)
+    constexpr VisPlugin(PluginInfo info, int type_mask, int fft_size = 512,
+                        int freq_bands = 0, int frame_rate = 30)
+        : DockablePlugin(PluginType::Vis, info),
+          Visualizer(type_mask, fft_size, freq_bands, frame_rate)
     {
     }
 };
@@ -0,0 +1,365 @@
+/*
+ * resample.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "internal.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "audio.h"
+#include "objects.h"
+#include "runtime.h"
+#include "threads.h"
+
+/* The output resampler converts the output of the effect plugins to the rate
+ * of an output stream that was opened at a different rate.  It is a polyphase
+ * windowed-sinc filter: the ratio of the two rates is reduced to lowest terms
+ * up/down, and each output frame is the dot product of a window of input
+ * frames with one of up precomputed phases of a Kaiser-windowed sinc.  The
+ * input is kept per channel so that the dot products run over contiguous
+ * memory, and they are computed with the GCC/Clang vector extensions (compiled
+ * to SSE on x86 and NEON on ARM). */
+typedef float v4sf __attribute__((vector_size(16)));
+
+/* a few filters are kept, so that going back and forth between the rates of a
+ * mixed playlist does not recompute them for every song */
+#define MAX_FILTERS 8
+
+/* for odd ratios, the phases are quantized; the timing stays exact */
+#define MAX_PHASES 1024
+#define MAX_TAPS 512
+
+struct QualityPreset
+{
+    int taps;       /* for upsampling; scaled up when downsampling */
+    double rolloff; /* cutoff as a fraction of the lower Nyquist frequency */
+    double beta;    /* Kaiser window parameter */
+};
+
+/* indexed by ResampleQuality; the rolloff is chosen so that the transition
+ * band of each window ends at the Nyquist frequency */
+static const QualityPreset presets[] = {
+    {16, 0.82, 5}, {64, 0.93, 7}, {128, 0.955, 9}};
+
+struct ResampleFilter
+{
+    int in_rate, out_rate;
+    ResampleQuality quality;
+    int up, down;       /* ratio of the rates, in lowest terms */
+    int phases, taps;   /* taps is a multiple of 8 */
+    Index<float> coefs; /* phases x taps, in input order */
+};
+
+static aud::mutex mutex;
+static Index<SmartPtr<ResampleFilter>> filters; /* most recently used last */
+
+static ResampleFilter * filter; /* null if not resampling */
+static int channels;
+static Index<float> history[AUD_MAX_CHANNELS]; /* per channel */
+static int pos;   /* first frame of the next window in history */
+static int phase; /* 0 <= phase < up */
+
+static Index<float> output, padding;
+
+static int gcd(int a, int b)
+{
+    while (b)
+    {
+        int c = a % b;
+        a = b;
+        b = c;
+    }
+
+    return a;
+}
+
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++)
+    {
+        double t = x / (2 * k);
+        term *= t * t;
+        sum += term;
+    }
+
+    return sum;
+}
+
+static double sinc(double x)
+{
+    return (fabs(x) < 1e-9) ? 1 : sin(M_PI * x) / (M_PI * x);
+}
+
+static ResampleFilter * create_filter(int in_rate, int out_rate,
+                                      ResampleQuality quality)
+{
+    const QualityPreset & preset = presets[(int)quality];
+    auto f = new ResampleFilter();
+
+    f->in_rate = in_rate;
+    f->out_rate = out_rate;
+    f->quality = quality;
+
+    int div = gcd(in_rate, out_rate);
+    f->up = out_rate / div;
+    f->down = in_rate / div;
+    f->phases = aud::min(f->up, MAX_PHASES);
+
+    /* when downsampling, the cutoff is lowered and the window widened to
+     * keep the same transition band in output terms */
+    double scale = aud::min(1.0, (double)f->up / f->down);
+    double cutoff = preset.rolloff * scale;
+
+    int taps = (int)ceil(preset.taps / scale);
+    f->taps = aud::min((taps + 7) & ~7, MAX_TAPS);
+
+    /* the window of phase p starts taps / 2 - 1 frames before the input frame
+     * preceding the output frame, which lies p / phases of a frame later */
+    int half = f->taps / 2;
+    double norm = bessel_i0(preset.beta);
+
+    f->coefs.resize(f->phases * f->taps);
+
+    for (int p = 0; p < f->phases; p++)
+    {
+        float * h = &f->coefs[p * f->taps];
+        double frac = (double)p / f->phases;
+        double sum = 0;
+
+        for (int k = 0; k < f->taps; k++)
+        {
+            double x = frac + half - 1 - k;
+            double r = aud::min(fabs(x) / half, 1.0);
+            double w = bessel_i0(preset.beta * sqrt(1 - r * r)) / norm;
+
+            h[k] = cutoff * sinc(cutoff * x) * w;
+            sum += h[k];
+        }
+
+        /* unity gain at DC for every phase */
+        for (int k = 0; k < f->taps; k++)
+            h[k] /= sum;
+    }
+
+    return f;
+}
+
+static ResampleFilter * get_filter(int in_rate, int out_rate,
+                                   ResampleQuality quality)
+{
+    for (int i = 0; i < filters.len(); i++)
+    {
+        ResampleFilter * f = filters[i].get();
+
+        if (f->in_rate == in_rate && f->out_rate == out_rate &&
+            f->quality == quality)
+        {
+            /* move to the end */
+            SmartPtr<ResampleFilter> ptr = std::move(filters[i]);
+            filters.remove(i, 1);
+            filters.append(std::move(ptr));
+            return f;
+        }
+    }
+
+    if (filters.len() == MAX_FILTERS)
+        filters.remove(0, 1);
+
+    auto f = create_filter(in_rate, out_rate, quality);
+    filters.append(SmartPtr<ResampleFilter>(f));
+    return f;
+}
+
+static void reset(aud::mutex::holder &)
+{
+    for (int c = 0; c < AUD_MAX_CHANNELS; c++)
+        history[c].clear();
+
+    /* zeros leading up to the first frame */
+    if (filter)
+    {
+        for (int c = 0; c < channels; c++)
+            history[c].insert(0, filter->taps / 2 - 1);
+    }
+
+    pos = 0;
+    phase = 0;
+}
+
+static float dot(const float * a, const float * b, int len)
+{
+    v4sf sum0 = {0, 0, 0, 0}, sum1 = {0, 0, 0, 0};
+
+    for (int i = 0; i < len; i += 8)
+    {
+        v4sf a0, a1, b0, b1;
+        memcpy(&a0, a + i, sizeof a0);
+        memcpy(&a1, a + i + 4, sizeof a1);
+        memcpy(&b0, b + i, sizeof b0);
+        memcpy(&b1, b + i + 4, sizeof b1);
+
+        sum0 += a0 * b0;
+        sum1 += a1 * b1;
+    }
+
+    v4sf sum = sum0 + sum1;
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+/* resamples the given interleaved input, appending to output */
+static void run(aud::mutex::holder &, const float * data, int frames)
+{
+    int old_len = history[0].len();
+
+    for (int c = 0; c < channels; c++)
+    {
+        history[c].resize(old_len + frames);
+
+        float * h = history[c].begin() + old_len;
+        for (int i = 0; i < frames; i++)
+            h[i] = data[i * channels + c];
+    }
+
+    int avail = old_len + frames;
+    int taps = filter->taps, up = filter->up, down = filter->down;
+
+    /* output frame n is ready once its window, which starts at
+     * pos + (phase + n * down) / up, fits in the history */
+    int64_t room = (int64_t)avail - taps - pos;
+    int count =
+        (room < 0) ? 0 : (int)(((room + 1) * up - phase - 1) / down + 1);
+
+    int out_len = output.len();
+    output.resize(out_len + count * channels);
+    float * out = &output[out_len];
+
+    for (int n = 0; n < count; n++)
+    {
+        int p = (filter->phases == up)
+                    ? phase
+                    : (int)((int64_t)phase * filter->phases / up);
+        const float * h = &filter->coefs[p * taps];
+
+        for (int c = 0; c < channels; c++)
+            *out++ = dot(h, &history[c][pos], taps);
+
+        phase += down;
+        pos += phase / up;
+        phase %= up;
+    }
+
+    /* when downsampling, the next window may start beyond the history */
+    int consumed = aud::min(pos, avail);
+
+    for (int c = 0; c < channels; c++)
+        history[c].remove(0, consumed);
+
+    pos -= consumed;
+}
+
+void resample_start(int new_channels, int in_rate, int out_rate,
+                    ResampleQuality quality)
+{
+    auto mh = mutex.take();
+
+    if (in_rate == out_rate)
+    {
+        filter = nullptr;
+        reset(mh);
+        return;
+    }
+
+    /* between songs of the same format, the audio continues seamlessly */
+    if (filter && new_channels == channels && filter->in_rate == in_rate &&
+        filter->out_rate == out_rate && filter->quality == quality)
+        return;
+
+    AUDINFO("Resampling output from %d to %d Hz.\n", in_rate, out_rate);
+
+    filter = get_filter(in_rate, out_rate, quality);
+    channels = new_channels;
+    reset(mh);
+}
+
+Index<float> & resample_process(Index<float> & data)
+{
+    auto mh = mutex.take();
+
+    if (!filter)
+        return data;
+
+    output.resize(0);
+    run(mh, data.begin(), data.len() / channels);
+    return output;
+}
+
+void resample_flush()
+{
+    auto mh = mutex.take();
+    reset(mh);
+}
+
+Index<float> & resample_finish(Index<float> & data, bool end_of_playlist)
+{
+    auto mh = mutex.take();
+
+    if (!filter)
+        return data;
+
+    output.resize(0);
+    run(mh, data.begin(), data.len() / channels);
+
+    /* at the end of the playlist, push out the last frames in the filter */
+    if (end_of_playlist)
+    {
+        padding.clear();
+        padding.insert(0, channels * (filter->taps / 2));
+        run(mh, padding.begin(), filter->taps / 2);
+        reset(mh);
+    }
+
+    return output;
+}
+
+int resample_adjust_delay(int delay)
+{
+    auto mh = mutex.take();
+
+    if (filter)
+    {
+        int frames = history[0].len() - pos - (filter->taps / 2 - 1);
+        delay += aud::rescale(aud::max(frames, 0), filter->in_rate, 1000);
+    }
+
+    return delay;
+}
+
+void resample_cleanup()
+{
+    auto mh = mutex.take();
+
+    filter = nullptr;
+    reset(mh);
+
+    filters.clear();
+    output.clear();
+    padding.clear();
+}
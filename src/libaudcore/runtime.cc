@@ -44,6 +44,7 @@
 #include "hook.h"
 #include "internal.h"
 #include "mainloop.h"
+#include "metadata-cache.h"
 #include "output.h"
 #include "playlist-internal.h"
 #include "plugins-internal.h"
@@ -315,11 +316,13 @@ EXPORT void aud_init()
     chardet_init();
     eq_init();
     output_init();
+    playback_init();
     playlist_init();
 
     start_plugins_one();
 
     record_init();
+    metadata_cache_init();
     scanner_init();
     load_playlists();
 }
@@ -362,14 +365,19 @@ EXPORT void aud_cleanup()
 
     adder_cleanup();
     scanner_cleanup();
+    metadata_cache_cleanup();
     record_cleanup();
 
     stop_plugins_one();
 
     art_cleanup();
     chardet_cleanup();
+    effect_cleanup();
     eq_cleanup();
+    fft_cleanup();
     output_cleanup();
+    resample_cleanup();
+    playback_cleanup();
     playlist_end();
 
     event_queue_cancel_all();
@@ -56,6 +56,23 @@ enum class OutputStream
     AfterEqualizer
 };
 
+/* what to do when the secondary (recording) output cannot keep up */
+enum class RecordOverflow
+{
+    Block, /* the primary output waits */
+    Drop,  /* audio is dropped from the recording */
+    Grow   /* the queue is enlarged, up to a limit */
+};
+
+/* filter length of the resampler used when the output stream is opened at a
+ * different sample rate than that of the audio */
+enum class ResampleQuality
+{
+    Fast,
+    Medium,
+    Best
+};
+
 enum class ReplayGainMode
 {
     Track,
@@ -200,6 +217,9 @@ String aud_history_get(int entry);
 void aud_history_add(const char * path);
 void aud_history_clear();
 
+/* OutputReset::ResetPlugin also discards the list of formats that are known to
+ * work (or not) with the current output plugin, so output plugins should use
+ * it when the audio device is changed. */
 void aud_output_reset(OutputReset type);
 
 #endif
@@ -20,17 +20,153 @@
 #include "scanner.h"
 
 #include <glib.h> /* for GThreadPool */
+#include <string.h>
+#include <time.h>
+
+#include <thread>
 
 #include "audstrings.h"
 #include "cue-cache.h"
 #include "i18n.h"
 #include "internal.h"
+#include "metadata-cache.h"
+#include "playlist.h"
 #include "plugins.h"
 #include "probe.h"
+#include "runtime.h"
+#include "threads.h"
 #include "tuple.h"
 #include "vfs.h"
 
-static GThreadPool * pool;
+/* Local files and remote locations are scanned by separate thread pools, since
+ * they behave very differently: a scan of a file on a fast local disk is mostly
+ * CPU time, so there is no point in running many more threads than there are
+ * cores, while a scan over the network is mostly spent waiting and benefits
+ * from many requests in flight.  (A network share mounted locally looks like a
+ * local file, so the local limit is still generous.)
+ *
+ * Every second or so, each pool estimates from the scans just finished how many
+ * threads it would take to keep the CPU busy: the number of cores, times the
+ * ratio of the time taken by a scan to the CPU time it used.  It then moves
+ * toward that number, at most doubling or halving at a time.  It only grows if
+ * requests were actually kept waiting, and not while the process is already
+ * using most of the CPU. */
+#define MIN_LOCAL_THREADS 1
+#define MAX_LOCAL_THREADS 16
+#define DEFAULT_LOCAL_THREADS 2
+#define MIN_REMOTE_THREADS 2
+#define MAX_REMOTE_THREADS 32
+#define DEFAULT_REMOTE_THREADS 4
+
+#define ADAPT_INTERVAL 1000000 /* microseconds */
+#define ADAPT_MIN_SAMPLES 4
+#define CPU_BUSY 0.9
+
+struct ScanPool
+{
+    constexpr ScanPool(const char * name, int min_threads, int max_threads)
+        : name(name), min_threads(min_threads), max_threads(max_threads)
+    {
+    }
+
+    const char * name;
+    int min_threads, max_threads;
+    int threads = 0;
+
+    GThreadPool * pool = nullptr;
+
+    /* current measurement window */
+    int64_t window_start = 0, window_cpu = 0;
+    int completed = 0;
+    int64_t latency_sum = 0, cpu_sum = 0;
+    bool saturated = false;
+
+    /* results of the last window */
+    float rate = 0;
+    int latency = 0;
+};
+
+static aud::mutex mutex;
+static ScanPool local_pool("local", MIN_LOCAL_THREADS, MAX_LOCAL_THREADS);
+static ScanPool remote_pool("remote", MIN_REMOTE_THREADS, MAX_REMOTE_THREADS);
+
+static ConfigHandle<int> scan_threads("scan_threads");
+static int applied_override; /* 0 = automatic */
+static int n_cpus;
+
+static int64_t cpu_time(clockid_t clock)
+{
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) < 0)
+        return 0;
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static ScanPool & pool_for(const char * filename)
+{
+    /* cuesheet entries and subtunes are still file:// URIs */
+    return strncmp(filename, "file://", 7) ? remote_pool : local_pool;
+}
+
+static void set_threads(aud::mutex::holder &, ScanPool & p, int threads)
+{
+    threads = aud::clamp(threads, p.min_threads, p.max_threads);
+    if (threads == p.threads)
+        return;
+
+    AUDINFO("Using %d threads to scan %s files.\n", threads, p.name);
+
+    p.threads = threads;
+    g_thread_pool_set_max_threads(p.pool, threads, nullptr);
+}
+
+static void reset_window(aud::mutex::holder &, ScanPool & p, int64_t now)
+{
+    p.window_start = now;
+    p.window_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    p.completed = 0;
+    p.latency_sum = 0;
+    p.cpu_sum = 0;
+    p.saturated = false;
+}
+
+static void adapt(aud::mutex::holder & mh, ScanPool & p, int64_t now)
+{
+    int64_t elapsed = now - p.window_start;
+    int64_t process_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - p.window_cpu;
+
+    p.rate = p.completed * 1000000.0f / elapsed;
+    p.latency = p.latency_sum / p.completed / 1000;
+
+    if (!applied_override)
+    {
+        int64_t latency = p.latency_sum / p.completed;
+        int64_t cpu = aud::max(p.cpu_sum / p.completed, (int64_t)1);
+        int64_t target = (n_cpus * latency + cpu - 1) / cpu;
+        bool cpu_busy = (process_cpu >= CPU_BUSY * n_cpus * elapsed);
+
+        if (target > p.threads && p.saturated && !cpu_busy)
+            set_threads(mh, p, aud::min(target, (int64_t)p.threads * 2));
+        else if (target < p.threads)
+            set_threads(mh, p, aud::max(target, (int64_t)p.threads / 2));
+    }
+
+    reset_window(mh, p, now);
+}
+
+static void check_override(aud::mutex::holder & mh)
+{
+    int fixed = aud::max(scan_threads.get(), 0);
+    if (fixed == applied_override)
+        return;
+
+    applied_override = fixed;
+
+    /* when switching back to automatic, start over from the defaults */
+    set_threads(mh, local_pool, fixed ? fixed : DEFAULT_LOCAL_THREADS);
+    set_threads(mh, remote_pool, fixed ? fixed : DEFAULT_REMOTE_THREADS);
+}
 
 ScanRequest::ScanRequest(const String & filename, int flags, Callback callback,
                          PluginHandle * decoder, Tuple && tuple)
@@ -73,16 +209,44 @@ void ScanRequest::run()
     bool need_tuple = (flags & SCAN_TUPLE) && !tuple.valid();
     bool need_image = (flags & SCAN_IMAGE);
 
+    /* consult the metadata cache before touching the file (cuesheet entries
+     * are read from the cuesheet instead) */
+    MetadataCacheItem cached = MetadataCacheItem();
+    bool cacheable = !cue_cache && metadata_cache_stat(filename, cached);
+
+    if (cacheable && (!decoder || need_tuple || need_image) &&
+        metadata_cache_lookup(filename, cached))
+    {
+        if (!decoder)
+            decoder = cached.decoder;
+
+        if (need_tuple)
+        {
+            tuple = cached.tuple.ref();
+            need_tuple = false;
+        }
+
+        if (need_image && cached.art == EmbeddedArt::None)
+        {
+            image_file = art_search(audio_file);
+            need_image = false;
+        }
+    }
+
     if (!decoder)
         decoder = aud_file_find_decoder(audio_file, false, file, &error);
     if (!decoder)
         goto err;
 
-    if (need_tuple || need_image)
+    /* the input plugin is needed for playback even if nothing is read */
+    if (need_tuple || need_image || (flags & (SCAN_PLUGIN | SCAN_FILE)))
     {
         if (!(ip = load_input_plugin(decoder, &error)))
             goto err;
+    }
 
+    if (need_tuple || need_image)
+    {
         Tuple dummy_tuple;
         /* don't overwrite tuple if already valid (e.g. from a cuesheet) */
         Tuple & rtuple = need_tuple ? tuple : dummy_tuple;
@@ -93,6 +257,18 @@ void ScanRequest::run()
 
         if (need_image && !image_data.len())
             image_file = art_search(audio_file);
+
+        if (cacheable && (need_tuple || cached.tuple.valid()))
+        {
+            cached.decoder = decoder;
+            if (need_tuple)
+                cached.tuple = tuple.ref();
+            if (need_image)
+                cached.art = image_data.len() ? EmbeddedArt::Present
+                                              : EmbeddedArt::None;
+
+            metadata_cache_store(filename, cached);
+        }
     }
 
     /* rewind/reopen the input file */
@@ -108,21 +284,90 @@ void ScanRequest::run()
     callback(this);
 }
 
-static void scan_worker(void * data, void *)
+static void scan_worker(void * data, void * pool_)
 {
-    ((ScanRequest *)data)->run();
-    delete (ScanRequest *)data;
+    auto request = (ScanRequest *)data;
+    auto & p = *(ScanPool *)pool_;
+
+    int64_t start = g_get_monotonic_time();
+    int64_t start_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+
+    request->run();
+    delete request;
+
+    int64_t now = g_get_monotonic_time();
+    int64_t cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - start_cpu;
+
+    auto mh = mutex.take();
+
+    p.completed++;
+    p.latency_sum += now - start;
+    p.cpu_sum += cpu;
+
+    if (g_thread_pool_unprocessed(p.pool) > 0)
+        p.saturated = true;
+
+    if (now - p.window_start >= ADAPT_INTERVAL &&
+        p.completed >= ADAPT_MIN_SAMPLES)
+        adapt(mh, p, now);
+}
+
+static void pool_init(aud::mutex::holder & mh, ScanPool & p, int threads)
+{
+    p.threads = aud::clamp(threads, p.min_threads, p.max_threads);
+    p.pool = g_thread_pool_new(scan_worker, &p, p.threads, false, nullptr);
+    p.rate = 0;
+    p.latency = 0;
+
+    reset_window(mh, p, g_get_monotonic_time());
 }
 
 void scanner_init()
 {
-    pool =
-        g_thread_pool_new(scan_worker, nullptr, SCAN_THREADS, false, nullptr);
+    scan_threads.connect();
+
+    auto mh = mutex.take();
+
+    n_cpus = aud::max((int)std::thread::hardware_concurrency(), 1);
+    applied_override = aud::max(scan_threads.get(), 0);
+
+    int fixed = applied_override;
+    pool_init(mh, local_pool, fixed ? fixed : DEFAULT_LOCAL_THREADS);
+    pool_init(mh, remote_pool, fixed ? fixed : DEFAULT_REMOTE_THREADS);
 }
 
 void scanner_request(ScanRequest * request)
 {
-    g_thread_pool_push(pool, request, nullptr);
+    auto mh = mutex.take();
+
+    check_override(mh);
+
+    /* time spent idle does not count */
+    ScanPool & p = pool_for(request->filename);
+    if (!g_thread_pool_get_num_threads(p.pool) &&
+        !g_thread_pool_unprocessed(p.pool))
+        reset_window(mh, p, g_get_monotonic_time());
+
+    g_thread_pool_push(p.pool, request, nullptr);
+}
+
+int scanner_max_pending()
+{
+    auto mh = mutex.take();
+    return 2 * (local_pool.threads + remote_pool.threads);
+}
+
+EXPORT Playlist::ScanStats Playlist::scan_stats()
+{
+    auto mh = mutex.take();
+    return {local_pool.threads, remote_pool.threads, local_pool.rate,
+            remote_pool.rate,   local_pool.latency,  remote_pool.latency};
 }
 
-void scanner_cleanup() { g_thread_pool_free(pool, false, true); }
+void scanner_cleanup()
+{
+    g_thread_pool_free(local_pool.pool, false, true);
+    g_thread_pool_free(remote_pool.pool, false, true);
+
+    scan_threads.disconnect();
+}
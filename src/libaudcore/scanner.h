@@ -32,15 +32,14 @@ class PluginHandle;
 #define SCAN_TUPLE (1 << 0)
 #define SCAN_IMAGE (1 << 1)
 #define SCAN_FILE (1 << 2)
-
-#define SCAN_THREADS 2
+#define SCAN_PLUGIN (1 << 3) /* load the input plugin (implied by SCAN_FILE) */
 
 struct ScanRequest
 {
     typedef void (*Callback)(ScanRequest * request);
 
     const String filename;
-    const int flags;
+    int flags; /* may be changed until the request is run */
     const Callback callback;
 
     PluginHandle * decoder;
@@ -68,4 +67,8 @@ void scanner_init();
 void scanner_request(ScanRequest * request);
 void scanner_cleanup();
 
+/* the number of requests that should be pending at once, to keep all threads
+ * busy and let the scanner see whether it could use more */
+int scanner_max_pending();
+
 #endif
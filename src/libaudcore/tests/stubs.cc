@@ -1,14 +1,94 @@
 #include "internal.h"
+#include "playlist-internal.h"
+#include "probe.h"
+#include "runtime.h"
 #include "vfs.h"
 
+#include <string.h>
+
 extern "C" const char * libguess_determine_encoding(const char *, int,
                                                     const char *)
 {
     return nullptr;
 }
 
-bool aud_get_bool(const char *, const char *) { return false; }
+// gapless pre-roll is enabled for test-playback.cc, and shuffle for
+// test-playlist-data.cc
+bool aud_get_bool(const char *, const char * name)
+{
+    return !strcmp(name, "gapless_preroll") || !strcmp(name, "shuffle");
+}
+
+int aud_get_int(const char *, const char * name)
+{
+    return !strcmp(name, "preroll_seconds") ? 1 : 0;
+}
+
 String aud_get_str(const char *, const char *) { return String(""); }
 String VFSFile::get_metadata(const char *) { return String(); }
 
+template<>
+void ConfigHandle<bool>::connect()
+{
+    m_value = aud_get_bool(nullptr, m_name);
+}
+
+template<>
+void ConfigHandle<int>::connect()
+{
+    m_value = aud_get_int(nullptr, m_name);
+}
+
+template<class T>
+void ConfigHandle<T>::disconnect()
+{
+}
+
+template class ConfigHandle<bool>;
+template class ConfigHandle<int>;
+
+// test input plugins are passed around as their own handles
+InputPlugin * load_input_plugin(PluginHandle * decoder, String *)
+{
+    return (InputPlugin *)decoder;
+}
+
 size_t misc_bytes_allocated;
+
+// a single playlist, filled in by test-playlist-store.cc; the playback in
+// test-playback.cc never reaches end_cb(), which would play the next entry
+Index<PlaylistAddItem> test_entries;
+String test_title;
+Playlist::Update test_changes;
+int test_saved_len;
+
+Playlist Playlist::playing_playlist() { return Playlist(); }
+int Playlist::get_position() const { return -1; }
+void Playlist::set_position(int) const {}
+bool Playlist::next_song(bool) const { return false; }
+
+int Playlist::n_entries() const { return test_entries.len(); }
+String Playlist::get_title() const { return test_title; }
+
+String Playlist::entry_filename(int entry) const
+{
+    return test_entries[entry].filename;
+}
+
+PluginHandle * Playlist::entry_decoder(int entry, GetMode, String *) const
+{
+    return test_entries[entry].decoder;
+}
+
+Tuple Playlist::entry_tuple(int entry, GetMode, String *) const
+{
+    return test_entries[entry].tuple.ref();
+}
+
+Playlist::Update PlaylistEx::take_save_changes(int & saved_len) const
+{
+    saved_len = test_saved_len;
+    return test_changes;
+}
+
+void PlaylistEx::set_modified(bool) const {}
@@ -0,0 +1,312 @@
+/*
+ * test-playback.cc - Gapless pre-roll test for libaudcore
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "drct.h"
+#include "hook.h"
+#include "interface.h"
+#include "internal.h"
+#include "output.h"
+#include "playlist-internal.h"
+#include "plugin.h"
+#include "runtime.h"
+#include "threads.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+// playback.cc is run with the playlist and the output replaced by the stubs
+// below; songs are "test://<n>", and are 2 seconds of samples equal to <n>, at
+// 1000 Hz so that one sample is one millisecond
+
+#define RATE 1000
+#define SONG_LENGTH 2000
+#define BLOCK 100
+
+static aud::mutex mutex;
+static aud::condvar cond;
+
+static const char * playing_song;
+static const char * next_song;
+static String open_filename; // as passed to playback_entry_read()
+
+static bool slow_blocked, slow_released, slow_finished;
+
+static Index<float> output;
+static int output_time, n_closed, n_moved;
+
+static const char * const schemes[] = {"test", nullptr};
+
+class SongInput : public InputPlugin
+{
+public:
+    constexpr SongInput()
+        : InputPlugin({"Test"},
+                      InputInfo(FlagConcurrent).with_schemes(schemes))
+    {
+    }
+
+    bool is_our_file(const char *, VFSFile &) { return true; }
+    bool read_tag(const char *, VFSFile &, Tuple &, Index<char> *)
+    {
+        return true;
+    }
+
+    bool play(const char * filename, VFSFile &)
+    {
+        // "test://slow" is stuck, as if opening a network stream
+        if (!strcmp(filename, "test://slow"))
+        {
+            auto mh = mutex.take();
+            slow_blocked = true;
+            cond.notify_all();
+
+            while (!slow_released)
+                cond.wait(mh);
+
+            slow_finished = true;
+            cond.notify_all();
+            return true;
+        }
+
+        float value = atoi(filename + 7);
+        open_audio(FMT_FLOAT, RATE, 1);
+
+        for (int i = 0; i < SONG_LENGTH && !check_stop(); i += BLOCK)
+        {
+            float block[BLOCK];
+            for (float & sample : block)
+                sample = value;
+
+            write_audio(block, sizeof block);
+        }
+
+        return true;
+    }
+};
+
+static SongInput song_input;
+
+// stubs.cc takes plugin handles to be the plugins themselves
+#define TEST_DECODER ((PluginHandle *)&song_input)
+
+static Tuple song_tuple(const char * filename)
+{
+    Tuple tuple;
+    tuple.set_filename(filename);
+    tuple.set_int(Tuple::Length, SONG_LENGTH);
+    tuple.set_state(Tuple::Valid);
+    return tuple;
+}
+
+DecodeInfo playback_entry_read(int serial, const char * open_filename_,
+                               PluginHandle *)
+{
+    DecodeInfo dec;
+    if (!playback_check_serial(serial))
+        return dec;
+
+    {
+        auto mh = mutex.take();
+        open_filename = String(open_filename_);
+    }
+
+    playback_set_info(0, song_tuple(playing_song));
+
+    dec.filename = String(playing_song);
+    dec.ip = &song_input;
+    dec.preopened = open_filename_ && !strcmp(open_filename_, playing_song);
+    return dec;
+}
+
+bool playback_entry_predict_next(int serial, String & filename,
+                                 PluginHandle *& decoder, Tuple & tuple)
+{
+    if (!next_song || !playback_check_serial(serial))
+        return false;
+
+    filename = String(next_song);
+    decoder = TEST_DECODER;
+    tuple = song_tuple(next_song);
+    return true;
+}
+
+void playback_entry_set_tuple(int, Tuple &&) {}
+
+bool output_open_audio(const String &, const Tuple &, int format, int rate,
+                       int channels, int, bool)
+{
+    assert(format == FMT_FLOAT && rate == RATE && channels == 1);
+
+    auto mh = mutex.take();
+    output_time = 0;
+    return true;
+}
+
+bool output_write_audio(const void * data, int size, int)
+{
+    int samples = size / sizeof(float);
+
+    auto mh = mutex.take();
+    output.insert((const float *)data, -1, samples);
+    output_time += samples * 1000 / RATE;
+    return true;
+}
+
+bool output_write_audio(Index<float> && data, int)
+{
+    auto mh = mutex.take();
+    output_time += data.len() * 1000 / RATE;
+    output.move_from(data, 0, -1, -1, true, true);
+    n_moved++;
+    return true;
+}
+
+int output_get_time()
+{
+    auto mh = mutex.take();
+    return output_time;
+}
+
+void output_close_audio()
+{
+    auto mh = mutex.take();
+    n_closed++;
+    cond.notify_all();
+}
+
+void output_set_tuple(const Tuple &) {}
+void output_set_replay_gain(const ReplayGainInfo &) {}
+void output_flush(int, bool) {}
+void output_resume() {}
+void output_pause(bool) {}
+void output_drain() {}
+
+void event_queue(const char *, void *, EventDestroyFunc) {}
+void event_queue_cancel(const char *, void *) {}
+void aud_set_bool(const char *, const char *, bool) {}
+void aud_ui_show_error(const char *) {}
+void aud_drct_stop() {}
+
+// waits (for at most 10 seconds) until the given number of songs is done
+static void wait_for_songs(int songs)
+{
+    auto mh = mutex.take();
+    auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    while (n_closed < songs)
+    {
+        auto status = cond.wait_until(mh, timeout);
+        assert(status == std::cv_status::no_timeout);
+    }
+}
+
+static void check_song(int start, int value)
+{
+    assert(output.len() >= start + SONG_LENGTH);
+
+    for (int i = start; i < start + SONG_LENGTH; i++)
+        assert(output[i] == value);
+}
+
+static void reset()
+{
+    output.clear();
+    n_closed = n_moved = 0;
+    open_filename = String();
+}
+
+static void test_preroll_promoted()
+{
+    reset();
+
+    // song 2 is pre-rolled during the last second of song 1
+    playing_song = "test://1";
+    next_song = "test://2";
+    playback_play(0, false);
+    wait_for_songs(1);
+
+    // when song 2 comes up, the pre-roll is used: the file is not opened again
+    // and the decoded second is handed to the output by move
+    playing_song = "test://2";
+    next_song = nullptr;
+    playback_play(0, false);
+    wait_for_songs(2);
+
+    playback_stop();
+
+    assert(open_filename && !strcmp(open_filename, "test://2"));
+    assert(n_moved == 1);
+    assert(output.len() == 2 * SONG_LENGTH);
+    check_song(0, 1);
+    check_song(SONG_LENGTH, 2);
+}
+
+static void test_preroll_cancelled()
+{
+    reset();
+
+    // the pre-roll of "test://slow" gets stuck
+    playing_song = "test://1";
+    next_song = "test://slow";
+    playback_play(0, false);
+    wait_for_songs(1);
+
+    {
+        auto mh = mutex.take();
+        while (!slow_blocked)
+            cond.wait(mh);
+    }
+
+    // another song is picked instead; cancelling the pre-roll does not wait
+    // for the stuck thread
+    playing_song = "test://3";
+    next_song = nullptr;
+    playback_play(0, false);
+    wait_for_songs(2);
+
+    assert(!open_filename);
+    assert(!n_moved);
+    assert(output.len() == 2 * SONG_LENGTH);
+    check_song(0, 1);
+    check_song(SONG_LENGTH, 3);
+
+    {
+        auto mh = mutex.take();
+        assert(!slow_finished);
+        slow_released = true;
+        cond.notify_all();
+    }
+
+    // at exit, the cancelled pre-roll thread is waited for
+    playback_stop(true);
+    assert(slow_finished);
+}
+
+void test_playback()
+{
+    playback_init();
+
+    test_preroll_promoted();
+    test_preroll_cancelled();
+
+    playback_cleanup();
+}
@@ -0,0 +1,326 @@
+/*
+ * test-playlist-data.cc - Playlist data test for libaudcore
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "audstrings.h"
+#include "playlist-data.h"
+#include "playlist-internal.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// PlaylistData is used directly, with the signals going nowhere; shuffle is
+// enabled by stubs.cc
+
+void pl_signal_entry_deleted(PlaylistEntry *) {}
+void pl_signal_position_changed(Playlist::ID *) {}
+void pl_signal_update_queued(Playlist::ID *, Playlist::UpdateLevel, int) {}
+void pl_signal_rescan_needed(Playlist::ID *) {}
+void pl_signal_playlist_deleted(Playlist::ID *) {}
+
+void metadata_cache_forget(const char *) {}
+
+static Index<PlaylistAddItem> make_items(int first, int count)
+{
+    Index<PlaylistAddItem> items;
+
+    for (int i = first; i < first + count; i++)
+        items.append(String(str_printf("file:///%d.ogg", i)), Tuple(),
+                     nullptr);
+
+    return items;
+}
+
+// the number in the filename of an entry, which does not change when entries
+// are added or removed before it
+static int entry_id(const PlaylistData & playlist, int entry)
+{
+    return atoi(playlist.entry_filename(entry) + 8);
+}
+
+static Index<int> history_ids(const PlaylistData & playlist)
+{
+    Index<int> ids;
+    for (int entry : playlist.shuffle_history())
+        ids.append(entry_id(playlist, entry));
+
+    return ids;
+}
+
+static bool same_ids(const Index<int> & a, const Index<int> & b)
+{
+    return a.len() == b.len() && !memcmp(a.begin(), b.begin(), a.len() * 4);
+}
+
+// plays through the entries not yet played; each must come up exactly once,
+// and be added to the end of the history
+static void play_rest(PlaylistData & playlist)
+{
+    Index<int> history = history_ids(playlist);
+    Index<bool> played;
+    played.insert(0, 1000);
+
+    for (int id : history)
+        played[id] = true;
+
+    while (playlist.next_song(false))
+    {
+        int id = entry_id(playlist, playlist.position());
+        assert(!played[id]);
+        played[id] = true;
+        history.append(id);
+
+        assert(same_ids(history_ids(playlist), history));
+    }
+
+    assert(history.len() == playlist.n_entries());
+}
+
+static void test_shuffle()
+{
+    Playlist::ID * id = nullptr;
+    PlaylistData playlist(id, "Test");
+    playlist.insert_items(0, make_items(0, 20));
+
+    // the whole playlist is played once
+    play_rest(playlist);
+    Index<int> history = history_ids(playlist);
+    assert(history.len() == 20);
+
+    // going back and forth follows the history
+    for (int i = 19; i > 0; i--)
+    {
+        bool moved = playlist.prev_song();
+        assert(moved && entry_id(playlist, playlist.position()) ==
+                            history[i - 1]);
+    }
+
+    assert(!playlist.prev_song());
+
+    for (int i = 1; i < 20; i++)
+    {
+        bool moved = playlist.next_song(false);
+        assert(moved && entry_id(playlist, playlist.position()) == history[i]);
+    }
+
+    assert(same_ids(history_ids(playlist), history));
+
+    // added entries are played before the playlist runs out again, and the
+    // history is unchanged although the entries after them are renumbered
+    playlist.insert_items(5, make_items(100, 10));
+    assert(same_ids(history_ids(playlist), history));
+    play_rest(playlist);
+    history = history_ids(playlist);
+    assert(history.len() == 30);
+
+    // removed entries leave the history, which otherwise stays in order
+    Index<bool> removed;
+    removed.insert(0, 1000);
+    for (int i = 0; i < 10; i++)
+        removed[entry_id(playlist, i)] = true;
+
+    playlist.remove_entries(0, 10);
+
+    Index<int> remaining;
+    for (int id : history)
+    {
+        if (!removed[id])
+            remaining.append(id);
+    }
+
+    assert(same_ids(history_ids(playlist), remaining));
+
+    // playing an entry directly moves it to the end of the history
+    int entry = playlist.shuffle_history()[3];
+    int moved_id = entry_id(playlist, entry);
+    playlist.set_position(entry);
+
+    remaining.remove(3, 1);
+    remaining.append(moved_id);
+    assert(same_ids(history_ids(playlist), remaining));
+
+    // the removed entries are not played yet if they are added back
+    playlist.insert_items(0, make_items(0, 5));
+    playlist.insert_items(5, make_items(100, 5));
+    play_rest(playlist);
+
+    // the history can be saved and replayed
+    Index<int> saved = playlist.shuffle_history();
+    history = history_ids(playlist);
+
+    Index<PlaylistAddItem> items;
+    for (int i = 0; i < playlist.n_entries(); i++)
+        items.append(playlist.entry_filename(i), Tuple(), nullptr);
+
+    PlaylistData copy(id, "Copy");
+    copy.insert_items(0, std::move(items));
+    copy.shuffle_replay(saved);
+    assert(same_ids(history_ids(copy), history));
+
+    // repeating starts the shuffle order over
+    bool moved = playlist.next_song(true);
+    assert(moved && playlist.shuffle_history().len() == 1);
+    play_rest(playlist);
+}
+
+static const char * const sort_strings[] = {
+    nullptr,   "",          "a",        "A",         "b",      "B1",
+    "b2",      "b10",       "b010",     "b01",       "b0",     "b00",
+    "10",      "9",         "09",       "0",         "a0b",    "a00b",
+    "a 2",     "a  2",      "a/2",      "a:2",       "track 2", "Track 10",
+    "track 1", "track 1a",  "track 01b", "123456789", "1234567", "\xc3\xa9",
+    "e",       "\xc3\xa9t\xc3\xa9", "~", "a~", "a9~", "a10~"};
+
+static PlaylistData::CompareData make_compare(
+    const Index<PlaylistSortKey> & keys)
+{
+    PlaylistData::CompareData data = PlaylistData::CompareData();
+    data.column = PlaylistData::NoColumn;
+    data.keys = &keys;
+    return data;
+}
+
+// sorts by a title (kept in a column) and a comment (read from the tuple)
+static void test_sort_keys()
+{
+    // enough entries to be sorted by several threads, given several CPUs
+    int n_strings = aud::n_elems(sort_strings);
+    int n_entries = 12000;
+
+    // each string is used as a title and as a comment, in random order
+    Index<PlaylistAddItem> items;
+    for (int i = 0; i < n_entries; i++)
+    {
+        const char * title = sort_strings[rand() % n_strings];
+        const char * comment = sort_strings[rand() % n_strings];
+
+        Tuple tuple;
+        tuple.set_filename(str_printf("file:///%d.ogg", i));
+        if (title)
+            tuple.set_str(Tuple::Title, title);
+        if (comment)
+            tuple.set_str(Tuple::Comment, comment);
+        tuple.set_state(Tuple::Valid);
+
+        items.append(String(str_printf("file:///%d.ogg", i)),
+                     std::move(tuple), nullptr);
+    }
+
+    Playlist::ID * id = nullptr;
+    PlaylistData playlist(id, "Test");
+    playlist.insert_items(0, std::move(items));
+
+    Index<PlaylistSortKey> keys;
+    keys.append(nullptr, Tuple::Title);
+    keys.append(nullptr, Tuple::Comment);
+
+    playlist.sort(make_compare(keys));
+
+    // the order must agree with str_compare(), and be stable
+    for (int i = 1; i < n_entries; i++)
+    {
+        Tuple a = playlist.entry_tuple(i - 1);
+        Tuple b = playlist.entry_tuple(i);
+
+        int cmp = str_compare(a.get_str(Tuple::Title), b.get_str(Tuple::Title));
+        if (!cmp)
+            cmp = str_compare(a.get_str(Tuple::Comment),
+                              b.get_str(Tuple::Comment));
+        if (!cmp)
+            cmp = entry_id(playlist, i - 1) - entry_id(playlist, i);
+
+        assert(cmp < 0);
+    }
+
+    // the same for every pair of strings, one entry each (the titles are
+    // made up from the filenames, so only the comments are compared)
+    keys.remove(0, 1);
+
+    for (int i = 0; i < n_strings; i++)
+    {
+        for (int j = 0; j < n_strings; j++)
+        {
+            Index<PlaylistAddItem> pair;
+            for (int k : {i, j})
+            {
+                Tuple tuple;
+                tuple.set_filename(str_printf("file:///%d.ogg", k));
+                if (sort_strings[k])
+                    tuple.set_str(Tuple::Comment, sort_strings[k]);
+                tuple.set_state(Tuple::Valid);
+
+                pair.append(String(str_printf("file:///%d.ogg", k)),
+                            std::move(tuple), nullptr);
+            }
+
+            PlaylistData two(id, "Pair");
+            two.insert_items(0, std::move(pair));
+            two.sort(make_compare(keys));
+
+            bool swapped = (entry_id(two, 0) != i);
+            assert(swapped == (str_compare(sort_strings[j], sort_strings[i]) <
+                               0));
+        }
+    }
+}
+
+// entries with a field not set, or not yet scanned, are not duplicates
+static void test_remove_duplicates()
+{
+    Index<PlaylistAddItem> items;
+    for (int i = 0; i < 6; i++)
+    {
+        StringBuf filename = str_printf("file:///%d.ogg", i);
+        Tuple tuple;
+
+        if (i < 4)
+        {
+            tuple.set_filename(filename);
+            if (i < 2)
+            {
+                tuple.set_str(Tuple::Artist, "Artist");
+                tuple.set_int(Tuple::Track, 1);
+            }
+            tuple.set_state(Tuple::Valid);
+        }
+
+        items.append(String(filename), std::move(tuple), nullptr);
+    }
+
+    Playlist::ID * id = nullptr;
+    PlaylistData playlist(id, "Test");
+    playlist.insert_items(0, std::move(items));
+
+    playlist.remove_duplicates(PlaylistData::ArtistColumn);
+    assert(playlist.n_entries() == 5);
+
+    playlist.remove_duplicates(PlaylistData::TrackColumn);
+    assert(playlist.n_entries() == 5);
+}
+
+void test_playlist_data()
+{
+    PlaylistData::update_formatter();
+
+    test_shuffle();
+    test_sort_keys();
+    test_remove_duplicates();
+
+    PlaylistData::cleanup_formatter();
+}
@@ -0,0 +1,340 @@
+/*
+ * test-playlist-store.cc - Playlist store test for libaudcore
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "audstrings.h"
+#include "binary-io.h"
+#include "playlist-internal.h"
+#include "plugin.h"
+#include "plugins.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+// the playlist saved is the one in stubs.cc, and the only decoder known to
+// the plugin subsystem is the one below
+
+extern Index<PlaylistAddItem> test_entries;
+extern String test_title;
+extern Playlist::Update test_changes;
+extern int test_saved_len;
+
+class TestInput : public InputPlugin
+{
+public:
+    constexpr TestInput() : InputPlugin({"Test"}, InputInfo()) {}
+
+    bool is_our_file(const char *, VFSFile &) { return true; }
+    bool read_tag(const char *, VFSFile &, Tuple &, Index<char> *)
+    {
+        return true;
+    }
+    bool play(const char *, VFSFile &) { return true; }
+};
+
+static TestInput test_input;
+
+// stubs.cc takes plugin handles to be the plugins themselves
+#define TEST_DECODER ((PluginHandle *)&test_input)
+
+PluginHandle * aud_plugin_lookup_basename(const char * basename)
+{
+    return !strcmp(basename, "test") ? TEST_DECODER : nullptr;
+}
+
+const char * aud_plugin_get_basename(PluginHandle *) { return "test"; }
+PluginType aud_plugin_get_type(PluginHandle *) { return PluginType::Input; }
+
+static void test_numbers()
+{
+    static const uint64_t values[] = {0,   1,          127,       128,
+                                      300, UINT32_MAX, UINT64_MAX};
+    static const int64_t signed_values[] = {0,  -1,        1,
+                                            -2, INT64_MIN, INT64_MAX};
+
+    Index<char> buf;
+    for (uint64_t val : values)
+        put_number(buf, val);
+    for (int64_t val : signed_values)
+        put_signed_number(buf, val);
+    put_string(buf, "string");
+
+    // 7 bits per byte; -1 is zigzag-encoded as 1
+    assert(buf[0] == 0 && buf[1] == 1 && buf[2] == 127);
+    assert(buf.len() == 1 + 1 + 1 + 2 + 2 + 5 + 10 + 1 + 1 + 1 + 1 + 10 + 10 +
+                            1 + 6);
+
+    BinaryReader r = {buf.begin(), buf.end(), true};
+
+    for (uint64_t val : values)
+    {
+        uint64_t read = r.number();
+        assert(read == val);
+    }
+
+    for (int64_t val : signed_values)
+    {
+        int64_t read = r.signed_number();
+        assert(read == val);
+    }
+
+    uint64_t len = r.number();
+    const char * str = r.bytes(len);
+    assert(str && len == 6 && !memcmp(str, "string", 6));
+    assert(r.ok && r.pos == r.end);
+
+    // reading past the end
+    str = r.bytes(1);
+    assert(!str && !r.ok);
+
+    // a number cut short
+    buf.resize(0);
+    put_number(buf, 300);
+
+    BinaryReader r2 = {buf.begin(), buf.end() - 1, true};
+    len = r2.number();
+    assert(!len && !r2.ok);
+}
+
+static void test_tuples()
+{
+    static const short subtunes[] = {1, 3, 5};
+
+    Tuple tuple;
+    tuple.set_filename("file:///folder/song.ogg");
+    tuple.set_str(Tuple::Title, "Title");
+    tuple.set_str(Tuple::Artist, "Artist");
+    tuple.set_str(Tuple::Comment, "");
+    tuple.set_int(Tuple::Length, 123456);
+    tuple.set_int(Tuple::Track, -1);
+    tuple.set_subtunes(3, subtunes);
+
+    Index<char> buf;
+    put_tuple(buf, tuple);
+    put_tuple(buf, tuple, (uint64_t)1 << Tuple::Title);
+
+    // derived fields are not written but set again from the filename
+    BinaryReader r = {buf.begin(), buf.end(), true};
+    Tuple read;
+    read.set_filename("file:///folder/song.ogg");
+    bool success = read_tuple(r, &read);
+    assert(success);
+    assert(!strcmp(read.get_str(Tuple::Title), "Title"));
+    assert(!strcmp(read.get_str(Tuple::Artist), "Artist"));
+    assert(!strcmp(read.get_str(Tuple::Comment), ""));
+    assert(!strcmp(read.get_str(Tuple::Basename), "song"));
+    assert(read.get_int(Tuple::Length) == 123456);
+    assert(read.get_int(Tuple::Track) == -1);
+    assert(!read.is_set(Tuple::Year));
+    assert(read.get_n_subtunes() == 3 && read.get_nth_subtune(2) == 5);
+    assert(read.state() == Tuple::Initial);
+
+    // skipped fields are left out
+    Tuple read2;
+    read2.set_filename("file:///folder/song.ogg");
+    success = read_tuple(r, &read2);
+    assert(success);
+    assert(!read2.is_set(Tuple::Title));
+    assert(!strcmp(read2.get_str(Tuple::Artist), "Artist"));
+    assert(r.ok && r.pos == r.end);
+
+    // without a tuple, the fields are only skipped over
+    BinaryReader r2 = {buf.begin(), buf.end(), true};
+    success = read_tuple(r2, nullptr) && read_tuple(r2, nullptr);
+    assert(success && r2.pos == r2.end);
+
+    // any truncation is caught
+    for (int len = 0; len < buf.len() / 2; len++)
+    {
+        BinaryReader r3 = {buf.begin(), buf.begin() + len, true};
+        success = read_tuple(r3, nullptr);
+        assert(!success);
+    }
+}
+
+static PlaylistAddItem make_item(const char * filename, const char * title,
+                                 int length)
+{
+    PlaylistAddItem item{String(filename), Tuple(), TEST_DECODER};
+
+    if (title)
+    {
+        item.tuple.set_filename(filename);
+        item.tuple.set_str(Tuple::Title, title);
+        item.tuple.set_int(Tuple::Length, length);
+        item.tuple.set_str(Tuple::Genre, "Genre");
+        item.tuple.set_state(Tuple::Valid);
+    }
+
+    return item;
+}
+
+static void set_entries(std::initializer_list<PlaylistAddItem> items)
+{
+    test_entries.clear();
+    for (auto & item : items)
+        test_entries.append(item.copy());
+}
+
+static void check_entries(const Index<PlaylistAddItem> & items)
+{
+    assert(items.len() == test_entries.len());
+
+    for (int i = 0; i < items.len(); i++)
+    {
+        const PlaylistAddItem & a = items[i];
+        const PlaylistAddItem & b = test_entries[i];
+
+        assert(!strcmp(a.filename, b.filename));
+        assert(a.decoder == b.decoder);
+        assert(a.tuple == b.tuple);
+    }
+}
+
+static void check_load(const char * path, const char * title)
+{
+    String loaded_title;
+    Index<PlaylistAddItem> items;
+    bool success = playlist_store_load(path, loaded_title, items);
+    assert(success && !strcmp(loaded_title, title));
+    check_entries(items);
+
+    String peek_title;
+    int n_entries;
+    int64_t total_length = 0;
+    success = playlist_store_peek(path, peek_title, n_entries, total_length);
+    assert(success && !strcmp(peek_title, title));
+    assert(n_entries == test_entries.len());
+
+    int64_t expected = 0;
+    for (auto & item : test_entries)
+        expected += aud::max(0, item.tuple.get_int(Tuple::Length));
+    assert(total_length == expected);
+}
+
+static void save(const char * path, Playlist::UpdateLevel level, int before,
+                 int after, int saved_len)
+{
+    test_changes = {level, before, after, false};
+    test_saved_len = saved_len;
+
+    bool success = playlist_store_save(path, PlaylistEx());
+    assert(success);
+}
+
+static Index<char> read_file(const char * path)
+{
+    Index<char> data;
+    FILE * handle = g_fopen(path, "rb");
+    assert(handle);
+
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof buf, handle)))
+        data.insert(buf, -1, len);
+
+    fclose(handle);
+    return data;
+}
+
+static void write_file(const char * path, const Index<char> & data)
+{
+    FILE * handle = g_fopen(path, "wb");
+    assert(handle);
+
+    size_t written = fwrite(data.begin(), 1, data.len(), handle);
+    int closed = fclose(handle);
+    assert(written == (size_t)data.len() && closed == 0);
+}
+
+static void test_store()
+{
+    StringBuf path = filename_build({g_get_tmp_dir(), "test-playlist-store"});
+
+    // the first save writes a snapshot
+    playlist_store_cleanup();
+    test_title = String("One");
+    set_entries({make_item("file:///a.ogg", "A", 1000),
+                 make_item("file:///b.ogg", nullptr, 0),
+                 make_item("file:///c.ogg", "C", 3000)});
+    save(path, Playlist::Structure, 0, 0, 0);
+    check_load(path, "One");
+
+    Index<char> snapshot = read_file(path);
+
+    // the second replaces the middle entry with two others
+    set_entries({make_item("file:///a.ogg", "A", 1000),
+                 make_item("file:///d.ogg", "D", 4000),
+                 make_item("file:///e.ogg", nullptr, 0),
+                 make_item("file:///c.ogg", "C", 3000)});
+    save(path, Playlist::Structure, 1, 1, 3);
+
+    // and the third only changes the title
+    test_title = String("Two");
+    save(path, Playlist::NoUpdate, 0, 0, 4);
+
+    // both are appended to the journal and replayed when loading
+    Index<char> full = read_file(path);
+    assert(full.len() > snapshot.len());
+    assert(!memcmp(full.begin(), snapshot.begin(), snapshot.len()));
+    check_load(path, "Two");
+
+    // the title change is 10 bytes (op, length, string, and checksum); if it
+    // is cut short, it is ignored, but the splice before it is still applied
+    Index<char> data;
+    data.insert(full.begin(), 0, full.len() - 1);
+    write_file(path, data);
+    check_load(path, "One");
+
+    // if the checksum of the splice is wrong, neither change is applied
+    data.clear();
+    data.insert(full.begin(), 0, full.len());
+    data[full.len() - 11] ^= 1;
+    write_file(path, data);
+    set_entries({make_item("file:///a.ogg", "A", 1000),
+                 make_item("file:///b.ogg", nullptr, 0),
+                 make_item("file:///c.ogg", "C", 3000)});
+    check_load(path, "One");
+
+    // a truncated snapshot is rejected altogether
+    data.clear();
+    data.insert(snapshot.begin(), 0, snapshot.len() / 2);
+    write_file(path, data);
+
+    String title;
+    Index<PlaylistAddItem> items;
+    bool success = playlist_store_load(path, title, items);
+    assert(!success && !items.len());
+
+    g_unlink(path);
+    playlist_store_cleanup();
+    test_entries.clear();
+    test_title = String();
+}
+
+void test_playlist_store()
+{
+    test_numbers();
+    test_tuples();
+    test_store();
+}
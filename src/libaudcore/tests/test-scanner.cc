@@ -0,0 +1,171 @@
+/*
+ * test-scanner.cc - Scanner test for libaudcore
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "cue-cache.h"
+#include "internal.h"
+#include "metadata-cache.h"
+#include "plugin.h"
+#include "probe.h"
+#include "scanner.h"
+
+#include <assert.h>
+
+// the scanner is run directly, with the metadata cache and the plugin
+// subsystem replaced by the stubs below
+
+class TestInput : public InputPlugin
+{
+public:
+    constexpr TestInput() : InputPlugin({"Test"}, InputInfo()) {}
+
+    bool is_our_file(const char *, VFSFile &) { return true; }
+    bool read_tag(const char *, VFSFile &, Tuple &, Index<char> *)
+    {
+        return true;
+    }
+    bool play(const char *, VFSFile &) { return true; }
+};
+
+static TestInput test_input;
+
+// stubs.cc takes plugin handles to be the plugins themselves
+#define TEST_DECODER ((PluginHandle *)&test_input)
+
+static bool cache_hit;
+static int n_probes, n_reads, n_opens, n_stores, n_callbacks;
+
+bool metadata_cache_stat(const char *, MetadataCacheItem & item)
+{
+    item.mtime = 1;
+    item.size = 2;
+    return true;
+}
+
+bool metadata_cache_lookup(const char * filename, MetadataCacheItem & item)
+{
+    if (!cache_hit)
+        return false;
+
+    item.decoder = TEST_DECODER;
+    item.tuple.set_filename(filename);
+    item.tuple.set_int(Tuple::Length, 1000);
+    item.tuple.set_state(Tuple::Valid);
+    item.art = EmbeddedArt::None;
+    return true;
+}
+
+void metadata_cache_store(const char *, const MetadataCacheItem &)
+{
+    n_stores++;
+}
+
+PluginHandle * aud_file_find_decoder(const char *, bool, VFSFile &, String *)
+{
+    n_probes++;
+    return TEST_DECODER;
+}
+
+bool aud_file_read_tag(const char * filename, PluginHandle *, VFSFile &,
+                       Tuple & tuple, Index<char> *, String *)
+{
+    n_reads++;
+    tuple.set_filename(filename);
+    tuple.set_state(Tuple::Valid);
+    return true;
+}
+
+bool open_input_file(const char *, const char *, InputPlugin *, VFSFile &,
+                     String *)
+{
+    n_opens++;
+    return true;
+}
+
+String art_search(const char *) { return String(); }
+
+CueCacheRef::CueCacheRef(const char * filename) : m_node(nullptr) {}
+CueCacheRef::~CueCacheRef() {}
+
+const Index<PlaylistAddItem> & CueCacheRef::load()
+{
+    static const Index<PlaylistAddItem> empty;
+    return empty;
+}
+
+static void scan_done(ScanRequest *) { n_callbacks++; }
+
+static void reset_counts()
+{
+    n_probes = n_reads = n_opens = n_stores = n_callbacks = 0;
+}
+
+static void test_playback_scan()
+{
+    // a file known to the cache to have no embedded art is not read, but the
+    // input plugin must still be found so that the file can be played
+    cache_hit = true;
+    reset_counts();
+
+    ScanRequest request(String("file:///test.ogg"),
+                        SCAN_TUPLE | SCAN_IMAGE | SCAN_FILE, scan_done);
+    request.run();
+
+    assert(request.decoder == TEST_DECODER);
+    assert(request.ip == &test_input);
+    assert(request.tuple.valid());
+    assert(request.tuple.get_int(Tuple::Length) == 1000);
+    assert(!request.error);
+    assert(!n_probes && !n_reads && !n_stores);
+    assert(n_opens == 1 && n_callbacks == 1);
+}
+
+static void test_playlist_scan()
+{
+    // a playlist scan does not need the input plugin if the cache has the tuple
+    cache_hit = true;
+    reset_counts();
+
+    ScanRequest request(String("file:///test.ogg"), SCAN_TUPLE, scan_done);
+    request.run();
+
+    assert(request.decoder == TEST_DECODER);
+    assert(!request.ip);
+    assert(request.tuple.valid());
+    assert(!n_probes && !n_reads && !n_opens && !n_stores);
+    assert(n_callbacks == 1);
+
+    // on a miss, the file is probed and read, and the result is stored
+    cache_hit = false;
+    reset_counts();
+
+    ScanRequest request2(String("file:///test.ogg"), SCAN_TUPLE, scan_done);
+    request2.run();
+
+    assert(request2.decoder == TEST_DECODER);
+    assert(request2.ip == &test_input);
+    assert(request2.tuple.valid());
+    assert(n_probes == 1 && n_reads == 1 && n_stores == 1);
+    assert(!n_opens && n_callbacks == 1);
+}
+
+void test_scanner()
+{
+    test_playback_scan();
+    test_playlist_scan();
+}
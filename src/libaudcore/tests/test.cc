@@ -27,6 +27,7 @@
 #include "vfs.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,10 @@ MainloopType aud_get_mainloop_type()
 }
 
 extern void test_mainloop();
+extern void test_playback();
+extern void test_playlist_data();
+extern void test_playlist_store();
+extern void test_scanner();
 
 static void test_audio_conversion()
 {
@@ -70,6 +75,263 @@ static void test_audio_conversion()
         assert(out[i] == (in[i] & 0xffffff));
 }
 
+static void test_audio_conversion_long()
+{
+    /* long enough to exercise the vectorized code paths, with a remainder */
+    /* input includes values outside of the (-1, 1) range */
+    static const int len = 1003;
+
+    float in[len], f[len], f2[len];
+    int16_t s16[len];
+    int32_t s24[len], s32[len];
+    char packed[3 * len];
+
+    for (int i = 0; i < len; i++)
+        in[i] = (i % 400 - 200) / 150.0f;
+
+    audio_to_int(in, s16, FMT_S16_NE, len);
+    audio_to_int(in, s24, FMT_S24_NE, len);
+    audio_to_int(in, s32, FMT_S32_NE, len);
+    audio_to_int(in, packed, FMT_S24_3NE, len);
+
+    for (int i = 0; i < len; i++)
+    {
+        float x16 = aud::clamp(in[i] * 0x8000, -32768.0f, 32767.0f);
+        float x24 = aud::clamp(in[i] * 0x800000, -8388608.0f, 8388607.0f);
+        float x32 = aud::clamp(in[i] * 0x80000000u, -2147483648.0f,
+                               2147483520.0f);
+
+        assert(s16[i] == (int16_t)lrintf(x16));
+        assert(s24[i] == (lrintf(x24) & 0xffffff));
+        assert(s32[i] == (int32_t)lrintf(x32));
+    }
+
+    audio_from_int(s16, FMT_S16_NE, f, len);
+
+    for (int i = 0; i < len; i++)
+        assert(f[i] == s16[i] / 32768.0f);
+
+    audio_from_int(s24, FMT_S24_NE, f, len);
+    audio_from_int(packed, FMT_S24_3NE, f2, len);
+
+    for (int i = 0; i < len; i++)
+    {
+        int32_t x24 = (s24[i] & 0x800000) ? (s24[i] | 0xff000000) : s24[i];
+        assert(f[i] == x24 / 8388608.0f);
+        assert(f2[i] == f[i]);
+    }
+
+    /* stereo interlacing round trip */
+    int frames = len / 2;
+    float left[len / 2], right[len / 2];
+    void * out[] = {left, right};
+    const void * in2[] = {left, right};
+
+    audio_deinterlace(in, FMT_FLOAT, 2, out, frames);
+
+    for (int i = 0; i < frames; i++)
+        assert(left[i] == in[2 * i] && right[i] == in[2 * i + 1]);
+
+    audio_interlace(in2, FMT_FLOAT, 2, f, frames);
+    assert(!memcmp(f, in, sizeof(float) * 2 * frames));
+}
+
+static void test_audio_amplify_clip()
+{
+    /* the fused pass should match audio_amplify() followed by
+     * audio_soft_clip(), to within single-precision rounding */
+    static const int len = 1003;
+
+    float in[len], ref[len], f[len];
+
+    for (int i = 0; i < len; i++)
+        in[i] = (i % 400 - 200) / 100.0f;
+
+    StereoVolume volume = {90, 60};
+    float left = audio_volume_factor(volume.left);
+    float right = audio_volume_factor(volume.right);
+
+    for (int channels = 1; channels <= 2; channels++)
+    {
+        int frames = len / channels;
+        int samples = channels * frames;
+
+        memcpy(ref, in, sizeof(float) * samples);
+        audio_amplify(ref, channels, frames, volume);
+        audio_soft_clip(ref, samples);
+
+        memcpy(f, in, sizeof(float) * samples);
+        audio_amplify_clip(f, channels, frames, left, right, true);
+
+        for (int i = 0; i < samples; i++)
+            assert(fabsf(f[i] - ref[i]) < 1e-6f);
+
+        /* without clipping, only the multiplication is done */
+        memcpy(ref, in, sizeof(float) * samples);
+        audio_amplify(ref, channels, frames, volume);
+
+        memcpy(f, in, sizeof(float) * samples);
+        audio_amplify_clip(f, channels, frames, left, right, false);
+
+        assert(!memcmp(f, ref, sizeof(float) * samples));
+    }
+}
+
+static void halve(float * data, int samples)
+{
+    for (int i = 0; i < samples; i++)
+        data[i] *= 0.5f;
+}
+
+static void test_audio_post_process()
+{
+    /* the blocked pass should give exactly the same result as running each
+     * step over the whole buffer; the length spans several blocks */
+    static const int channels = 3, frames = 2001;
+    static const int len = channels * frames;
+
+    static float in[len], ref[len], f[len];
+    static int16_t s16[len], out16[len];
+    static char packed[3 * len], out_packed[3 * len];
+
+    for (int i = 0; i < len; i++)
+        in[i] = (i % 400 - 200) / 100.0f;
+
+    float factor = audio_volume_factor(80);
+
+    memcpy(ref, in, sizeof ref);
+    halve(ref, len);
+    audio_amplify_clip(ref, channels, frames, factor, factor, true);
+    audio_to_int(ref, s16, FMT_S16_NE, len);
+    audio_to_int(ref, packed, FMT_S24_3NE, len);
+
+    memcpy(f, in, sizeof f);
+    audio_post_process(f, out16, FMT_S16_NE, channels, frames, halve, factor,
+                       factor, true);
+    assert(!memcmp(out16, s16, sizeof s16));
+    assert(!memcmp(f, ref, sizeof ref));
+
+    memcpy(f, in, sizeof f);
+    audio_post_process(f, out_packed, FMT_S24_3NE, channels, frames, halve,
+                       factor, factor, true);
+    assert(!memcmp(out_packed, packed, sizeof packed));
+
+    memcpy(f, in, sizeof f);
+    audio_post_process(f, nullptr, FMT_FLOAT, channels, frames, halve, factor,
+                       factor, true);
+    assert(!memcmp(f, ref, sizeof ref));
+}
+
+static void test_resample(int in_rate, int out_rate, ResampleQuality quality)
+{
+    /* a 1 kHz tone should come out as the same tone at the new rate, and the
+     * result should not depend on how the input is divided up */
+    static const int channels = 2, chunk = 997;
+    int frames = in_rate / 4;
+
+    Index<float> in, whole, pieces;
+    in.resize(channels * frames);
+
+    for (int i = 0; i < frames; i++)
+    {
+        float x = sin(2 * M_PI * 1000 * i / in_rate);
+        in[i * channels] = x;
+        in[i * channels + 1] = -0.5f * x;
+    }
+
+    Index<float> data;
+
+    resample_start(channels, in_rate, out_rate, quality);
+    data.insert(in.begin(), 0, in.len());
+
+    auto & out = resample_finish(data, true);
+    whole.insert(out.begin(), 0, out.len());
+
+    for (int i = 0; i < frames; i += chunk)
+    {
+        data.clear();
+        data.insert(&in[i * channels], 0,
+                    channels * aud::min(chunk, frames - i));
+
+        auto & out = (i + chunk < frames) ? resample_process(data)
+                                          : resample_finish(data, true);
+        pieces.insert(out.begin(), -1, out.len());
+    }
+
+    assert(whole.len() == pieces.len());
+    assert(!memcmp(whole.begin(), pieces.begin(), sizeof(float) * whole.len()));
+
+    int out_frames = whole.len() / channels;
+    int expect = aud::rescale(frames, in_rate, out_rate);
+    assert(abs(out_frames - expect) <= 1);
+
+    float tolerance = (quality == ResampleQuality::Fast) ? 1e-2f : 1e-4f;
+
+    /* skip the edges, where the filter window overlaps the silence */
+    for (int i = out_rate / 100; i < out_frames - out_rate / 100; i++)
+    {
+        float x = sin(2 * M_PI * 1000 * i / out_rate);
+        assert(fabsf(whole[i * channels] - x) < tolerance);
+        assert(fabsf(whole[i * channels + 1] + 0.5f * x) < tolerance);
+    }
+
+    /* nothing is done when the rates are the same */
+    resample_start(channels, in_rate, in_rate, quality);
+    assert(&resample_process(data) == &data);
+}
+
+static void test_resampler()
+{
+    test_resample(44100, 48000, ResampleQuality::Medium);
+    test_resample(48000, 44100, ResampleQuality::Best);
+    test_resample(96000, 44100, ResampleQuality::Medium);
+    test_resample(22050, 44100, ResampleQuality::Fast);
+
+    resample_cleanup();
+}
+
+static void test_fft()
+{
+    /* compare with a direct evaluation of the windowed DFT */
+    static float data[1024], freq[512], bands[16];
+
+    for (int i = 0; i < 1024; i++)
+        data[i] = sinf(i * 0.3f) + 0.5f * cosf(i * 1.7f) + (i % 7) / 14.0f;
+
+    for (int n = 256; n <= 1024; n *= 4)
+    {
+        calc_freq(data, freq, n);
+
+        for (int k = 1; k <= n / 2; k++)
+        {
+            double re = 0, im = 0;
+
+            for (int i = 0; i < n; i++)
+            {
+                double x = data[i] * (1 - 0.85 * cos(2 * M_PI * i / n));
+                re += x * cos(2 * M_PI * i * k / n);
+                im -= x * sin(2 * M_PI * i * k / n);
+            }
+
+            double mag = sqrt(re * re + im * im) * ((k < n / 2) ? 2 : 1) / n;
+            assert(fabs(freq[k - 1] - mag) < 1e-5);
+        }
+    }
+
+    /* the bands together cover all the frequencies exactly once */
+    calc_freq_bands(freq, 512, bands, 16);
+
+    float sum = 0, band_sum = 0;
+    for (int k = 0; k < 512; k++)
+        sum += freq[k];
+    for (int i = 0; i < 16; i++)
+        band_sum += bands[i];
+
+    assert(fabsf(sum - band_sum) < 1e-4f * sum);
+
+    fft_cleanup();
+}
+
 static void test_case_conversion()
 {
     const char in[] = "AÄaäEÊeêIÌiìOÕoõUÚuú";
@@ -595,6 +857,11 @@ int main(int argc, const char ** argv)
         use_qt = true;
 
     test_audio_conversion();
+    test_audio_conversion_long();
+    test_audio_amplify_clip();
+    test_audio_post_process();
+    test_resampler();
+    test_fft();
     test_case_conversion();
     test_numeric_conversion();
     test_filename_split();
@@ -603,6 +870,10 @@ int main(int argc, const char ** argv)
     test_stringbuf();
     test_str_printf();
     test_uri_construct();
+    test_scanner();
+    test_playback();
+    test_playlist_data();
+    test_playlist_store();
 
     test_mainloop();
 
@@ -21,87 +21,178 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "hook.h"
-#include "list.h"
 #include "mainloop.h"
 #include "output.h"
 #include "threads.h"
 
-#define INTERVAL 33 /* milliseconds */
-#define FRAMES_PER_NODE 512
+#define MIN_NODES 32   /* initial size of the ring */
+#define MAX_NODES 1024 /* about four seconds at 240 Hz */
+#define MAX_BUFFERED (1 << 21) /* frames in all the nodes together */
+#define MIN_FRAMES 512
+#define MAX_FRAMES 16384
+#define MIN_RATE 1 /* frames per second */
+#define MAX_RATE 240
+
+/* The audio passed to the output plugin is copied into a ring of nodes, each
+ * holding a window of the signal; the windows start one frame interval apart
+ * and overlap if they are longer than that.  The audio thread (which fills the
+ * nodes) and the visualization worker thread (which sends them to the
+ * visualizers) never wait for each other.  Instead, each node is handed back
+ * and forth through its atomic state.  The audio thread takes the nodes in ring
+ * order, reclaiming any that were never sent, and skips the one node (at most)
+ * that the worker is reading.  The worker wakes up once per frame interval and
+ * picks the node matching the time of the audio being heard by scanning the
+ * timestamps of the ready nodes.  The length of the windows is set by
+ * vis_runner_set_frames() to fit the largest transform requested by the
+ * visualizers, and the interval by vis_runner_set_rate() to match the highest
+ * frame rate requested.
+ *
+ * The ring must hold all the audio between the output plugin's input and what
+ * is being heard, which depends on both the frame rate and the latency of the
+ * output.  It starts small, and grows whenever the audio thread comes around
+ * to a node that is not yet due (up to MAX_NODES, or MAX_BUFFERED frames).
+ * The buffers are freed when the runner is disabled. */
 
-struct VisNode : public ListNode
+enum
 {
-    VisNode(int channels, int time)
-        : channels(channels), time(time),
-          data(new float[channels * FRAMES_PER_NODE])
-    {
-    }
-
-    ~VisNode() { delete[] data; }
+    NODE_FREE,
+    NODE_WRITING, /* owned by the audio thread */
+    NODE_READY,
+    NODE_READING /* owned by the worker thread */
+};
 
-    const int channels;
-    int time;
-    float * data;
+struct VisNode
+{
+    std::atomic<int> state{NODE_FREE};
+    std::atomic<int> time{0};
+    int channels = 0, frames = 0; /* valid while ready or reading */
+    int size = 0;                 /* allocated samples */
+    float * data = nullptr;
 };
 
+static VisNode nodes[MAX_NODES];
+static std::atomic<int> n_nodes(MIN_NODES);   /* grown by the audio thread */
+static std::atomic<int> heard_time(INT32_MAX); /* as last seen by the worker */
+static std::atomic<bool> in_audio(false);     /* in vis_runner_pass_audio() */
+
+/* control state, changed only with the mutex held */
 static aud::mutex mutex;
 static bool enabled = false;
 static bool playing = false, paused = false;
-static VisNode * current_node = nullptr;
-static int current_frames;
-static List<VisNode> vis_list;
-static List<VisNode> vis_pool;
 static QueuedFunc queued_clear;
-
-static void send_audio(void *)
+static std::thread worker;
+static aud::condvar cond;
+
+static std::atomic<bool> active(false);        /* enabled and playing */
+static std::atomic<bool> reset_pending(false); /* audio thread starts over */
+static std::atomic<int> frames_wanted(MIN_FRAMES);
+static std::atomic<int> interval(1000 / 30); /* milliseconds */
+
+/* used only by the audio thread */
+static int next_node;
+static int cur_channels, cur_rate, cur_frames, cur_interval;
+static float * pending;       /* audio not yet copied into all its nodes */
+static int pending_size;      /* allocated samples */
+static int pending_len;       /* samples */
+static int64_t pending_frame; /* position of the first frame in pending */
+static int next_time;         /* start of the next node (ms) */
+
+/* called from the worker thread only */
+static void send_audio()
 {
-    /* call before locking mutex to avoid deadlock */
     int outputted = output_get_raw_time();
+    int soon_limit = outputted + interval.load(std::memory_order_relaxed);
 
-    auto mh = mutex.take();
-
-    if (!enabled || !playing || paused)
+    if (!active.load(std::memory_order_relaxed))
         return;
 
-    VisNode * node = nullptr;
-    VisNode * next;
+    heard_time.store(outputted, std::memory_order_relaxed);
+    int count = n_nodes.load(std::memory_order_acquire);
+
+    /* Use the most recent node that is not in the future.  Failing that, use
+     * the earliest node that is not in the future by more than the length of
+     * an interval. */
+    VisNode * past = nullptr, * soon = nullptr;
+    int past_time = 0, soon_time = 0;
 
-    while ((next = vis_list.head()))
+    for (int i = 0; i < count; i++)
     {
-        /* If we are considering a node, stop searching and use it if it is the
-         * most recent (that is, the next one is in the future).  Otherwise,
-         * consider the next node if it is not in the future by more than the
-         * length of an interval. */
-        if (next->time > outputted + (node ? 0 : INTERVAL))
-            break;
-
-        if (node)
-            vis_pool.prepend(node);
-
-        node = next;
-        vis_list.remove(node);
+        VisNode & node = nodes[i];
+        if (node.state.load(std::memory_order_acquire) != NODE_READY)
+            continue;
+
+        int time = node.time.load(std::memory_order_relaxed);
+
+        if (time <= outputted)
+        {
+            if (!past || time > past_time)
+            {
+                past = &node;
+                past_time = time;
+            }
+        }
+        else if (time <= soon_limit)
+        {
+            if (!soon || time < soon_time)
+            {
+                soon = &node;
+                soon_time = time;
+            }
+        }
     }
 
+    VisNode * node = past ? past : soon;
     if (!node)
         return;
 
-    mh.unlock();
-    vis_send_audio(node->data, node->channels);
-    mh.lock();
+    int time = past ? past_time : soon_time;
 
-    vis_pool.prepend(node);
+    /* older nodes will not be needed any more */
+    for (int i = 0; i < count; i++)
+    {
+        VisNode & old = nodes[i];
+        if (&old != node && old.time.load(std::memory_order_relaxed) < time)
+        {
+            int state = NODE_READY;
+            old.state.compare_exchange_strong(state, NODE_FREE,
+                                              std::memory_order_relaxed);
+        }
+    }
+
+    /* the node may have been reclaimed (and even refilled) in the meantime */
+    int state = NODE_READY;
+    if (!node->state.compare_exchange_strong(state, NODE_READING,
+                                             std::memory_order_acquire))
+        return;
+
+    if (node->time.load(std::memory_order_relaxed) <= soon_limit)
+    {
+        vis_send_audio(node->data, node->channels, node->frames);
+        node->state.store(NODE_FREE, std::memory_order_release);
+    }
+    else
+        node->state.store(NODE_READY, std::memory_order_release);
 }
 
 static void flush(aud::mutex::holder &)
 {
-    delete current_node;
-    current_node = nullptr;
+    reset_pending.store(true, std::memory_order_relaxed);
+    heard_time.store(INT32_MAX, std::memory_order_relaxed); /* not known */
 
-    vis_list.clear();
-    vis_pool.clear();
+    for (VisNode & node : nodes)
+    {
+        int state = NODE_READY;
+        node.state.compare_exchange_strong(state, NODE_FREE,
+                                           std::memory_order_relaxed);
+    }
 
     if (enabled)
         queued_clear.queue(vis_send_clear);
@@ -121,13 +212,44 @@ static void start_stop(aud::mutex::holder & mh, bool new_playing,
 
     queued_clear.stop();
 
+    active.store(enabled && playing);
+
     if (!enabled || !playing)
         flush(mh);
 
-    if (enabled && playing && !paused)
-        timer_add(TimerRate::Hz30, send_audio);
-    else
-        timer_remove(TimerRate::Hz30, send_audio);
+    cond.notify_all();
+}
+
+/* The worker sleeps while playback is stopped or paused, and exits once the
+ * runner is disabled.  It is joined only by vis_runner_enable(), never with
+ * the mutex held, since it may be waiting for the output lock, which the
+ * playback thread holds while calling vis_runner_start_stop(). */
+static void run_worker()
+{
+    typedef std::chrono::steady_clock Clock;
+    auto next = Clock::now();
+
+    auto mh = mutex.take();
+
+    while (enabled)
+    {
+        if (!playing || paused)
+        {
+            cond.wait(mh);
+            next = Clock::now();
+            continue;
+        }
+
+        mh.unlock();
+        send_audio();
+        mh.lock();
+
+        /* keep to the schedule, unless we have fallen behind */
+        next += std::chrono::milliseconds(interval.load());
+        next = aud::max(next, Clock::now());
+
+        cond.wait_until(mh, next);
+    }
 }
 
 void vis_runner_start_stop(bool new_playing, bool new_paused)
@@ -136,82 +258,210 @@ void vis_runner_start_stop(bool new_playing, bool new_paused)
     start_stop(mh, new_playing, new_paused);
 }
 
+/* returns a node owned by the audio thread, or null if none is available */
+static VisNode * take_node()
+{
+    int count = n_nodes.load(std::memory_order_relaxed);
+    int heard = heard_time.load(std::memory_order_relaxed);
+
+    /* the worker thread reads only one node at a time */
+    for (int tries = 0; tries < 2; tries++)
+    {
+        VisNode * node = &nodes[next_node];
+        int state = node->state.load(std::memory_order_relaxed);
+
+        /* rather than reclaim a node that is not yet due, add a new one (the
+         * old node stays next in line) */
+        if (state == NODE_READY &&
+            node->time.load(std::memory_order_relaxed) > heard &&
+            count < MAX_NODES && (count + 1) * cur_frames <= MAX_BUFFERED)
+        {
+            node = &nodes[count];
+            node->state.store(NODE_WRITING, std::memory_order_relaxed);
+            n_nodes.store(count + 1, std::memory_order_release);
+            return node;
+        }
+
+        next_node = (next_node + 1) % count;
+
+        while (state != NODE_READING)
+        {
+            if (node->state.compare_exchange_weak(state, NODE_WRITING,
+                                                  std::memory_order_acquire))
+                return node;
+        }
+    }
+
+    return nullptr;
+}
+
+static void fill_node(const float * data, int time)
+{
+    VisNode * node = take_node();
+    if (!node)
+        return;
+
+    int samples = cur_channels * cur_frames;
+
+    if (node->size < samples)
+    {
+        delete[] node->data;
+        node->data = new float[samples];
+        node->size = samples;
+    }
+
+    memcpy(node->data, data, sizeof(float) * samples);
+
+    node->channels = cur_channels;
+    node->frames = cur_frames;
+    node->time.store(time, std::memory_order_relaxed);
+    node->state.store(NODE_READY, std::memory_order_release);
+}
+
+static void start_over(int time, int channels, int rate)
+{
+    cur_channels = channels;
+    cur_rate = rate;
+    cur_frames = frames_wanted.load(std::memory_order_relaxed);
+    cur_interval = interval.load(std::memory_order_relaxed);
+
+    pending_len = 0;
+    pending_frame = aud::rescale<int64_t>(time, 1000, rate);
+    next_time = time;
+}
+
+/* called from the audio thread only */
 void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
                            int rate)
 {
-    auto mh = mutex.take();
+    /* see vis_runner_enable() */
+    in_audio.store(true);
 
-    if (!enabled || !playing)
+    if (!active.load())
+    {
+        in_audio.store(false);
         return;
+    }
 
-    /* We can build a single node from multiple calls; we can also build
-     * multiple nodes from the same call.  If current_node is present, it was
-     * partly built in the last call and needs to be finished. */
+    /* Start over after a flush, or if the audio is not continuous (allowing
+     * for the rounding of the time to milliseconds). */
+    int64_t start = aud::rescale<int64_t>(time, 1000, rate);
+    int64_t expected = pending_frame + pending_len / aud::max(cur_channels, 1);
 
-    int at = 0;
+    if (reset_pending.exchange(false, std::memory_order_relaxed) ||
+        channels != cur_channels || rate != cur_rate ||
+        llabs(start - expected) > rate / 500 + 1)
+        start_over(time, channels, rate);
 
-    while (1)
+    int needed = pending_len + data.len();
+
+    if (pending_size < needed)
     {
-        if (current_node)
-            assert(current_node->channels == channels);
-        else
-        {
-            int node_time = time;
+        float * grown = new float[needed];
+        memcpy(grown, pending, sizeof(float) * pending_len);
+        delete[] pending;
 
-            /* There is no partly-built node, so start a new one.  Normally
-             * there will be nodes in the queue already; if so, we want to copy
-             * audio data from the signal starting at 30 milliseconds after the
-             * beginning of the most recent node.  If there are no nodes in the
-             * queue, we are at the beginning of the song or had an underrun,
-             * and we want to copy the earliest audio data we have. */
+        pending = grown;
+        pending_size = needed;
+    }
 
-            VisNode * tail = vis_list.tail();
-            if (tail)
-                node_time = tail->time + INTERVAL;
+    memcpy(pending + pending_len, data.begin(), sizeof(float) * data.len());
+    pending_len = needed;
 
-            at = channels * (int)((int64_t)(node_time - time) * rate / 1000);
+    /* We can build a single node from multiple calls; we can also build
+     * multiple nodes from the same call.  Each node is built as soon as all of
+     * its window has been passed in. */
+    int64_t end = pending_frame + pending_len / channels;
+    int64_t next_frame = aud::rescale<int64_t>(next_time, 1000, rate);
 
-            if (at < 0)
-                at = 0;
-            if (at >= data.len())
-                break;
+    while (next_frame + cur_frames <= end)
+    {
+        fill_node(pending + channels * (int)(next_frame - pending_frame),
+                  next_time);
 
-            current_node = vis_pool.head();
+        next_time += cur_interval;
+        next_frame = aud::rescale<int64_t>(next_time, 1000, rate);
+    }
 
-            if (current_node)
-            {
-                assert(current_node->channels == channels);
-                vis_pool.remove(current_node);
-                current_node->time = node_time;
-            }
-            else
-                current_node = new VisNode(channels, node_time);
+    /* keep only what the next node needs */
+    int drop = channels * aud::clamp((int)(next_frame - pending_frame), 0,
+                                     pending_len / channels);
 
-            current_frames = 0;
-        }
+    memmove(pending, pending + drop, sizeof(float) * (pending_len - drop));
+    pending_len -= drop;
+    pending_frame += drop / channels;
 
-        /* Copy as much data as we can, limited by how much we have and how much
-         * space is left in the node.  If we cannot fill the node, we return and
-         * wait for more data to be passed in the next call.  If we do fill the
-         * node, we loop and start building a new one. */
+    in_audio.store(false, std::memory_order_release);
+}
+
+void vis_runner_set_frames(int frames)
+{
+    auto mh = mutex.take();
 
-        int copy = aud::min(data.len() - at,
-                            channels * (FRAMES_PER_NODE - current_frames));
-        memcpy(current_node->data + channels * current_frames, &data[at],
-               sizeof(float) * copy);
-        current_frames += copy / channels;
+    frames = aud::clamp(frames, MIN_FRAMES, MAX_FRAMES);
 
-        if (current_frames < FRAMES_PER_NODE)
-            break;
+    if (frames != frames_wanted.load(std::memory_order_relaxed))
+    {
+        frames_wanted.store(frames, std::memory_order_relaxed);
+        flush(mh);
+    }
+}
+
+void vis_runner_set_rate(int rate)
+{
+    auto mh = mutex.take();
+
+    int ms = 1000 / aud::clamp(rate, MIN_RATE, MAX_RATE);
+
+    if (ms != interval.load(std::memory_order_relaxed))
+    {
+        interval.store(ms, std::memory_order_relaxed);
+        flush(mh);
+    }
+}
 
-        vis_list.append(current_node);
-        current_node = nullptr;
+/* called once neither the worker nor the audio thread is using the buffers */
+static void release_buffers()
+{
+    for (VisNode & node : nodes)
+    {
+        node.state.store(NODE_FREE, std::memory_order_relaxed);
+        delete[] node.data;
+        node.data = nullptr;
+        node.size = 0;
     }
+
+    delete[] pending;
+    pending = nullptr;
+    pending_size = pending_len = 0;
+
+    n_nodes.store(MIN_NODES, std::memory_order_relaxed);
+    next_node = 0;
 }
 
+/* called from the main thread only */
 void vis_runner_enable(bool enable)
 {
     auto mh = mutex.take();
+
+    if (enable == enabled)
+        return;
+
     enabled = enable;
     start_stop(mh, playing, paused);
+
+    if (enable)
+        worker = std::thread(run_worker);
+    else
+    {
+        mh.unlock();
+        worker.join();
+
+        /* the audio thread sees that the runner is inactive on its next call
+         * to vis_runner_pass_audio(), but may still be in the current one */
+        while (in_audio.load())
+            std::this_thread::yield();
+
+        release_buffers();
+    }
 }
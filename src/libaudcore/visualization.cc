@@ -20,20 +20,126 @@
 #include "interface.h"
 #include "internal.h"
 
+#include <stdint.h>
 #include <string.h>
 
+#include <chrono>
+
+#include "mainloop.h"
 #include "plugin.h"
 #include "plugins.h"
 #include "runtime.h"
+#include "threads.h"
+
+#define PCM_FRAMES 512
+#define MIN_FFT_SIZE 256
+#define MAX_FFT_SIZE 16384
+#define MIN_FRAME_RATE 1
+#define MAX_FRAME_RATE 240
+
+/* The data for the visualizers is computed by the worker thread of
+ * vis-runner.cc, which wakes up at the highest frame rate requested; each
+ * visualizer is included in the frames that fall due at its own rate.  The
+ * worker computes each frame into the back one of two buffers, swaps it to
+ * the front when done, and asks the main thread to render it, so that the main
+ * thread only has to call the render functions.  If the main thread is still
+ * rendering the front buffer, the worker drops its frame rather than wait.
+ * The list of visualizers is changed only by the main thread, with the mutex
+ * held so that the worker can read it. */
+
+struct VisEntry
+{
+    Visualizer * vis;
+    int64_t due; /* microseconds; used by the worker */
+};
+
+struct Spectrum
+{
+    int size;
+    Index<float> freq;
+};
 
-static Index<Visualizer *> visualizers;
+struct VisOutput
+{
+    Visualizer * vis;
+    int type_mask, fft_size, freq_bands;
+    int spectrum; /* index into spectra */
+    Index<float> bands;
+};
+
+struct VisFrame
+{
+    int channels;
+    Index<float> mono, multi;
+    Index<Spectrum> spectra;
+    Index<VisOutput> outputs;
+};
+
+static aud::mutex mutex;
+static Index<VisEntry> visualizers;
+static int tick; /* microseconds between wakeups of the worker */
+
+static VisFrame frames[2];
+static VisFrame * back = &frames[0], * front = &frames[1];
+static bool front_ready, rendering;
+static QueuedFunc queued_render;
 
 static int running = false;
 static int num_enabled = 0;
 
+static int64_t get_time_us()
+{
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+}
+
+/* rounds up to a supported size, in case the visualizer asks for another */
+static int get_fft_size(Visualizer * vis)
+{
+    int size = MIN_FFT_SIZE;
+    while (size < MAX_FFT_SIZE && size < vis->fft_size)
+        size <<= 1;
+
+    return size;
+}
+
+static int get_frame_rate(Visualizer * vis)
+{
+    return aud::clamp(vis->frame_rate, MIN_FRAME_RATE, MAX_FRAME_RATE);
+}
+
+/* the audio passed in must be long enough for the largest transform, and come
+ * often enough for the highest frame rate */
+static void update_runner()
+{
+    int frames = PCM_FRAMES;
+    int rate = MIN_FRAME_RATE;
+
+    for (const VisEntry & entry : visualizers)
+    {
+        if ((entry.vis->type_mask & Visualizer::Freq))
+            frames = aud::max(frames, get_fft_size(entry.vis));
+
+        rate = aud::max(rate, get_frame_rate(entry.vis));
+    }
+
+    {
+        auto mh = mutex.take();
+        tick = 1000000 / rate;
+    }
+
+    vis_runner_set_frames(frames);
+    vis_runner_set_rate(rate);
+}
+
 EXPORT void aud_visualizer_add(Visualizer * vis)
 {
-    visualizers.append(vis);
+    {
+        auto mh = mutex.take();
+        visualizers.append(VisEntry{vis, 0});
+    }
+
+    update_runner();
 
     num_enabled++;
     if (num_enabled == 1)
@@ -44,35 +150,106 @@ EXPORT void aud_visualizer_remove(Visualizer * vis)
 {
     int num_disabled = 0;
 
-    auto is_match = [&](Visualizer * vis2) {
-        if (vis2 != vis)
+    auto is_match = [&](const VisEntry & entry) {
+        if (entry.vis != vis)
             return false;
 
         num_disabled++;
         return true;
     };
 
-    visualizers.remove_if(is_match, true);
+    {
+        auto mh = mutex.take();
+        visualizers.remove_if(is_match, true);
+    }
+
+    update_runner();
 
     num_enabled -= num_disabled;
-    if (!num_enabled)
-        vis_runner_enable(false);
+    if (num_enabled)
+        return;
+
+    /* the worker has exited once this returns */
+    vis_runner_enable(false);
+
+    auto mh = mutex.take();
+
+    queued_render.stop();
+    front_ready = false;
+
+    for (VisFrame & frame : frames)
+        frame = VisFrame();
+}
+
+/* called from the main thread only */
+static bool is_visualizer(Visualizer * vis)
+{
+    for (const VisEntry & entry : visualizers)
+    {
+        if (entry.vis == vis)
+            return true;
+    }
+
+    return false;
 }
 
 void vis_send_clear()
 {
-    for (Visualizer * vis : visualizers)
-        vis->clear();
+    {
+        auto mh = mutex.take();
+        queued_render.stop();
+        front_ready = false;
+    }
+
+    for (const VisEntry & entry : visualizers)
+        entry.vis->clear();
+}
+
+static void render_frame()
+{
+    auto mh = mutex.take();
+
+    if (!front_ready)
+        return;
+
+    front_ready = false;
+    rendering = true;
+
+    mh.unlock();
+
+    for (const VisOutput & out : front->outputs)
+    {
+        /* the visualizer may have been removed in the meantime */
+        if (!is_visualizer(out.vis))
+            continue;
+
+        if ((out.type_mask & Visualizer::MonoPCM))
+            out.vis->render_mono_pcm(front->mono.begin());
+        if ((out.type_mask & Visualizer::MultiPCM))
+            out.vis->render_multi_pcm(front->multi.begin(), front->channels);
+
+        if ((out.type_mask & Visualizer::Freq))
+        {
+            if (out.freq_bands > 0)
+                out.vis->render_freq(out.bands.begin());
+            else
+                out.vis->render_freq(front->spectra[out.spectrum].freq.begin());
+        }
+    }
+
+    mh.lock();
+    rendering = false;
 }
 
-static void pcm_to_mono(const float * data, float * mono, int channels)
+static void pcm_to_mono(const float * data, float * mono, int channels,
+                        int frames)
 {
     if (channels == 1)
-        memcpy(mono, data, sizeof(float) * 512);
+        memcpy(mono, data, sizeof(float) * frames);
     else
     {
         float * set = mono;
-        while (set < &mono[512])
+        while (set < &mono[frames])
         {
             *set++ = (data[0] + data[1]) / 2;
             data += channels;
@@ -80,35 +257,109 @@ static void pcm_to_mono(const float * data, float * mono, int channels)
     }
 }
 
-void vis_send_audio(const float * data, int channels)
+/* each size of transform is computed only once for all the visualizers */
+static int get_spectrum(Index<Spectrum> & spectra, const float * mono,
+                        int size)
 {
-    auto is_active = [](int type_mask) {
-        for (Visualizer * vis : visualizers)
-        {
-            if ((vis->type_mask & type_mask))
-                return true;
-        }
+    for (int i = 0; i < spectra.len(); i++)
+    {
+        if (spectra[i].size == size)
+            return i;
+    }
 
-        return false;
-    };
+    Spectrum & spectrum = spectra.append();
+    spectrum.size = size;
+    spectrum.freq.resize(size / 2);
+
+    calc_freq(mono, spectrum.freq.begin(), size);
+    return spectra.len() - 1;
+}
+
+/* called from the worker thread only */
+void vis_send_audio(const float * data, int channels, int frames)
+{
+    int64_t now = get_time_us();
+
+    auto mh = mutex.take();
+
+    /* the back buffer is ours, but it could not be swapped in */
+    if (rendering)
+        return;
+
+    VisFrame & frame = *back;
+    frame.outputs.clear();
+
+    for (VisEntry & entry : visualizers)
+    {
+        if (entry.due - now > tick / 2)
+            continue;
+
+        int period = 1000000 / get_frame_rate(entry.vis);
+        entry.due = aud::max(entry.due + period, now);
+
+        Visualizer * vis = entry.vis;
+        frame.outputs.append(VisOutput{vis, vis->type_mask, get_fft_size(vis),
+                                       vis->freq_bands, -1, Index<float>()});
+    }
+
+    mh.unlock();
+
+    if (!frame.outputs.len())
+        return;
+
+    int mono_frames = 0;
+    bool multi = false;
+
+    for (const VisOutput & out : frame.outputs)
+    {
+        if ((out.type_mask & Visualizer::MonoPCM))
+            mono_frames = aud::max(mono_frames, PCM_FRAMES);
+        if ((out.type_mask & Visualizer::MultiPCM))
+            multi = true;
+        if ((out.type_mask & Visualizer::Freq))
+            mono_frames = aud::max(mono_frames, out.fft_size);
+    }
+
+    /* the audio may fall short for a moment after a visualizer asking for a
+     * larger transform is added; the rest is left silent */
+    frame.mono.clear();
+    frame.mono.insert(0, mono_frames);
+    pcm_to_mono(data, frame.mono.begin(), channels,
+                aud::min(frames, mono_frames));
+
+    frame.channels = channels;
+    frame.multi.clear();
 
-    float mono[512];
-    float freq[256];
+    if (multi)
+        frame.multi.insert(data, 0, channels * PCM_FRAMES);
 
-    if (is_active(Visualizer::MonoPCM | Visualizer::Freq))
-        pcm_to_mono(data, mono, channels);
-    if (is_active(Visualizer::Freq))
-        calc_freq(mono, freq);
+    frame.spectra.clear();
 
-    for (Visualizer * vis : visualizers)
+    for (VisOutput & out : frame.outputs)
     {
-        if ((vis->type_mask & Visualizer::MonoPCM))
-            vis->render_mono_pcm(mono);
-        if ((vis->type_mask & Visualizer::MultiPCM))
-            vis->render_multi_pcm(data, channels);
-        if ((vis->type_mask & Visualizer::Freq))
-            vis->render_freq(freq);
+        if (!(out.type_mask & Visualizer::Freq))
+            continue;
+
+        out.spectrum =
+            get_spectrum(frame.spectra, frame.mono.begin(), out.fft_size);
+
+        if (out.freq_bands > 0)
+        {
+            out.bands.resize(out.freq_bands);
+            calc_freq_bands(frame.spectra[out.spectrum].freq.begin(),
+                            out.fft_size / 2, out.bands.begin(),
+                            out.freq_bands);
+        }
     }
+
+    mh.lock();
+
+    if (rendering)
+        return;
+
+    std::swap(back, front);
+    front_ready = true;
+    queued_render.queue(render_frame);
 }
 
 static bool vis_load(PluginHandle * plugin)
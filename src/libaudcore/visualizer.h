@@ -33,7 +33,28 @@ public:
     };
 
     const int type_mask;
-    constexpr Visualizer(int type_mask) : type_mask(type_mask) {}
+
+    /* size of the transform used for render_freq(), a power of 2 from 256 to
+     * 16384; larger sizes give a finer frequency resolution */
+    const int fft_size;
+
+    /* if nonzero, render_freq() is passed this many bands, spaced
+     * logarithmically (see compute_log_xscale), instead of fft_size / 2 */
+    const int freq_bands;
+
+    /* how many times per second the render functions are called, from 1 to
+     * 240 (while audio is playing) */
+    const int frame_rate;
+
+    constexpr Visualizer(int type_mask, int fft_size = 512, int freq_bands = 0,
+                         int frame_rate = 30)
+        : type_mask(type_mask), fft_size(fft_size), freq_bands(freq_bands),
+          frame_rate(frame_rate)
+    {
+    }
+
+    /* The data for the render functions is computed in a separate thread, but
+     * the render functions themselves are called from the main thread. */
 
     /* reset internal state and clear display */
     virtual void clear() = 0;
@@ -44,7 +65,8 @@ public:
     /* 512 frames of an interleaved multi-channel PCM signal */
     virtual void render_multi_pcm(const float * pcm, int channels) {}
 
-    /* intensity of frequencies 1/512, 2/512, ..., 256/512 of sample rate */
+    /* intensity of frequencies 1/N, 2/N, ..., (N/2)/N of sample rate, where N
+     * is fft_size (512 by default), or of freq_bands bands if set */
     virtual void render_freq(const float * freq) {}
 
     /* common math for rendering a frequency graph (see util.cc) */
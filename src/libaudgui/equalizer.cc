@@ -51,23 +51,48 @@ static GtkWidget * create_on_off ()
     return on_off;
 }
 
+static void band_mode_cb (GtkToggleButton * toggle)
+{
+    aud_set_bool ("equalizer_31band", gtk_toggle_button_get_active (toggle));
+}
+
+static void band_mode_update (void *, GtkWidget * window)
+{
+    bool is_31band = aud_get_bool (nullptr, "equalizer_31band");
+
+    GtkWidget * toggle = (GtkWidget *) g_object_get_data ((GObject *) window, "band_mode");
+    GtkWidget * bands = (GtkWidget *) g_object_get_data ((GObject *) window, "bands");
+    GtkWidget * bands_31 = (GtkWidget *) g_object_get_data ((GObject *) window, "bands_31");
+
+    gtk_toggle_button_set_active ((GtkToggleButton *) toggle, is_31band);
+    gtk_widget_set_visible (bands, ! is_31band);
+    gtk_widget_set_visible (bands_31, is_31band);
+}
+
 static void reset_to_zero ()
 {
     aud_eq_apply_preset (EqualizerPreset ());
+
+    double zeros[AUD_EQ_NBANDS_31] = {};
+    aud_eq_set_bands_31 (zeros);
 }
 
 static void slider_moved (GtkRange * slider)
 {
     int band = GPOINTER_TO_INT (g_object_get_data ((GObject *) slider, "band"));
+    bool is_31band = GPOINTER_TO_INT (g_object_get_data ((GObject *) slider, "31band"));
     double value = round (gtk_range_get_value (slider));
 
     if (band == -1)
         aud_set_double ("equalizer_preamp", value);
+    else if (is_31band)
+        aud_eq_set_band_31 (band, value);
     else
         aud_eq_set_band (band, value);
 }
 
-static GtkWidget * create_slider (const char * name, int band, GtkWidget * hbox)
+static GtkWidget * create_slider (const char * name, int band, GtkWidget * hbox,
+ bool is_31band = false)
 {
     GtkWidget * vbox = audgui_vbox_new (6);
 
@@ -85,6 +110,7 @@ static GtkWidget * create_slider (const char * name, int band, GtkWidget * hbox)
     gtk_widget_set_size_request (slider, -1, audgui_get_dpi () * 5 / 4);
 
     g_object_set_data ((GObject *) slider, "band", GINT_TO_POINTER (band));
+    g_object_set_data ((GObject *) slider, "31band", GINT_TO_POINTER (is_31band));
     g_signal_connect (slider, "value-changed", (GCallback) slider_moved, nullptr);
 
     gtk_box_pack_start ((GtkBox *) vbox, slider, false, false, 0);
@@ -114,12 +140,24 @@ static void update_sliders (void *, GtkWidget * window)
         GtkWidget * slider = (GtkWidget *) g_object_get_data ((GObject *) window, slider_id);
         set_slider (slider, values[i]);
     }
+
+    double values_31[AUD_EQ_NBANDS_31];
+    aud_eq_get_bands_31 (values_31);
+
+    for (int i = 0; i < AUD_EQ_NBANDS_31; i ++)
+    {
+        StringBuf slider_id = str_printf ("slider_31_%d", i);
+        GtkWidget * slider = (GtkWidget *) g_object_get_data ((GObject *) window, slider_id);
+        set_slider (slider, values_31[i]);
+    }
 }
 
 static void destroy_cb ()
 {
     hook_dissociate ("set equalizer_active", (HookFunction) on_off_update);
+    hook_dissociate ("set equalizer_31band", (HookFunction) band_mode_update);
     hook_dissociate ("set equalizer_bands", (HookFunction) update_sliders);
+    hook_dissociate ("set equalizer_bands_31", (HookFunction) update_sliders);
     hook_dissociate ("set equalizer_preamp", (HookFunction) update_sliders);
 }
 
@@ -129,6 +167,12 @@ static GtkWidget * create_window ()
      N_("125 Hz"), N_("250 Hz"), N_("500 Hz"), N_("1 kHz"), N_("2 kHz"),
      N_("4 kHz"), N_("8 kHz"), N_("16 kHz")};
 
+    /* ISO 1/3-octave center frequencies */
+    const char * const names_31[AUD_EQ_NBANDS_31] = {"20", "25", "31.5",
+     "40", "50", "63", "80", "100", "125", "160", "200", "250", "315", "400",
+     "500", "630", "800", "1k", "1.25k", "1.6k", "2k", "2.5k", "3.15k", "4k",
+     "5k", "6.3k", "8k", "10k", "12.5k", "16k", "20k"};
+
     GtkWidget * window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title ((GtkWindow *) window, _("Equalizer"));
     gtk_window_set_role ((GtkWindow *) window, "equalizer");
@@ -145,6 +189,11 @@ static GtkWidget * create_window ()
 
     gtk_box_pack_start ((GtkBox *) top_row, create_on_off (), false, false, 0);
 
+    GtkWidget * band_mode = gtk_check_button_new_with_mnemonic (_("_31 bands"));
+    g_signal_connect (band_mode, "toggled", (GCallback) band_mode_cb, nullptr);
+    gtk_box_pack_start ((GtkBox *) top_row, band_mode, false, false, 0);
+    g_object_set_data ((GObject *) window, "band_mode", band_mode);
+
     GtkWidget * presets = audgui_button_new (_("Presets ..."), nullptr,
      (AudguiCallback) audgui_show_eq_preset_window, nullptr);
     gtk_box_pack_end ((GtkBox *) top_row, presets, false, false, 0);
@@ -162,17 +211,41 @@ static GtkWidget * create_window ()
     gtk_box_pack_start ((GtkBox *) hbox,
      audgui_separator_new (GTK_ORIENTATION_VERTICAL), false, false, 0);
 
+    /* only one set of bands is shown at a time */
+    GtkWidget * bands = audgui_hbox_new (6);
+    gtk_box_pack_start ((GtkBox *) hbox, bands, false, false, 0);
+    g_object_set_data ((GObject *) window, "bands", bands);
+
     for (int i = 0; i < AUD_EQ_NBANDS; i ++)
     {
         StringBuf slider_id = str_printf ("slider%d", i);
-        GtkWidget * slider = create_slider (_(names[i]), i, hbox);
+        GtkWidget * slider = create_slider (_(names[i]), i, bands);
         g_object_set_data ((GObject *) window, slider_id, slider);
     }
 
+    GtkWidget * bands_31 = audgui_hbox_new (6);
+    gtk_box_pack_start ((GtkBox *) hbox, bands_31, false, false, 0);
+    g_object_set_data ((GObject *) window, "bands_31", bands_31);
+
+    for (int i = 0; i < AUD_EQ_NBANDS_31; i ++)
+    {
+        StringBuf slider_id = str_printf ("slider_31_%d", i);
+        GtkWidget * slider = create_slider (names_31[i], i, bands_31, true);
+        g_object_set_data ((GObject *) window, slider_id, slider);
+    }
+
+    gtk_widget_show_all (bands);
+    gtk_widget_show_all (bands_31);
+    gtk_widget_set_no_show_all (bands, true);
+    gtk_widget_set_no_show_all (bands_31, true);
+
     update_sliders (nullptr, window);
+    band_mode_update (nullptr, window);
 
     hook_associate ("set equalizer_preamp", (HookFunction) update_sliders, window);
     hook_associate ("set equalizer_bands", (HookFunction) update_sliders, window);
+    hook_associate ("set equalizer_bands_31", (HookFunction) update_sliders, window);
+    hook_associate ("set equalizer_31band", (HookFunction) band_mode_update, window);
 
     g_signal_connect (window, "destroy", (GCallback) destroy_cb, nullptr);
 
@@ -146,6 +146,18 @@ static const ComboItem record_elements[] = {
     ComboItem (N_("After applying equalization"), (int) OutputStream::AfterEqualizer)
 };
 
+static const ComboItem record_overflow_elements[] = {
+    ComboItem (N_("Pause playback"), (int) RecordOverflow::Block),
+    ComboItem (N_("Skip audio"), (int) RecordOverflow::Drop),
+    ComboItem (N_("Use a larger buffer"), (int) RecordOverflow::Grow)
+};
+
+static const ComboItem resample_quality_elements[] = {
+    ComboItem (N_("Fast"), (int) ResampleQuality::Fast),
+    ComboItem (N_("Medium"), (int) ResampleQuality::Medium),
+    ComboItem (N_("Best"), (int) ResampleQuality::Best)
+};
+
 static const ComboItem replaygainmode_elements[] = {
     ComboItem (N_("Track"), (int) ReplayGainMode::Track),
     ComboItem (N_("Album"), (int) ReplayGainMode::Album),
@@ -196,6 +208,9 @@ static void output_combo_changed ();
 static void * output_create_config_button ();
 static void * output_create_about_button ();
 static void output_bit_depth_changed ();
+static void output_thread_changed ();
+static void effect_threads_changed ();
+static void low_latency_changed ();
 
 static const PreferencesWidget output_combo_widgets[] = {
     WidgetCombo (N_("Output plugin:"),
@@ -236,6 +251,24 @@ static const PreferencesWidget audio_page_widgets[] = {
     WidgetSpin (N_("Buffer size:"),
         WidgetInt (0, "output_buffer_size"),
         {100, 10000, 1000, N_("ms")}),
+    WidgetCheck (N_("Write audio from a separate thread"),
+        WidgetBool (0, "output_thread", output_thread_changed)),
+    WidgetSpin (N_("Decode ahead by:"),
+        WidgetInt (0, "output_thread_ahead"),
+        {20, 10000, 10, N_("ms")}, WIDGET_CHILD),
+    WidgetCheck (N_("Run each effect in a separate thread"),
+        WidgetBool (0, "effect_threads", effect_threads_changed)),
+    WidgetCheck (N_("Low-latency mode"),
+        WidgetBool (0, "low_latency", low_latency_changed)),
+    WidgetSpin (N_("Target latency:"),
+        WidgetInt (0, "target_latency"),
+        {1, 1000, 1, N_("ms")}, WIDGET_CHILD),
+    WidgetCheck (N_("Resample when the sample rate changes"),
+        WidgetBool (0, "resample_output")),
+    WidgetCombo (N_("Resampling quality:"),
+        WidgetInt (0, "resample_quality"),
+        {{resample_quality_elements}},
+        WIDGET_CHILD),
     WidgetCheck (N_("Soft clipping"),
         WidgetBool (0, "soft_clipping")),
     WidgetCheck (N_("Use software volume control (not recommended)"),
@@ -247,6 +280,9 @@ static const PreferencesWidget audio_page_widgets[] = {
     WidgetCombo (N_("Record stream:"),
         WidgetInt (0, "record_stream"),
         {{record_elements}}),
+    WidgetCombo (N_("If recording falls behind:"),
+        WidgetInt (0, "record_overflow"),
+        {{record_overflow_elements}}),
     WidgetLabel (N_("<b>ReplayGain</b>")),
     WidgetCheck (N_("Enable ReplayGain"),
         WidgetBool (0, "enable_replay_gain")),
@@ -326,6 +362,12 @@ static const PreferencesWidget playlist_page_widgets[] = {
         WidgetBool (0, "clear_playlist")),
     WidgetCheck (N_("Open files in a temporary playlist"),
         WidgetBool (0, "open_to_temporary")),
+    WidgetCheck (N_("Decode the next song ahead of time"),
+        WidgetBool (0, "gapless_preroll")),
+    WidgetSpin (N_("Start decoding:"),
+        WidgetInt (0, "preroll_seconds"),
+        {1, 30, 1, N_("seconds before the end")},
+        WIDGET_CHILD),
     WidgetLabel (N_("<b>Song Display</b>")),
     WidgetCheck (N_("Show song numbers"),
         WidgetBool (0, "show_numbers_in_pl", send_title_change)),
@@ -382,6 +424,9 @@ static const PreferencesWidget advanced_page_widgets[] = {
         WidgetBool (0, "metadata_on_play")),
     WidgetCheck (N_("Probe content of files with no recognized file name extension"),
         WidgetBool (0, "slow_probe")),
+    WidgetSpin (N_("Threads for reading metadata:"),
+        WidgetInt (0, "scan_threads"),
+        {0, 32, 1, N_("(0 = automatic)")}),
     WidgetLabel (N_("<b>Miscellaneous</b>")),
     WidgetSpin (N_("Step forward/backward by:"),
         WidgetInt (0, "step_size"),
@@ -746,6 +791,22 @@ static void output_bit_depth_changed ()
     aud_output_reset (OutputReset::ReopenStream);
 }
 
+static void output_thread_changed ()
+{
+    aud_output_reset (OutputReset::ReopenStream);
+}
+
+static void effect_threads_changed ()
+{
+    aud_output_reset (OutputReset::EffectsOnly);
+}
+
+static void low_latency_changed ()
+{
+    /* the output buffering follows the setting by itself */
+    aud_output_reset (OutputReset::EffectsOnly);
+}
+
 static void * output_create_config_button ()
 {
     auto do_config = [] (void *)
@@ -96,6 +96,13 @@ public:
     }
 };
 
+/* ISO 1/3-octave center frequencies */
+static const char * const names_31[AUD_EQ_NBANDS_31] = {
+    "20",     "25",     "31.5",   "40",     "50",     "63",     "80",     "100",
+    "125",    "160",    "200",    "250",    "315",    "400",    "500",    "630",
+    "800",    "1k",     "1.25k",  "1.6k",   "2k",     "2.5k",   "3.15k",  "4k",
+    "5k",     "6.3k",   "8k",     "10k",    "12.5k",  "16k",    "20k"};
+
 class EqualizerWindow : public QWidget
 {
 public:
@@ -103,21 +110,30 @@ public:
 
 private:
     QCheckBox m_onoff_checkbox;
+    QCheckBox m_31band_checkbox;
     EqualizerSlider * m_preamp_slider;
+    QWidget * m_bands_container;
+    QWidget * m_bands_31_container;
     EqualizerSlider * m_sliders[AUD_EQ_NBANDS];
+    EqualizerSlider * m_sliders_31[AUD_EQ_NBANDS_31];
 
     void updateActive();
     void updatePreamp();
     void updateBands();
+    void update31Band();
+    void updateBands31();
 
     const HookReceiver<EqualizerWindow> //
         hook1{"set equalizer_active", this, &EqualizerWindow::updateActive},
         hook2{"set equalizer_preamp", this, &EqualizerWindow::updatePreamp},
-        hook3{"set equalizer_bands", this, &EqualizerWindow::updateBands};
+        hook3{"set equalizer_bands", this, &EqualizerWindow::updateBands},
+        hook4{"set equalizer_31band", this, &EqualizerWindow::update31Band},
+        hook5{"set equalizer_bands_31", this, &EqualizerWindow::updateBands31};
 };
 
 EqualizerWindow::EqualizerWindow()
-    : m_onoff_checkbox(audqt::translate_str(N_("_Enable")))
+    : m_onoff_checkbox(audqt::translate_str(N_("_Enable"))),
+      m_31band_checkbox(audqt::translate_str(N_("_31 bands")))
 {
     const char * const names[AUD_EQ_NBANDS] = {
         N_("31 Hz"), N_("63 Hz"), N_("125 Hz"), N_("250 Hz"), N_("500 Hz"),
@@ -134,10 +150,26 @@ EqualizerWindow::EqualizerWindow()
     line->setFrameShadow(QFrame::Sunken);
     slider_layout->addWidget(line);
 
+    /* only one set of bands is shown at a time */
+    m_bands_container = new QWidget(this);
+    auto bands_layout = audqt::make_hbox(m_bands_container, audqt::sizes.TwoPt);
+    slider_layout->addWidget(m_bands_container);
+
     for (int i = 0; i < AUD_EQ_NBANDS; i++)
     {
         m_sliders[i] = new EqualizerSlider(_(names[i]), this);
-        slider_layout->addWidget(m_sliders[i]);
+        bands_layout->addWidget(m_sliders[i]);
+    }
+
+    m_bands_31_container = new QWidget(this);
+    auto bands_31_layout =
+        audqt::make_hbox(m_bands_31_container, audqt::sizes.TwoPt);
+    slider_layout->addWidget(m_bands_31_container);
+
+    for (int i = 0; i < AUD_EQ_NBANDS_31; i++)
+    {
+        m_sliders_31[i] = new EqualizerSlider(names_31[i], this);
+        bands_31_layout->addWidget(m_sliders_31[i]);
     }
 
     auto zero_button = new QPushButton(_("Reset to Zero"), this);
@@ -145,6 +177,7 @@ EqualizerWindow::EqualizerWindow()
 
     auto hbox = audqt::make_hbox(nullptr);
     hbox->addWidget(&m_onoff_checkbox);
+    hbox->addWidget(&m_31band_checkbox);
     hbox->addStretch(1);
     hbox->addWidget(zero_button);
     hbox->addWidget(preset_button);
@@ -161,13 +194,23 @@ EqualizerWindow::EqualizerWindow()
     updateActive();
     updatePreamp();
     updateBands();
+    update31Band();
+    updateBands31();
 
     connect(&m_onoff_checkbox, &QCheckBox::stateChanged, [](int state) {
         aud_set_bool("equalizer_active", (state == Qt::Checked));
     });
 
-    connect(zero_button, &QPushButton::clicked,
-            []() { aud_eq_apply_preset(EqualizerPreset()); });
+    connect(&m_31band_checkbox, &QCheckBox::stateChanged, [](int state) {
+        aud_set_bool("equalizer_31band", (state == Qt::Checked));
+    });
+
+    connect(zero_button, &QPushButton::clicked, []() {
+        aud_eq_apply_preset(EqualizerPreset());
+
+        double zeros[AUD_EQ_NBANDS_31] = {};
+        aud_eq_set_bands_31(zeros);
+    });
 
     connect(preset_button, &QPushButton::clicked, audqt::eq_presets_show);
 
@@ -179,6 +222,12 @@ EqualizerWindow::EqualizerWindow()
         connect(&m_sliders[i]->slider, &QSlider::valueChanged,
                 [i](int value) { aud_eq_set_band(i, value); });
     }
+
+    for (int i = 0; i < AUD_EQ_NBANDS_31; i++)
+    {
+        connect(&m_sliders_31[i]->slider, &QSlider::valueChanged,
+                [i](int value) { aud_eq_set_band_31(i, value); });
+    }
 }
 
 void EqualizerWindow::updateActive()
@@ -201,6 +250,23 @@ void EqualizerWindow::updateBands()
         m_sliders[i]->slider.setValue(values[i]);
 }
 
+void EqualizerWindow::update31Band()
+{
+    bool is_31band = aud_get_bool("equalizer_31band");
+    m_31band_checkbox.setCheckState(is_31band ? Qt::Checked : Qt::Unchecked);
+    m_bands_container->setVisible(!is_31band);
+    m_bands_31_container->setVisible(is_31band);
+}
+
+void EqualizerWindow::updateBands31()
+{
+    double values[AUD_EQ_NBANDS_31];
+    aud_eq_get_bands_31(values);
+
+    for (int i = 0; i < AUD_EQ_NBANDS_31; i++)
+        m_sliders_31[i]->slider.setValue(values[i]);
+}
+
 EXPORT void equalizer_show()
 {
     dock_show_simple("equalizer", _("Equalizer"),
@@ -208,6 +208,16 @@ static const ComboItem record_elements[] = {
     ComboItem(N_("After applying equalization"),
               (int)OutputStream::AfterEqualizer)};
 
+static const ComboItem record_overflow_elements[] = {
+    ComboItem(N_("Pause playback"), (int)RecordOverflow::Block),
+    ComboItem(N_("Skip audio"), (int)RecordOverflow::Drop),
+    ComboItem(N_("Use a larger buffer"), (int)RecordOverflow::Grow)};
+
+static const ComboItem resample_quality_elements[] = {
+    ComboItem(N_("Fast"), (int)ResampleQuality::Fast),
+    ComboItem(N_("Medium"), (int)ResampleQuality::Medium),
+    ComboItem(N_("Best"), (int)ResampleQuality::Best)};
+
 static const ComboItem replaygainmode_elements[] = {
     ComboItem(N_("Track"), (int)ReplayGainMode::Track),
     ComboItem(N_("Album"), (int)ReplayGainMode::Album),
@@ -279,6 +289,9 @@ static const PreferencesWidget appearance_page_widgets[] = {
     WidgetCustomQt(iface_create_prefs_box)};
 
 static void output_bit_depth_changed();
+static void output_thread_changed();
+static void effect_threads_changed();
+static void low_latency_changed();
 
 static const PreferencesWidget output_combo_widgets[] = {
     WidgetCombo(N_("Output plugin:"),
@@ -307,6 +320,20 @@ static const PreferencesWidget audio_page_widgets[] = {
                 {{bitdepth_elements}}),
     WidgetSpin(N_("Buffer size:"), WidgetInt(0, "output_buffer_size"),
                {100, 10000, 1000, N_("ms")}),
+    WidgetCheck(N_("Write audio from a separate thread"),
+                WidgetBool(0, "output_thread", output_thread_changed)),
+    WidgetSpin(N_("Decode ahead by:"), WidgetInt(0, "output_thread_ahead"),
+               {20, 10000, 10, N_("ms")}, WIDGET_CHILD),
+    WidgetCheck(N_("Run each effect in a separate thread"),
+                WidgetBool(0, "effect_threads", effect_threads_changed)),
+    WidgetCheck(N_("Low-latency mode"),
+                WidgetBool(0, "low_latency", low_latency_changed)),
+    WidgetSpin(N_("Target latency:"), WidgetInt(0, "target_latency"),
+               {1, 1000, 1, N_("ms")}, WIDGET_CHILD),
+    WidgetCheck(N_("Resample when the sample rate changes"),
+                WidgetBool(0, "resample_output")),
+    WidgetCombo(N_("Resampling quality:"), WidgetInt(0, "resample_quality"),
+                {{resample_quality_elements}}, WIDGET_CHILD),
     WidgetCheck(N_("Soft clipping"), WidgetBool(0, "soft_clipping")),
     WidgetCheck(N_("Use software volume control (not recommended)"),
                 WidgetBool(0, "software_volume_control")),
@@ -315,6 +342,9 @@ static const PreferencesWidget audio_page_widgets[] = {
     WidgetBox({{record_buttons}, true}, WIDGET_CHILD),
     WidgetCombo(N_("Record stream:"), WidgetInt(0, "record_stream"),
                 {{record_elements}}),
+    WidgetCombo(N_("If recording falls behind:"),
+                WidgetInt(0, "record_overflow"),
+                {{record_overflow_elements}}),
     WidgetLabel(N_("<b>ReplayGain</b>")),
     WidgetCheck(N_("Enable ReplayGain"), WidgetBool(0, "enable_replay_gain")),
     WidgetCombo(N_("Mode:"), WidgetInt(0, "replay_gain_mode"),
@@ -367,6 +397,10 @@ static const PreferencesWidget playlist_page_widgets[] = {
                 WidgetBool(0, "clear_playlist")),
     WidgetCheck(N_("Open files in a temporary playlist"),
                 WidgetBool(0, "open_to_temporary")),
+    WidgetCheck(N_("Decode the next song ahead of time"),
+                WidgetBool(0, "gapless_preroll")),
+    WidgetSpin(N_("Start decoding:"), WidgetInt(0, "preroll_seconds"),
+               {1, 30, 1, N_("seconds before the end")}, WIDGET_CHILD),
     WidgetLabel(N_("<b>Song Display</b>")),
     WidgetCheck(N_("Show song numbers"),
                 WidgetBool(0, "show_numbers_in_pl", send_title_change)),
@@ -415,6 +449,8 @@ static const PreferencesWidget advanced_page_widgets[] = {
     WidgetCheck(
         N_("Probe content of files with no recognized file name extension"),
         WidgetBool(0, "slow_probe")),
+    WidgetSpin(N_("Threads for reading metadata:"),
+               WidgetInt(0, "scan_threads"), {0, 32, 1, N_("(0 = automatic)")}),
     WidgetLabel(N_("<b>Miscellaneous</b>")),
     WidgetSpin(N_("Step forward/backward by:"), WidgetInt(0, "step_size"),
                {1, 60, 1, N_("seconds")}),
@@ -585,6 +621,22 @@ static void output_bit_depth_changed()
     aud_output_reset(OutputReset::ReopenStream);
 }
 
+static void output_thread_changed()
+{
+    aud_output_reset(OutputReset::ReopenStream);
+}
+
+static void effect_threads_changed()
+{
+    aud_output_reset(OutputReset::EffectsOnly);
+}
+
+static void low_latency_changed()
+{
+    /* the output buffering follows the setting by itself */
+    aud_output_reset(OutputReset::EffectsOnly);
+}
+
 static void create_category(QStackedWidget * notebook,
                             ArrayRef<PreferencesWidget> widgets)
 {